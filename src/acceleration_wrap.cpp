@@ -30,6 +30,8 @@ void RaytracingBuilderKHR::destroy()
     vkDestroyAccelerationStructureKHR(VK->m_device, m_tlas.accel, nullptr);
 
     m_blas.clear();
+    m_tlas = {};  // So the next scene's TLAS doesn't destroy it again
+
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -66,6 +68,7 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
 {
     //printf("RaytracingBuilderKHR::buildBlas (110)\n");
     auto         nbBlas = static_cast<uint32_t>(input.size());
+    if (nbBlas == 0) return;
     VkDeviceSize asTotalSize{0};     // Memory size of all allocated BLAS
     uint32_t     nbCompactions{0};   // Nb of BLAS requesting compaction
     VkDeviceSize maxScratchSize{0};  // Largest scratch size
@@ -102,6 +105,8 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
         }
 
     // Allocate the scratch buffers holding the temporary data of the acceleration structure builder
+    // (buildBlas runs again as a scene streams in; the last build's is done with)
+    VK->m_scratch1.destroy(VK->m_device);
     VK->m_scratch1 = VK->createBufferWrap(maxScratchSize,
                                     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
                                     | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
@@ -330,6 +335,10 @@ void RaytracingBuilderKHR::cmdCreateTlas(VkCommandBuffer                      cm
     // Create TLAS
     if(update == false)
         {
+            // Rebuilt as a scene streams in: the caller has waited for
+            // the frames using the previous one
+            m_tlas.bw.destroy(VK->m_device);
+            vkDestroyAccelerationStructureKHR(VK->m_device, m_tlas.accel, nullptr);
 
             VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
             createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
@@ -338,6 +347,7 @@ void RaytracingBuilderKHR::cmdCreateTlas(VkCommandBuffer                      cm
         }
 
     // Allocate the scratch memory
+    VK->m_scratch2.destroy(VK->m_device);
     VK->m_scratch2 = VK->createBufferWrap(sizeInfo.buildScratchSize,
                                               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
                                               | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
@@ -425,21 +435,24 @@ void RaytracingBuilderKHR::buildTlas(
     // Command buffer to create the TLAS
     VkCommandBuffer    cmdBuf = VK->createTempCmdBuffer();
 
-    // Create a buffer holding the actual instance data (matrices++) for use by the AS builder
-    BufferWrap instancesBuffer = VK->createStagedBufferWrap(cmdBuf, instances,
+    // Create a buffer holding the actual instance data (matrices++) for
+    // use by the AS builder.  Host visible, written here: it's rebuilt
+    // as a scene streams in, and is small.  (At least one instance's
+    // worth, as a buffer can't be empty; the build reads countInstance.)
+    VkDeviceSize instancesSize = std::max<size_t>(1, instances.size())*sizeof(VkAccelerationStructureInstanceKHR);
+    BufferWrap instancesBuffer = VK->createBufferWrap(instancesSize,
                                                       VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-                                                  | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+                                                  | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    void* dest;
+    vkMapMemory(m_device, instancesBuffer.memory, 0, instancesSize, 0, &dest);
+    memcpy(dest, instances.data(), instances.size()*sizeof(VkAccelerationStructureInstanceKHR));
+    vkUnmapMemory(m_device, instancesBuffer.memory);
+
     VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr,
         instancesBuffer.buffer};
     VkDeviceAddress           instBufferAddr = vkGetBufferDeviceAddress(m_device, &bufferInfo);
-    
-    // Make sure the copy of the instance buffer are copied before triggering the acceleration structure build
-    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-                         0, 1, &barrier, 0, nullptr, 0, nullptr);
 
     // Creating the TLAS
     cmdCreateTlas(cmdBuf, countInstance, instBufferAddr, flags, update, motion);
@@ -504,20 +517,23 @@ BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model)
     return input;
 }
 
-void VkApp::createRtAccelerationStructure()
+// One BLAS per object without one yet: all of them at start-up, or
+// those that streamed in since the last call.  BLAS i is object i's.
+void VkApp::createBottomLevelAS()
 {
-    //printf("VkApp::createRtAccelerationStructure (25)\n");
-    // BLAS - Storing each primitive in a geometry
     std::vector<BlasInput> allBlas;
-    allBlas.reserve(m_objData.size());
-    for (const auto& obj : m_objData)  {
-        BlasInput blas = objectToVkGeometryKHR(obj);
+    allBlas.reserve(m_objData.size() - m_rtBuilder.blasCount());
+    for (size_t i = m_rtBuilder.blasCount(); i < m_objData.size(); i++)  {
+        BlasInput blas = objectToVkGeometryKHR(m_objData[i]);
         // We could add more geometry in each BLAS, but we add only one for now
         allBlas.emplace_back(blas); }
 
     m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+}
 
-    // TLAS 
+// A new TLAS over all of m_objInst (which may be empty)
+void VkApp::createTopLevelAS()
+{
     std::vector<VkAccelerationStructureInstanceKHR> tlas;
     tlas.reserve(m_objInst.size());
     for(const ObjInst& inst : m_objInst) {
@@ -534,3 +550,9 @@ void VkApp::createRtAccelerationStructure()
                           false, false);
 }
 
+void VkApp::createRtAccelerationStructure()
+{
+    //printf("VkApp::createRtAccelerationStructure (25)\n");
+    createBottomLevelAS();
+    createTopLevelAS();
+}
@@ -67,6 +67,9 @@ public:
     // Return the Acceleration Structure Device Address of a BLAS Id
     VkDeviceAddress getBlasDeviceAddress(uint32_t blasId);
 
+    // Number of BLAS built so far
+    size_t blasCount() const { return m_blas.size(); }
+
     // Create all the BLAS from the vector of BlasInput
     void buildBlas(const std::vector<BlasInput>&        input,
                    VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
@@ -32,22 +32,94 @@ void drawGUI(VkApp& VK)
 
     // This needs a window if we want to dock it.
     ImGui::Begin("Debug");
+    static char scenePath[256] = "";
+    if (!scenePath[0])
+        snprintf(scenePath, sizeof(scenePath), "%s", VK.app->modelPath.c_str());
+    ImGui::InputText("##Scene", scenePath, sizeof(scenePath));
+    ImGui::SameLine();
+    if (ImGui::Button("Load"))
+        VK.loadScene(scenePath);  // Streams in, replacing the scene once parsed
+    ImGui::SliderInt("Texture MB", &VK.m_texBudgetMB, 16, 2048);  // Streamed levels' budget
+    ImGui::Text("Textures %.1f MB resident", VK.m_texResidentBytes / 1048576.0);
     ImGui::Checkbox("Raytrace", &VK.useRaytracer);
+    if (VK.m_hasRtPipeline) {
+        ImGui::RadioButton("Megakernel", &VK.rtBackend, eMegakernel);
+        ImGui::SameLine();
+        ImGui::RadioButton("Wavefront", &VK.rtBackend, eWavefront);
+        ImGui::SameLine(); }
+    if (VK.m_hasRayQuery)
+        ImGui::RadioButton("Ray query", &VK.rtBackend, eRayQuery);
+    ImGui::Checkbox("Specialized pipelines", &VK.useVariants);  // Megakernel, ray query, scanline
+    if (VK.m_postComputePipeline)
+        ImGui::Checkbox("Compute post", &VK.useComputePost);  // Else post.frag's render pass
+    if (VK.m_asyncTimeline)
+        ImGui::Checkbox("Async compute", &VK.useAsyncCompute);  // Denoise and post on the compute queue
     ImGui::SliderFloat("RussianRoulette", &VK.m_pcRay.rr,0.0f, 1.0f);
+    ImGui::SliderInt("Min depth", &VK.m_pcRay.minDepth, 1, 16);
+    ImGui::SliderInt("Max depth", &VK.m_pcRay.maxDepth, 1, 64);
 
     ImGui::Checkbox("Explicit Lights", &VK.useExplicit);
+    ImGui::Text("MIS");
+    ImGui::SameLine();
+    ImGui::RadioButton("0.5/0.5", &VK.m_pcRay.mis, eMisHalf);
+    ImGui::SameLine();
+    ImGui::RadioButton("Balance", &VK.m_pcRay.mis, eMisBalance);
+    ImGui::SameLine();
+    ImGui::RadioButton("Power", &VK.m_pcRay.mis, eMisPower);
+    ImGui::Checkbox("ReSTIR direct light", &VK.useRestir);  // Megakernel and ray query backends
+    ImGui::SameLine();
+    ImGui::SliderInt("Candidates", &VK.m_pcRay.restirCandidates, 1, 32);
+    ImGui::Text("Sampler");
+    ImGui::SameLine();
+    ImGui::RadioButton("Random", &VK.sampler, eSamplerRandom);
+    ImGui::SameLine();
+    ImGui::RadioButton("Sobol", &VK.sampler, eSamplerSobol);
+    ImGui::SameLine();
+    ImGui::RadioButton("Blue noise", &VK.sampler, eSamplerBlueNoise);
+    ImGui::Checkbox("Hybrid G-buffer", &VK.useHybrid);  // Megakernel and ray query backends
+    ImGui::SameLine();
+    ImGui::Checkbox("Checkerboard", &VK.useCheckerboard);  // Megakernel and ray query backends
+    ImGui::Checkbox("Adaptive", &VK.useAdaptive);  // Megakernel and ray query backends
+    ImGui::SameLine();
+    ImGui::SliderFloat("Error", &VK.m_pcRay.adaptiveThreshold, 0.001f, 0.1f, "%.3f");
+    ImGui::SliderInt("Max spp", &VK.m_pcRay.adaptiveMaxSpp, 1, 16);
     ImGui::SliderFloat("N threshold", &VK.f_nThreshold, 0.0f,1.0f);
     ImGui::SliderFloat("D threshold", &VK.f_dThreshold, 0.0f,1.0f);
 
     ImGui::Checkbox("History ", &VK.useHistory);
+    ImGui::SameLine();
+    ImGui::SliderInt("History cap", &VK.m_pcRay.historyCap, 1, 256);  // While moving
 
     ImGui::Checkbox("Denoise ", &VK.useDenoise);
     ImGui::SameLine();
     ImGui::SliderInt("Atrous iterations", &VK.m_num_atrous_iterations,0,10);
     ImGui::SliderFloat("N factor", &VK.f_normFactor, 0.0f,1.0f);
     ImGui::SliderFloat("D factor", &VK.f_depthFactor, 0.0f,1.0f);
-    ImGui::SliderFloat("L factor", &VK.f_lumenFactor, 0.0f,1.0f);
+    ImGui::SliderFloat("L factor", &VK.f_lumenFactor, 0.0f,16.0f);
     ImGui::Checkbox("Demodulate ", &VK.useDemodulate);
+    ImGui::SameLine();
+    ImGui::Checkbox("Variance guided", &VK.useVarianceGuided);
+    ImGui::RadioButton("Per iteration", &VK.denoiseSchedule, eDenoisePerIteration);
+    ImGui::SameLine();
+    ImGui::RadioButton("Fused", &VK.denoiseSchedule, eDenoiseFused);
+    ImGui::SameLine();
+    if (ImGui::Button("Benchmark"))
+        VK.runDenoiseBenchmark = true;  // Prints its timings
+    ImGui::SameLine();
+    if (ImGui::Button("CPU compare"))
+        VK.runCpuDenoiseCompare = true;  // Prints the differences, and the CPU's Mpix/s
+    // Packed screen targets, where the device can store them (vkapp_formats.cpp)
+    ImGui::Checkbox("Pack Nd", &VK.packNd);
+    ImGui::SameLine();
+    ImGui::Checkbox("Pack Kd", &VK.packKd);
+    ImGui::SameLine();
+    ImGui::Checkbox("Pack samples", &VK.packSample);
+    if (VK.m_denoisePipelineX16) {
+        ImGui::SameLine();
+        ImGui::Checkbox("FP16 denoise", &VK.useFp16Denoise); }
+    ImGui::SameLine();
+    if (ImGui::Button("Precision compare"))
+        VK.runPrecisionCompare = true;  // Prints full against packed: times, and the difference
     ImGui::Text("Iterations %d", VK.currIterations);
     ImGui::Text("Rate %.3f ms/frame (%.1f FPS)",
                 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
@@ -209,12 +281,16 @@ App::App(int argc, char** argv)
 {
     doApiDump = false;
     m_show_gui = true;
+    modelPath = "models/living_room.obj";
 
+    // rtrt [-d] [model]
     int argi = 1;
     while (argi<argc) {
         std::string arg = argv[argi++];
         if (arg == "-d")
             doApiDump = true;
+        else if (arg[0] != '-')
+            modelPath = arg;
         else {
             printf("Unknown argument: %s\n", arg.c_str());
             exit(-1); } }
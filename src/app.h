@@ -1,4 +1,5 @@
 
+#include <string>
 #include "camera.h"
 
 class App
@@ -7,6 +8,7 @@ public:
     GLFWwindow* GLFW_window;
     App(int argc, char** argv);
     bool doApiDump;
+    std::string modelPath;  // The scene loaded at start-up
     
     bool m_show_gui;
     Camera myCamera;
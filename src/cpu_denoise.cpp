@@ -0,0 +1,352 @@
+// The A-Trous denoiser on the CPU.  See cpu_denoise.h.
+//
+// The image is held as planes (one float array per channel) so that
+// a row of taps is one unaligned vector load.  Each iteration reads
+// the demodulated color, luminance and variance planes of the last,
+// and writes those of the next; the Kd, normal and depth planes are
+// fixed.  The shader's separate edge-stopping exponentials are
+// combined into one exp of their sum.
+//
+// A pixel whose taps could fall outside the image (within two step
+// widths of the left or right edge) is filtered one at a time, as the
+// shader does, skipping those taps; the rest of its row a vector of
+// pixels at a time, with no checks.
+
+#include <cmath>
+#include <algorithm>
+
+#include "cpu_denoise.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// ThreadPool
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+    for (unsigned i = 1; i < std::max(threads, 1u); i++)
+        m_workers.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_startCv.notify_all();
+    for (std::thread& thread : m_workers)
+        thread.join();
+}
+
+void ThreadPool::run(int count, const std::function<void(int)>& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task  = &task;
+        m_count = count;
+        m_next  = 0;
+        m_busy  = unsigned(m_workers.size());
+        m_batch++;
+    }
+    m_startCv.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCv.wait(lock, [this]() { return m_busy == 0; });
+}
+
+void ThreadPool::worker()
+{
+    unsigned long batch = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_startCv.wait(lock, [&]() { return m_quit || m_batch != batch; });
+            if (m_quit) return;
+            batch = m_batch;
+        }
+
+        work();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busy == 0)
+            m_doneCv.notify_one();
+    }
+}
+
+void ThreadPool::work()
+{
+    for (int i = m_next++; i < m_count; i = m_next++)
+        (*m_task)(i);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Lanes: a vector of pixels in a row, with the few operations the
+// filter needs.  Plain floats have the same operations, for the
+// pixels done one at a time.
+
+namespace {
+
+#if defined(__AVX2__)
+
+const char* isaName = "AVX2";
+const int LANES = 8;
+struct Lanes { __m256 v; };
+inline Lanes load(const float* p)        { return {_mm256_loadu_ps(p)}; }
+inline void  store(float* p, Lanes a)    { _mm256_storeu_ps(p, a.v); }
+inline Lanes splat(float f)              { return {_mm256_set1_ps(f)}; }
+inline Lanes operator+(Lanes a, Lanes b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline Lanes operator-(Lanes a, Lanes b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline Lanes operator*(Lanes a, Lanes b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline Lanes operator/(Lanes a, Lanes b) { return {_mm256_div_ps(a.v, b.v)}; }
+inline Lanes sqrt(Lanes a)               { return {_mm256_sqrt_ps(a.v)}; }
+inline Lanes abs(Lanes a)                { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+inline Lanes max(Lanes a, Lanes b)       { return {_mm256_max_ps(a.v, b.v)}; }
+inline Lanes min(Lanes a, Lanes b)       { return {_mm256_min_ps(a.v, b.v)}; }
+inline Lanes roundNearest(Lanes a)
+    { return {_mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)}; }
+inline Lanes pow2(Lanes n)  // 2^n for integral n in the float exponent range
+    { __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127));
+      return {_mm256_castsi256_ps(_mm256_slli_epi32(e, 23))}; }
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+const char* isaName = "NEON";
+const int LANES = 4;
+struct Lanes { float32x4_t v; };
+inline Lanes load(const float* p)        { return {vld1q_f32(p)}; }
+inline void  store(float* p, Lanes a)    { vst1q_f32(p, a.v); }
+inline Lanes splat(float f)              { return {vdupq_n_f32(f)}; }
+inline Lanes operator+(Lanes a, Lanes b) { return {vaddq_f32(a.v, b.v)}; }
+inline Lanes operator-(Lanes a, Lanes b) { return {vsubq_f32(a.v, b.v)}; }
+inline Lanes operator*(Lanes a, Lanes b) { return {vmulq_f32(a.v, b.v)}; }
+inline Lanes operator/(Lanes a, Lanes b) { return {vdivq_f32(a.v, b.v)}; }
+inline Lanes sqrt(Lanes a)               { return {vsqrtq_f32(a.v)}; }
+inline Lanes abs(Lanes a)                { return {vabsq_f32(a.v)}; }
+inline Lanes max(Lanes a, Lanes b)       { return {vmaxq_f32(a.v, b.v)}; }
+inline Lanes min(Lanes a, Lanes b)       { return {vminq_f32(a.v, b.v)}; }
+inline Lanes roundNearest(Lanes a)       { return {vrndnq_f32(a.v)}; }
+inline Lanes pow2(Lanes n)
+    { int32x4_t e = vaddq_s32(vcvtq_s32_f32(n.v), vdupq_n_s32(127));
+      return {vreinterpretq_f32_s32(vshlq_n_s32(e, 23))}; }
+
+#else
+
+const char* isaName = "scalar";
+const int LANES = 1;
+struct Lanes { float v; };
+inline Lanes load(const float* p)        { return {*p}; }
+inline void  store(float* p, Lanes a)    { *p = a.v; }
+inline Lanes splat(float f)              { return {f}; }
+inline Lanes operator+(Lanes a, Lanes b) { return {a.v + b.v}; }
+inline Lanes operator-(Lanes a, Lanes b) { return {a.v - b.v}; }
+inline Lanes operator*(Lanes a, Lanes b) { return {a.v * b.v}; }
+inline Lanes operator/(Lanes a, Lanes b) { return {a.v / b.v}; }
+inline Lanes sqrt(Lanes a)               { return {std::sqrt(a.v)}; }
+inline Lanes abs(Lanes a)                { return {std::fabs(a.v)}; }
+inline Lanes max(Lanes a, Lanes b)       { return {std::max(a.v, b.v)}; }
+inline Lanes min(Lanes a, Lanes b)       { return {std::min(a.v, b.v)}; }
+inline Lanes roundNearest(Lanes a)       { return {std::nearbyint(a.v)}; }
+inline Lanes pow2(Lanes n)               { return {std::ldexp(1.0f, int(n.v))}; }
+
+#endif
+
+// e^x: 2^n e^r, with n = round(x/ln 2) and |r| <= ln 2/2 by a degree 6
+// polynomial (a few ulp).  The filter only needs x <= 0; below -87
+// the result flushes to about 1e-38.
+inline Lanes exp(Lanes x)
+{
+    x = max(min(x, splat(88.0f)), splat(-87.0f));
+    Lanes n = roundNearest(x * splat(1.44269504f));
+    Lanes r = x - n*splat(0.693359375f) - n*splat(-2.12194440e-4f);  // ln 2 in two parts
+    Lanes p = splat(1.0f/720.0f);
+    p = p*r + splat(1.0f/120.0f);
+    p = p*r + splat(1.0f/24.0f);
+    p = p*r + splat(1.0f/6.0f);
+    p = p*r + splat(0.5f);
+    p = p*r + splat(1.0f);
+    p = p*r + splat(1.0f);
+    return p * pow2(n);
+}
+
+inline float load(const float* p, float)  { return *p; }
+inline Lanes load(const float* p, Lanes)  { return load(p); }
+inline void  store(float* p, float a)     { *p = a; }
+inline float splat(float f, float)        { return f; }
+inline Lanes splat(float f, Lanes)        { return splat(f); }
+inline float sqrt(float a)                { return std::sqrt(a); }
+inline float abs(float a)                 { return std::fabs(a); }
+inline float exp(float x)                 { return std::exp(x); }
+
+////////////////////////////////////////////////////////////////////////
+// The filter
+
+// The fixed planes
+struct Surface
+{
+    std::vector<float> kr, kg, kb;  // Demodulation (Kd + 0.1, or 1)
+    std::vector<float> nx, ny, nz, depth;
+};
+
+// The planes each iteration reads, and writes for the next
+struct Signal
+{
+    std::vector<float> r, g, b;  // Demodulated color
+    std::vector<float> lum;      // Luminance, not demodulated
+    std::vector<float> var;      // Variance
+    void resize(size_t n) { r.resize(n); g.resize(n); b.resize(n); lum.resize(n); var.resize(n); }
+};
+
+const float kernel[5] = {1.0f/16.0f, 4.0f/16.0f, 6.0f/16.0f, 4.0f/16.0f, 1.0f/16.0f};
+
+// As the shader's luminance()
+template <class T> T luminance(T r, T g, T b)
+{
+    return r*splat(0.2126f, r) + g*splat(0.7152f, r) + b*splat(0.0722f, r);
+}
+
+// Filter the pixel at (x,y), or LANES of them from there (T = Lanes),
+// at step width s.  With checkX, taps left or right of the image are
+// skipped; without, there must be none.
+template <class T, bool checkX>
+void filterAt(int width, int height, const Surface& surface, const Signal& in, Signal& next,
+              const CpuDenoiseParams& params, int x, int y, int s)
+{
+    const T zero = splat(0.0f, T());
+    size_t c = size_t(y)*width + x;
+    T lval = load(&in.lum[c], T());
+    T dval = load(&surface.depth[c], T());
+    T nx = load(&surface.nx[c], T()), ny = load(&surface.ny[c], T()), nz = load(&surface.nz[c], T());
+
+    // The center's variance, blurred 3x3 over its neighbours s apart
+    T gvar = zero;
+    for (int j = -1; j <= 1; j++) {
+        int yy = y + j*s;
+        if (yy < 0 || yy >= height) continue;
+        for (int i = -1; i <= 1; i++) {
+            int xx = x + i*s;
+            if (checkX && (xx < 0 || xx >= width)) continue;
+            float blur = (2 - std::abs(i))*(2 - std::abs(j))/16.0f;
+            gvar = gvar + splat(blur, T())*load(&in.var[size_t(yy)*width + xx], T()); } }
+    T lumenScale = splat(params.lumenFactor, T())*sqrt(gvar) + splat(1e-6f, T());
+
+    T sumR = zero, sumG = zero, sumB = zero, cum_w = zero, sumVar = zero;
+    const T depthFactor = splat(params.depthFactor, T());
+    const T normFactor  = splat(float(s*s)*params.normFactor, T());
+    for (int j = -2; j <= 2; j++) {
+        int yy = y + j*s;
+        if (yy < 0 || yy >= height) continue;
+        for (int i = -2; i <= 2; i++) {
+            int xx = x + i*s;
+            if (checkX && (xx < 0 || xx >= width)) continue;
+            size_t t = size_t(yy)*width + xx;
+
+            // The edge-stopping functions' exponents, summed
+            T dd = load(&surface.depth[t], T()) - dval;
+            T dnx = nx - load(&surface.nx[t], T());
+            T dny = ny - load(&surface.ny[t], T());
+            T dnz = nz - load(&surface.nz[t], T());
+            T exponent = zero - dd*dd/depthFactor - (dnx*dnx + dny*dny + dnz*dnz)/normFactor;
+            if (params.varianceGuided)
+                exponent = exponent - abs(load(&in.lum[t], T()) - lval)/lumenScale;
+
+            T weight = splat(kernel[i+2]*kernel[j+2], T())*exp(exponent);
+            sumR = sumR + load(&in.r[t], T())*weight;
+            sumG = sumG + load(&in.g[t], T())*weight;
+            sumB = sumB + load(&in.b[t], T())*weight;
+            cum_w = cum_w + weight;
+            sumVar = sumVar + weight*weight*load(&in.var[t], T()); } }
+
+    // The center's own weight is never 0, so neither is cum_w
+    T r = sumR/cum_w, g = sumG/cum_w, b = sumB/cum_w;
+    store(&next.r[c], r);
+    store(&next.g[c], g);
+    store(&next.b[c], b);
+    store(&next.var[c], sumVar/(cum_w*cum_w));
+    store(&next.lum[c], luminance(r*load(&surface.kr[c], T()),
+                                  g*load(&surface.kg[c], T()),
+                                  b*load(&surface.kb[c], T())));
+}
+
+void filterRow(int width, int height, const Surface& surface, const Signal& in, Signal& next,
+               const CpuDenoiseParams& params, int y, int s)
+{
+    // Pixels within 2s of the left or right edge one at a time, the
+    // ones between LANES at a time
+    int left = std::min(2*s, width);
+    int right = std::max(width - 2*s, left);
+    int x = 0;
+    for (; x < left; x++)
+        filterAt<float, true>(width, height, surface, in, next, params, x, y, s);
+    for (; x + LANES <= right; x += LANES)
+        filterAt<Lanes, false>(width, height, surface, in, next, params, x, y, s);
+    for (; x < width; x++)
+        filterAt<float, true>(width, height, surface, in, next, params, x, y, s);
+}
+
+}  // namespace
+
+void cpuDenoise(int width, int height, const float* color, const float* kd,
+                const float* nd, const float* moments, const CpuDenoiseParams& params,
+                float* out, ThreadPool& pool)
+{
+    size_t n = size_t(width)*height;
+    Surface surface;
+    Signal signal, next;
+    surface.kr.resize(n);  surface.kg.resize(n);  surface.kb.resize(n);
+    surface.nx.resize(n);  surface.ny.resize(n);  surface.nz.resize(n);  surface.depth.resize(n);
+    signal.resize(n);
+    next.resize(n);
+
+    // Bands of rows: a few per thread, to even out the load
+    int bands = std::min(height, int(pool.size())*4);
+    auto rows = [&](int band, int& y0, int& y1) {
+        y0 = int(int64_t(height)*band/bands);
+        y1 = int(int64_t(height)*(band + 1)/bands); };
+
+    // To planes, demodulated
+    pool.run(bands, [&](int band) {
+        int y0, y1;
+        rows(band, y0, y1);
+        for (size_t c = size_t(y0)*width; c < size_t(y1)*width; c++) {
+            const float* C = &color[4*c];
+            float k[3] = {1.0f, 1.0f, 1.0f};
+            if (params.demodulate)
+                for (int i = 0; i < 3; i++) k[i] = kd[4*c + i] + 0.1f;
+            surface.kr[c] = k[0];  surface.kg[c] = k[1];  surface.kb[c] = k[2];
+            surface.nx[c] = nd[4*c];  surface.ny[c] = nd[4*c + 1];  surface.nz[c] = nd[4*c + 2];
+            surface.depth[c] = nd[4*c + 3];
+            signal.r[c] = C[0]/k[0];  signal.g[c] = C[1]/k[1];  signal.b[c] = C[2]/k[2];
+            signal.lum[c] = luminance(C[0], C[1], C[2]);
+            signal.var[c] = moments[4*c + 2]; } });
+
+    for (int a = 0; a < params.iterations; a++) {
+        int s = 1 << a;
+        pool.run(bands, [&](int band) {
+            int y0, y1;
+            rows(band, y0, y1);
+            for (int y = y0; y < y1; y++)
+                filterRow(width, height, surface, signal, next, params, y, s); });
+        std::swap(signal, next); }
+
+    // Re-modulated, back to RGBA
+    pool.run(bands, [&](int band) {
+        int y0, y1;
+        rows(band, y0, y1);
+        for (size_t c = size_t(y0)*width; c < size_t(y1)*width; c++) {
+            out[4*c]     = signal.r[c]*surface.kr[c];
+            out[4*c + 1] = signal.g[c]*surface.kg[c];
+            out[4*c + 2] = signal.b[c]*surface.kb[c];
+            out[4*c + 3] = signal.var[c]; } });
+}
+
+const char* cpuDenoiseIsa()
+{
+    return isaName;
+}
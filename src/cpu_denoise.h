@@ -0,0 +1,70 @@
+#pragma once
+
+// The A-Trous denoiser on the CPU: the algorithm of denoiseX.comp
+// (demodulation by Kd, the 5x5 {1,4,6,4,1} kernel, luminance, normal
+// and depth edge stopping, the variance filtered alongside, step width
+// doubling each iteration), for post-processing renders without a GPU
+// and for checking the GPU's output.
+//
+// Vectorized along rows with AVX2 (8 pixels) or NEON (4 pixels), as
+// the compiler targets, else one pixel at a time; parallel over bands
+// of rows on a ThreadPool.  No Vulkan: just arrays of floats.
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+struct CpuDenoiseParams
+{
+    float normFactor;
+    float depthFactor;
+    float lumenFactor;
+    bool  demodulate;
+    bool  varianceGuided;
+    int   iterations;  // Step widths 1, 2, 4, ...
+};
+
+// A fixed set of worker threads, for running a batch of tasks and
+// waiting for them all; the calling thread works on the batch too.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threads);  // Threads in all, the caller's included
+    ~ThreadPool();
+
+    unsigned size() const { return unsigned(m_workers.size()) + 1; }
+
+    // Run task(0) ... task(count-1), and return when they're all done
+    void run(int count, const std::function<void(int)>& task);
+
+private:
+    void worker();
+    void work();  // Take tasks of the current batch until there are none
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_startCv, m_doneCv;
+    const std::function<void(int)>* m_task = nullptr;
+    int m_count = 0;
+    std::atomic<int> m_next{0};
+    unsigned m_busy = 0;           // Workers still on the current batch
+    unsigned long m_batch = 0;     // Counts batches, to wake the workers
+    bool m_quit = false;
+};
+
+// Denoise a width x height image.  Every image is RGBA float, row
+// after row, as the GPU's rgba32f images read back:
+//   color:    the radiance to denoise (the temporal pass's colCurr)
+//   kd:       first hit albedo (KdCurr)
+//   nd:       first hit normal and depth (NdCurr)
+//   moments:  .z is the luminance variance (eLumMomCurr)
+//   out:      the denoised radiance, and its filtered variance in .w
+void cpuDenoise(int width, int height, const float* color, const float* kd,
+                const float* nd, const float* moments, const CpuDenoiseParams& params,
+                float* out, ThreadPool& pool);
+
+// The instruction set cpuDenoise was built for: "AVX2", "NEON" or "scalar"
+const char* cpuDenoiseIsa();
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "render_graph.h"
+
+// Accesses that write.  (Anything else only reads.)
+static const VkAccessFlags2 writeAccesses = VK_ACCESS_2_SHADER_WRITE_BIT
+    | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT
+    | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT
+    | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+    | VK_ACCESS_2_TRANSFER_WRITE_BIT
+    | VK_ACCESS_2_HOST_WRITE_BIT
+    | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+int RenderGraph::addImage(const std::string& name, ImageWrap* wrap, bool transient,
+                          VkImageLayout layout)
+{
+    Image image;
+    image.name      = name;
+    image.wrap      = wrap;
+    image.transient = transient;
+    if (!transient)
+        image.layout = layout;
+    images.push_back(image);
+    return int(images.size()) - 1;
+}
+
+int RenderGraph::addPass(const std::string& name, const std::vector<Access>& accesses)
+{
+    passes.push_back({name, accesses});
+    return int(passes.size()) - 1;
+}
+
+void RenderGraph::allocate(VkDevice device, VkPhysicalDevice physicalDevice)
+{
+    // Each transient image lives from the first pass using it to the last
+    for (int p = 0; p < int(passes.size()); p++)
+        for (const Access& a : passes[p].accesses) {
+            Image& image = images[a.image];
+            if (image.first < 0)
+                image.first = p;
+            image.last = p; }
+
+    std::vector<int> transients;
+    std::vector<VkMemoryRequirements> requirements(images.size());
+    for (int i = 0; i < int(images.size()); i++) {
+        if (!images[i].transient)
+            continue;
+        vkGetImageMemoryRequirements(device, images[i].wrap->image, &requirements[i]);
+        transients.push_back(i); }
+    if (transients.empty())
+        return;
+
+    // Largest first, each into the first slot whose images all live in
+    // other passes than its own (or a new slot)
+    std::stable_sort(transients.begin(), transients.end(), [&](int a, int b) {
+        return requirements[a].size > requirements[b].size; });
+
+    VkDeviceSize unaliased = 0;
+    uint32_t memoryTypeBits = ~0u;
+    for (int i : transients) {
+        Image& image = images[i];
+        unaliased += requirements[i].size;
+        memoryTypeBits &= requirements[i].memoryTypeBits;
+
+        for (int s = 0; s < int(slots.size()) && image.slot < 0; s++) {
+            bool overlaps = false;
+            for (int j : slots[s].images)
+                overlaps |= !(images[j].last < image.first || image.last < images[j].first);
+            if (!overlaps)
+                image.slot = s; }
+        if (image.slot < 0) {
+            image.slot = int(slots.size());
+            slots.push_back({}); }
+
+        Slot& slot = slots[image.slot];
+        slot.images.push_back(i);
+        slot.size = std::max(slot.size, requirements[i].size); }
+
+    VkDeviceSize size = 0;
+    for (Slot& slot : slots) {
+        VkDeviceSize alignment = 1;
+        for (int j : slot.images)
+            alignment = std::max(alignment, requirements[j].alignment);
+        slot.offset = (size + alignment - 1) / alignment * alignment;
+        size = slot.offset + slot.size; }
+
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    uint32_t memoryType = ~0u;
+    for (uint32_t t = 0; t < memProperties.memoryTypeCount && memoryType == ~0u; t++)
+        if ((memoryTypeBits & (1u << t))
+            && (memProperties.memoryTypes[t].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+            memoryType = t;
+    if (memoryType == ~0u)
+        throw std::runtime_error("no memory type for the render graph's transient images!");
+
+    VkMemoryAllocateInfo allocInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    allocInfo.allocationSize  = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        throw std::runtime_error("failed to allocate the render graph's transient images!");
+
+    for (int i : transients)
+        vkBindImageMemory(device, images[i].wrap->image, memory, slots[images[i].slot].offset);
+
+    printf("Render graph: %d transient images in %d slots, %.1f MB (%.1f MB unaliased)\n",
+           int(transients.size()), int(slots.size()),
+           size/(1024.0*1024.0), unaliased/(1024.0*1024.0));
+}
+
+void RenderGraph::newFrame()
+{
+    for (Image& image : images)
+        if (image.transient)
+            image.alive = false;
+}
+
+void RenderGraph::begin(VkCommandBuffer cmd, int pass)
+{
+    access(cmd, passes[pass].accesses);
+}
+
+// The barriers for these accesses, against everything recorded before:
+// a read after a write (unless the write's already visible to it), a
+// write after either, and a layout change.  A transient image's first
+// use this frame discards its contents, and waits instead on whatever
+// last used its slot.
+void RenderGraph::access(VkCommandBuffer cmd, const std::vector<Access>& accesses)
+{
+    std::vector<VkImageMemoryBarrier2> barriers;
+    for (const Access& a : accesses) {
+        Image& image = images[a.image];
+        VkAccessFlags2 writes = a.access & writeAccesses;
+        VkAccessFlags2 reads  = a.access & ~writeAccesses;
+
+        VkImageMemoryBarrier2 barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+        barrier.dstStageMask        = a.stages;
+        barrier.dstAccessMask       = a.access;
+        barrier.oldLayout           = image.layout;
+        barrier.newLayout           = a.layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image               = image.wrap->image;
+        barrier.subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS,
+                                       0, VK_REMAINING_ARRAY_LAYERS};
+
+        bool needed;
+        if (image.transient && !image.alive) {
+            Slot& slot = slots[image.slot];
+            barrier.srcStageMask  = slot.stages;
+            barrier.srcAccessMask = slot.writeAccess;
+            barrier.oldLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+            slot.stages = slot.writeAccess = 0;
+            image.alive = true;
+            image.writeStages = image.writeAccess = image.readStages = image.readAccess = 0;
+            needed = true; }
+        else {
+            bool layout = image.layout != a.layout;
+            bool raw = image.writeStages && reads
+                && ((a.stages & ~image.readStages) || (reads & ~image.readAccess));
+            bool waw = image.writeStages && writes;
+            bool war = image.readStages && writes;
+            barrier.srcStageMask  = image.writeStages | (writes || layout ? image.readStages : 0);
+            barrier.srcAccessMask = image.writeAccess;
+            needed = layout || raw || waw || war; }
+
+        if (needed)
+            barriers.push_back(barrier);
+
+        image.layout = a.layout;
+        if (writes) {
+            image.writeStages = a.stages;
+            image.writeAccess = writes;
+            image.readStages = image.readAccess = 0; }
+        else {
+            image.readStages |= a.stages;
+            image.readAccess |= reads; }
+        if (image.transient) {
+            slots[image.slot].stages      |= a.stages;
+            slots[image.slot].writeAccess |= writes; } }
+
+    if (barriers.empty())
+        return;
+    VkDependencyInfo dependency{VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependency.imageMemoryBarrierCount = uint32_t(barriers.size());
+    dependency.pImageMemoryBarriers    = barriers.data();
+    vkCmdPipelineBarrier2(cmd, &dependency);
+}
+
+void RenderGraph::destroy(VkDevice device)
+{
+    for (Image& image : images)
+        if (image.transient) {
+            image.wrap->destroy(device);  // (Its memory is the graph's)
+            *image.wrap = {}; }
+    vkFreeMemory(device, memory, nullptr);
+    memory = VK_NULL_HANDLE;
+}
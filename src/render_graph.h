@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "image_wrap.h"
+
+// A small render graph: the frame's passes, declared once in the order
+// they run, each with the images it reads and writes.  begin(pass)
+// records the barriers that pass needs, from what's been recorded since
+// newFrame, as one vkCmdPipelineBarrier2.  Transient images (whose
+// contents don't outlive the frame) share memory with any others whose
+// passes don't overlap theirs.
+class RenderGraph
+{
+public:
+    // An image, and how a pass uses it
+    struct Access
+    {
+        int                   image;
+        VkPipelineStageFlags2 stages;
+        VkAccessFlags2        access;
+        VkImageLayout         layout = VK_IMAGE_LAYOUT_GENERAL;
+    };
+
+    struct Image
+    {
+        std::string name;
+        ImageWrap*  wrap;
+        bool        transient;
+        int         slot = -1;            // Of the shared memory, if transient
+        int         first = -1, last = -1;  // The passes using it, if transient
+
+        // What's recorded since newFrame
+        bool                  alive = false;  // Its contents are this frame's
+        VkImageLayout         layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags2 writeStages = 0;
+        VkAccessFlags2        writeAccess = 0;
+        VkPipelineStageFlags2 readStages = 0;   // Since the write, made visible to
+        VkAccessFlags2        readAccess = 0;
+    };
+
+    struct Pass
+    {
+        std::string         name;
+        std::vector<Access> accesses;
+    };
+
+    // A range of the shared memory, and every use of it since the last
+    // image placed there took it over
+    struct Slot
+    {
+        VkDeviceSize          offset = 0, size = 0;
+        std::vector<int>      images;
+        VkPipelineStageFlags2 stages = 0;
+        VkAccessFlags2        writeAccess = 0;
+    };
+
+    std::vector<Image> images;
+    std::vector<Pass>  passes;
+    std::vector<Slot>  slots;
+    VkDeviceMemory     memory{};  // The transient images'
+
+    // A persistent image is in layout when the first pass is recorded.
+    // (It needn't be created yet.)  A transient one is created, not
+    // bound, before allocate.
+    int addImage(const std::string& name, ImageWrap* wrap, bool transient,
+                 VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL);
+    int addPass(const std::string& name, const std::vector<Access>& accesses);
+
+    // Places the transient images (created, not yet bound) and binds them
+    void allocate(VkDevice device, VkPhysicalDevice physicalDevice);
+
+    // The transient images' contents are gone
+    void newFrame();
+    void begin(VkCommandBuffer cmd, int pass);
+    void access(VkCommandBuffer cmd, const std::vector<Access>& accesses);
+
+    // The transient images and their memory
+    void destroy(VkDevice device);
+};
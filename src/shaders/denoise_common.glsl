@@ -0,0 +1,67 @@
+// The denoiser's bindings, and the A-Trous weights its kernels share
+// (denoiseX.comp: one iteration; denoise_fused.comp: the first two).
+
+layout(set = 0, binding = 0, rgba32f) uniform image2D images[3];  // DENOISE_IMAGE_*: pc.src to pc.dst
+layout(set = 0, binding = 1) uniform image2D kdBuff;  // Full precision, or packed: their format is the image's
+layout(set = 0, binding = 2) uniform image2D ndBuff;  // Octahedral normal, depth (nd_packing.glsl)
+layout(set = 0, binding = 3, rgba32f) uniform image2D varBuff;  // Temporal moments; .z is the variance
+
+layout(push_constant) uniform _pcDenoise { PushConstantDenoise pc; };
+
+#include "nd_packing.glsl"
+
+float kernel[5] = float[5](1.0/16.0, 4.0/16.0, 6.0/16.0, 4.0/16.0, 1.0/16.0);
+
+// Variance guidance (SVGF): the luminance edge-stopping function is
+// scaled by the standard deviation of the center pixel's luminance, so
+// noise (a difference within a few sigma) is smoothed and a lighting
+// edge (many sigma) is kept.  The first iteration reads the variance
+// from the temporal pass; each iteration filters it alongside the
+// color (weights squared, as for the variance of a weighted average)
+// and passes it to the next in the output's .w.
+
+float luminance(vec3 c)
+{
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 demodulation(ivec2 p)
+{
+    return pc.demodulate ? imageLoad(kdBuff, p).xyz + vec3(0.1) : vec3(1);  // firsthit Kd color
+}
+
+bool insideImage(ivec2 p, ivec2 size)
+{
+    return p.x >= 0 && p.y >= 0 && p.x < size.x && p.y < size.y;
+}
+
+// The center's variance is blurred 3x3 against its own noise, with
+// these weights, before it scales the luminance edge-stopping function
+float blurWeight(int i, int j)
+{
+    return (2-abs(i))*(2-abs(j))/16.0;
+}
+
+float lumenScale(float blurredVariance)
+{
+    return pc.lumenFactor*sqrt(blurredVariance) + 1e-6;
+}
+
+// The weight of a tap at kernel index (i,j), step width s, with normal
+// and depth oNd and luminance ol, for the center's nval, dval, lval
+float tapWeight(int i, int j, int s, vec4 oNd, float ol,
+                vec3 nval, float dval, float lval, float lscale)
+{
+    // The weight is the product of
+    //  two Gaussian weights {1,4,6,4,1}/16 indexed by i+2 and j+2
+    //  a color edge-stopping function
+    //  a depth edge-stopping function
+    //  a normal edge-stopping function
+    float pixWeight = kernel[i+2] * kernel[j+2];
+    float luminanceEdge = pc.varianceGuided ? exp(-abs(ol - lval)/lscale) : 1.0;
+    float dz = oNd.w - dval;  // Squared by hand: GLSL's pow is undefined for a negative base
+    float depthEdge = exp(- dz*dz/pc.depthFactor );
+    float normalEdge = exp(- dot(nval-oNd.xyz,nval-oNd.xyz)/(s*s*pc.normFactor));
+
+    return pixWeight*luminanceEdge*normalEdge *depthEdge;
+}
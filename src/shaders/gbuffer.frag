@@ -0,0 +1,30 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+
+// G-buffer pass of the hybrid renderer: what a camera ray through the
+// pixel center would return, as the path tracer's payload has it.
+// Normal, texture coordinates and Kd are looked up from the IDs, as
+// for a traced hit.
+
+#include "shared_structs.h"
+
+layout(push_constant) uniform _PushConstantGBuffer
+{
+  PushConstantGBuffer pcGBuffer;
+};
+
+layout(location = 1) in vec3 worldPos;
+layout(location = 2) flat in vec3 eye;
+
+layout(location = 0) out vec4  gbPos;  // World position, and distance from the eye
+layout(location = 1) out uvec2 gbIds;  // Instance index + 1 (0: nothing hit), primitive index
+
+void main()
+{
+  gbPos = vec4(worldPos, length(worldPos - eye));
+  gbIds = uvec2(pcGBuffer.instanceIndex + 1, gl_PrimitiveID);
+}
@@ -0,0 +1,40 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_scalar_block_layout : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+
+// G-buffer pass of the hybrid renderer: rasterizes the camera rays'
+// first hits for the path tracer.
+
+#include "shared_structs.h"
+
+layout(binding = 0) uniform _MatrixUniforms
+{
+  MatrixUniforms mats;
+};
+
+layout(push_constant) uniform _PushConstantGBuffer
+{
+  PushConstantGBuffer pcGBuffer;
+};
+
+layout(location = 0) in vec3 i_position;
+
+layout(location = 1) out vec3 worldPos;
+layout(location = 2) flat out vec3 eye;
+
+out gl_PerVertex
+{
+  vec4 gl_Position;
+};
+
+
+void main()
+{
+  eye      = vec3(mats.viewInverse * vec4(0, 0, 0, 1));
+  worldPos = vec3(pcGBuffer.modelMatrix * vec4(i_position, 1.0));
+
+  gl_Position = mats.viewProj * vec4(worldPos, 1.0);
+}
@@ -0,0 +1,36 @@
+// The normal:depth targets (NdCurr, NdPrev, the denoiser's ndBuff)
+// hold (oct.x, oct.y, depth, valid): the first hit's normal,
+// octahedral-encoded, its depth, and whether there's a normal at all (a
+// miss has none).  Two channels keep the normal's precision in the
+// packed RGBA16F target.  decodeNd gives back (normal, depth).
+
+vec2 octWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    return n.z >= 0.0 ? n.xy : octWrap(n.xy);
+}
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = octWrap(n.xy);
+    return normalize(n);
+}
+
+vec4 encodeNd(vec3 n, float depth)
+{
+    if (dot(n,n) == 0.0)
+        return vec4(0.0, 0.0, depth, 0.0);
+    return vec4(octEncode(n), depth, 1.0);
+}
+
+vec4 decodeNd(vec4 v)
+{
+    return vec4(v.w != 0.0 ? octDecode(v.xy) : vec3(0.0), v.z);
+}
@@ -0,0 +1,259 @@
+// The path tracer itself, shared by the ray tracing pipeline
+// (raytrace.rgen) and the ray query (raytrace.comp) backends.
+// The includer provides, before including this file:
+//   RayPayload payload;  The result of the last traced ray
+//   void traceClosest(vec3 origin, vec3 direction);
+//       Sets payload.hit, and on a hit payload.hitPos, instanceIndex,
+//       primitiveIndex, bc and depth.
+//   void traceShadow(vec3 origin, vec3 direction, float tmax);
+//       Sets payload.occluded.
+
+#include "restir.glsl"
+
+// The camera ray's hit, as traceClosest would set it, read from the
+// hybrid renderer's rasterized G-buffer instead of traced.
+void gbufferHit(ivec2 pixel)
+{
+    uvec2 ids = imageLoad(gbIds, pixel).xy;
+    payload.hit = ids.x != 0;
+    if (!payload.hit) return;
+
+    vec4 pos = imageLoad(gbPos, pixel);
+    payload.instanceIndex  = int(ids.x) - 1;
+    payload.primitiveIndex = int(ids.y);
+    payload.hitPos = pos.xyz;
+    payload.depth  = pos.w;
+
+    // Only the position was stored: recover the barycentrics from the triangle
+    InstDesc inst    = instDesc.i[payload.instanceIndex];
+    ObjDesc  obj     = objDesc.i[inst.objIndex];
+    Vertices vertices = Vertices(obj.vertexAddress);
+    ivec3    ind      = Indices(obj.indexAddress).i[payload.primitiveIndex];
+    payload.bc = barycentrics(pos.xyz,
+                              (inst.transform*vec4(vertices.v[ind.x].pos, 1.0)).xyz,
+                              (inst.transform*vec4(vertices.v[ind.y].pos, 1.0)).xyz,
+                              (inst.transform*vec4(vertices.v[ind.z].pos, 1.0)).xyz);
+}
+
+// Trace one path through the pixel, returning its radiance in C and
+// its first hit.  False if the first hit is degenerate (and marked).
+// firstPath: the pixel's first this frame, which updates its reservoir.
+bool tracePath(ivec2 pixel, ivec2 size, bool firstPath, out vec3 C,
+               out vec3 firstPos, out vec3 firstNorm, out float firstDepth, out vec3 firstCol)
+{
+    const vec2 pixelCenter = vec2(pixel) + vec2(0.5);
+    vec2 pixelNDC = pixelCenter/vec2(size)*2.0 - 1.0;
+ 
+    vec3 eyeW    = (mats.viewInverse * vec4(0, 0, 0, 1)).xyz;
+    vec4 pixelH = mats.viewInverse * mats.projInverse * vec4(pixelNDC.x, pixelNDC.y, 1, 1);
+    vec3 pixelW = pixelH.xyz/pixelH.w;
+    
+    vec3 rayO    = eyeW;
+    vec3 rayD = normalize(pixelW - eyeW);
+    payload.hit = false;
+
+    // @@  Most of the ray casting code goes in a loop:
+    // Accumulate color in a vec3 C initialized to (0,0,0)
+    // Accumulate product of f/p weights in vec3 W initialized to (1,1,1)
+    C = vec3(0.0,0.0,0.0);
+    vec3 W = vec3(1.0,1.0,1.0);
+
+    firstPos = vec3(0.0);
+    firstCol = vec3(0.0);
+    firstNorm = vec3(0.0);
+    firstDepth = 0.0;
+
+    float lastPdf = 0.0;  // Pdf of the BRDF sample that chose rayD (0: camera ray)
+    float coneWidth = 0.0;  // Ray cone at rayO
+    float coneSpread = pixelSpreadAngle(size);
+
+
+    for (int i=0; i<pcRay.maxDepth;  i++) {
+        // Fire the ray;  the closest hit (if any) is returned in the payload
+        if (i == 0 && pcRay.hybrid)
+            gbufferHit(pixel);
+        else
+            traceClosest(rayO, rayD);
+                 
+        // If nothing was hit, output background color.
+        if (!payload.hit) {
+            break; }
+
+        // If something was hit, find the instance, and from it the object data.
+        // Object data (containing 4 device addresses)
+        InstDesc   inst         = instDesc.i[payload.instanceIndex];
+        ObjDesc    objResources = objDesc.i[inst.objIndex];
+    
+        // Dereference the object's 4 device addresses
+        Vertices   vertices    = Vertices(objResources.vertexAddress);
+        Indices    indices     = Indices(objResources.indexAddress);
+        Materials  materials   = Materials(objResources.materialAddress);
+        MatIndices matIndices  = MatIndices(objResources.materialIndexAddress);
+  
+        // Use gl_PrimitiveID to access the triangle's vertices and material
+        ivec3 ind    = indices.i[payload.primitiveIndex]; // The triangle hit
+        int matIdx   = matIndices.i[payload.primitiveIndex]; // The triangles material index
+        Material mat = materials.m[matIdx]; // The triangles material
+
+       
+
+        
+        // If material indicates triangle is a light, pass the light's
+        // emission through all BRDFs to output to a  pixel.
+        
+        // Vertex of the triangle (Vertex has pos, nrm, tex)
+        Vertex v0 = vertices.v[ind.x];
+        Vertex v1 = vertices.v[ind.y];
+        Vertex v2 = vertices.v[ind.z];
+
+        // Computing the normal and tex coord at hit position
+        const vec3 bc = payload.bc; // The barycentric coordinates of the hit point
+        const vec3 nrm  = mat3(inst.normalTransform)
+                        * (bc.x*v0.nrm      + bc.y*v1.nrm      + bc.z*v2.nrm);
+        const vec2 uv =  bc.x*v0.texCoord + bc.y*v1.texCoord + bc.z*v2.texCoord;
+
+        coneWidth += coneSpread*payload.depth;
+
+           // If the material has a texture, read diffuse color from it,
+           // at the LOD of the ray cone's footprint.
+        if (mat.textureId >= 0) 
+        {
+            uint txtId = objResources.txtOffset + mat.textureId;
+            float lod = rayConeLod(coneWidth, rayD,
+                                   (inst.transform*vec4(v0.pos,1.0)).xyz,
+                                   (inst.transform*vec4(v1.pos,1.0)).xyz,
+                                   (inst.transform*vec4(v2.pos,1.0)).xyz,
+                                   v0.texCoord, v1.texCoord, v2.texCoord,
+                                   vec2(textureSize(textureSamplers[(txtId)], 0)));
+            textureFeedback(txtId, lod);
+            mat.diffuse = textureLod(textureSamplers[(txtId)], uv, textureResidentLod(txtId, lod)).xyz; 
+        }
+
+        if(i== 0)
+        {
+            firstPos = payload.hitPos;
+            firstNorm =  normalize(nrm);
+            if(dot(firstNorm,firstNorm) == 0.0){
+            imageStore(sampleCurr, pixel,vec4(100.0,0.0,0.0,1.0));
+            imageStore(motionVectors, pixel, vec4(0.0, 0.0, 0.0, intBitsToFloat(pcRay.frame)));
+            return false;            }
+            firstCol = mat.diffuse;
+            firstDepth = payload.depth;
+        }
+
+       // image. Better yet, include a GUI slider to adjust exposure.
+        if (dot(mat.emission,mat.emission) > 0.0) 
+        {
+            // With explicit lights, a BRDF sample hitting a light
+            // could also have been chosen by SampleLight: weight it by MIS.
+            float w = 1.0;
+            if (featureExplicitLights() && featureRestir() && i == 1)
+                w = 0.0;  // The first hit's direct light came from its reservoir
+            else if (featureExplicitLights() && i > 0)
+            {
+                vec3 L0 = (inst.transform*vec4(v0.pos,1.0)).xyz;
+                vec3 L1 = (inst.transform*vec4(v1.pos,1.0)).xyz;
+                vec3 L2 = (inst.transform*vec4(v2.pos,1.0)).xyz;
+                vec3 crs = cross(L1-L0, L2-L0);
+                float area = length(crs)/2.0;
+                float pl = PdfLightSolidAngle(1.0/(area*emitter.list.length()),
+                                              rayO, payload.hitPos, crs/(2.0*area));
+                w = MisWeight(lastPdf, pl);
+            }
+            C +=  w * ( W*mat.emission ); 
+            break; 
+        }
+
+        // From the current hit point, setup N,L,V for BRDF calculation
+        vec3 P = payload.hitPos;  // Current hit point
+
+        vec3 Wi; 
+        if(featureExplicitLights() && featureRestir() && i == 0)
+        {
+            C += W * restirDirect(pixel, size, P, normalize(nrm), -rayD, mat,
+                                  payload.depth, firstPath, payload.seed);
+        }
+        else if(featureExplicitLights())
+        {
+            Emitter lightInfo = SampleLight(payload.seed);
+            vec3 lightPoint = SampleTriangle(lightInfo.v0,lightInfo.v1,lightInfo.v2, payload.seed);
+            Wi = normalize(lightPoint - payload.hitPos);
+            float dist = length(lightPoint- payload.hitPos);
+            traceShadow(payload.hitPos, Wi, dist-0.001);
+
+            if(!payload.occluded)
+            {
+                vec3 N = normalize(nrm);  // Its normal
+                vec3 Wo = -rayD;
+                vec3 f = EvalBrdf(N, Wi, Wo, mat);                    
+                float p = PdfLightSolidAngle(PdfLight(lightInfo), payload.hitPos,
+                                             lightPoint, lightInfo.normal);
+               
+                if (p > 0.0)
+                    C += MisWeight(p, PdfBrdf(N, Wi, Wo, mat)) * W * f/p * EvalLight(lightInfo);
+            }
+        }// end explicit lights
+
+        
+        vec3 N = normalize(nrm);  // Its normal
+        vec3 Wo = -rayD;
+        Wi = SampleBrdf(payload.seed, N, Wo, mat);
+        coneSpread += rayConeBounce(mat);
+        
+        // Color via a BRDF calculation
+        vec3 f = EvalBrdf(N, Wi, Wo, mat);        
+        lastPdf = PdfBrdf(N, Wi, Wo, mat);
+        float p = lastPdf;
+        
+        if (p != 0.0)
+            W *= f/p;// Monte-Carlo
+
+        if (!russianRoulette(i, W, payload.seed))
+            break;
+
+        // Step forward: Set the next ray's origin and direction to
+        // current point P, and the next sample direction Wi.
+        rayO = P;
+        rayD = Wi;
+    }
+
+    return true;
+}
+
+// Trace spp paths through the pixel, and accumulate them into the output images
+void pathTrace(ivec2 pixel, ivec2 size, int spp)
+{
+    // Adaptive sampling gives pixels different sample counts, so each
+    // continues its own sequence.
+    uint index = pcRay.sampleIndex;
+    if (pcRay.adaptive)
+        index = uint(imageLoad(moments, pixel).z);
+    else if (pcRay.checkerboard)
+        index /= 2;  // Traced every other frame: keep its samples consecutive
+
+    vec3 sumC = vec3(0.0);
+    vec2 lum  = vec2(0.0);  // Sum of the paths' luminances, and of their squares
+    vec3 firstPos, firstNorm, firstCol;
+    float firstDepth;
+    if (featureRestir())
+        restirClear(pixel, size);  // Unless the first path reaches restirDirect
+    for (int s=0;  s<spp;  s++) {
+        payload.seed = samplerSeed(pixel, size, index + s);
+
+        vec3 C, P, N, Kd;
+        float depth;
+        if (!tracePath(pixel, size, s == 0, C, P, N, depth, Kd))
+            return;
+        if (s == 0) {  // The paths share their camera ray, so their first hit
+            firstPos = P;  firstNorm = N;  firstDepth = depth;  firstCol = Kd; }
+
+        float L = luminance(C);
+        sumC += C;
+        lum  += vec2(L, L*L); }
+
+    storeSample(pixel, size, sumC/spp, float(spp), lum,
+                firstPos, firstNorm, firstDepth, firstCol);
+
+    // Recognize camera motion at "spin +=" in camera.cpp or "myCamera.eye +=" in app.cpp
+    // Communicate the camera modified state via a m_pcRay variable.
+}
@@ -1,11 +1,17 @@
+#version 460
+#extension GL_EXT_shader_explicit_arithmetic_types_int64  : require
+#extension GL_GOOGLE_include_directive : enable
+
+#include "shared_structs.h"
 
-#version 450
 layout(location = 0) out vec4 fragColor;
 
-layout(set = 0, binding  = 0) uniform sampler2D renderedImage;
+layout(set = 0, binding = ePostSources) uniform sampler2D renderedImage[2];  // POST_SOURCE_*
+layout(push_constant) uniform _pcPost { PushConstantPost pc; };
 
 void main()
 {
-    vec2 uv = gl_FragCoord.xy/vec2(1280, 768);
-	fragColor = pow(texture(renderedImage,uv), vec4(1.0/2.2));
+    // The rendered image is the window's size: one texel per fragment
+    vec4 C = texelFetch(renderedImage[pc.src], ivec2(gl_FragCoord.xy), 0);
+	fragColor = pow(C, vec4(1.0/2.2));
 }
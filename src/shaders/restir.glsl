@@ -0,0 +1,103 @@
+// ReSTIR direct lighting (Bitterli et al. 2020) for the first hit of
+// each path: a per-pixel reservoir picks one light sample from
+// resampled candidates, reuses the previous frame's reservoirs at the
+// reprojected pixel and a few of its neighbours, and then pays for a
+// single visibility ray.
+//
+// Reservoirs ping-pong between the two halves of the reservoir buffer
+// by frame parity.  The reuse is the biased variant: the reused samples'
+// visibility is not rechecked at this pixel.
+// Needs traceShadow (see pathtrace.glsl), so include after it is declared.
+
+#define RESTIR_NEIGHBOURS 3      // Spatial neighbours, in addition to the temporal one
+#define RESTIR_RADIUS     20.0   // Spatial reuse radius, in pixels
+#define RESTIR_MAX_HISTORY 20.0  // Cap on reused M, in multiples of the candidate count
+
+// The target function: the unshadowed luminance that light sample
+// (light, Pl) contributes at P.  Also returns that contribution.
+float restirTarget(vec3 P, vec3 N, vec3 Wo, Material mat, uint light, vec3 Pl,
+                   out vec3 contribution)
+{
+    contribution = vec3(0.0);
+    Emitter L = emitter.list[light];
+    vec3 D = Pl-P;
+    float d2 = dot(D,D);
+    if (d2 <= 0.0) return 0.0;
+    vec3 Wi = D/sqrt(d2);
+
+    // f includes N.L; the light's cosine and distance convert its area to solid angle.
+    contribution = EvalBrdf(N, Wi, Wo, mat) * EvalLight(L) * abs(dot(L.normal, Wi))/d2;
+    return luminance(contribution);
+}
+
+// Stream one sample (or a whole reservoir's worth, M) into reservoir r
+void restirUpdate(inout Reservoir r, vec3 Pl, uint light, float w, float M, inout uint seed)
+{
+    r.wSum += w;
+    r.M    += M;
+    if (w > 0.0 && rnd(seed) * r.wSum <= w) {
+        r.lightPoint = Pl;
+        r.light      = light; }
+}
+
+// The direct light at the first hit P, computed from the pixel's reservoir.
+// Only the pixel's first path of the frame stores its reservoir (store):
+// with several paths per pixel, the others resample their own.
+vec3 restirDirect(ivec2 pixel, ivec2 size, vec3 P, vec3 N, vec3 Wo, Material mat,
+                  float depth, bool store, inout uint seed)
+{
+    uint count    = size.x*size.y;
+    uint currBase = (pcRay.frame & 1) * count;
+    uint prevBase = count - currBase;
+
+    Reservoir r = Reservoir(vec3(0.0), 0u, 0.0, 0.0, 0.0);
+    vec3 contribution;
+
+    // Initial candidates, from the same light sampling as the explicit light rays
+    for (int k=0;  k<pcRay.restirCandidates;  k++) {
+        uint light = rndIndex(seed, emitter.list.length());
+        Emitter L = emitter.list[light];
+        vec3 Pl = SampleTriangle(L.v0, L.v1, L.v2, seed);
+        float pHat = restirTarget(P, N, Wo, mat, light, Pl, contribution);
+        restirUpdate(r, Pl, light, pHat/PdfLight(L), 1.0, seed); }
+
+    // Reuse the previous frame's reservoirs around where P was, if that
+    // pixel saw the same surface.
+    vec4 screenH = mats.priorViewProj * vec4(P, 1.0);
+    vec2 screen  = ((screenH.xy/screenH.w) + vec2(1.0))/2.0;
+    if (screen.x >= 0 && screen.x <= 1 && screen.y >= 0 && screen.y <= 1) {
+        ivec2 prevPixel = ivec2(screen*size);
+        float maxM = RESTIR_MAX_HISTORY*pcRay.restirCandidates;
+
+        for (int s=0;  s<=RESTIR_NEIGHBOURS;  s++) {
+            ivec2 q = prevPixel;  // s==0: temporal
+            if (s > 0) {
+                float a = 2*pi*rnd(seed);
+                q += ivec2(RESTIR_RADIUS*sqrt(rnd(seed))*vec2(cos(a), sin(a))); }
+            if (q.x < 0 || q.y < 0 || q.x >= size.x || q.y >= size.y) continue;
+
+            vec4 Nd = decodeNd(imageLoad(NdPrev, q));
+            if (dot(N, Nd.xyz) < pcRay.n_threshold || abs(depth - Nd.w) > pcRay.d_threshold)
+                continue;
+
+            Reservoir prev = reservoirs.r[prevBase + q.y*size.x + q.x];
+            if (prev.M <= 0.0) continue;
+            prev.M = min(prev.M, maxM);
+            float pHat = restirTarget(P, N, Wo, mat, prev.light, prev.lightPoint, contribution);
+            restirUpdate(r, prev.lightPoint, prev.light, pHat*prev.W*prev.M, prev.M, seed); }
+    }
+
+    float pHat = restirTarget(P, N, Wo, mat, r.light, r.lightPoint, contribution);
+    r.W = (pHat > 0.0 && r.M > 0.0) ? r.wSum/(r.M*pHat) : 0.0;
+
+    // The one visibility ray.  An occluded sample is not passed on either.
+    if (r.W > 0.0) {
+        vec3 D = r.lightPoint - P;
+        float dist = length(D);
+        traceShadow(P, D/dist, dist-0.001);
+        if (payload.occluded) r.W = 0.0; }
+
+    if (store)
+        reservoirs.r[currBase + pixel.y*size.x + pixel.x] = r;
+    return contribution * r.W;
+}
@@ -0,0 +1,600 @@
+// Declarations and functions shared by all the path tracing shaders:
+// the megakernel ray generation shader and the wavefront stages.
+// The includer enables the extensions (scalar block layout, int64,
+// buffer_reference2, nonuniform_qualifier) and declares the TLAS.
+
+// Push constant for ray tracing shaders
+layout(push_constant) uniform _PushConstantRay
+{
+    PushConstantRay pcRay;
+#ifdef WAVEFRONT
+    PushConstantWavefront pcWf;
+#endif
+};
+
+// Feature toggles, fixed by a specialized pipeline variant so the
+// compiler drops the branches not taken, or read from the push
+// constant by the generic pipelines.
+layout(constant_id = SPEC_EXPLICIT_LIGHTS) const int specExplicitLights = SPEC_DYNAMIC;
+layout(constant_id = SPEC_RESTIR)          const int specRestir         = SPEC_DYNAMIC;
+layout(constant_id = SPEC_MIS)             const int specMis            = SPEC_DYNAMIC;
+layout(constant_id = SPEC_SAMPLER)         const int specSampler        = SPEC_DYNAMIC;
+
+bool featureExplicitLights()
+{
+    return specExplicitLights == SPEC_DYNAMIC ? pcRay.ExplicitLightRays : specExplicitLights != 0;
+}
+bool featureRestir()
+{
+    return specRestir == SPEC_DYNAMIC ? pcRay.useRestir : specRestir != 0;
+}
+int featureMis()
+{
+    return specMis == SPEC_DYNAMIC ? pcRay.mis : specMis;
+}
+int featureSampler()
+{
+    return specSampler == SPEC_DYNAMIC ? pcRay.sampler : specSampler;
+}
+
+// Ray tracing descriptor set: 0:acceleration structure (declared by the includer), and output images
+layout(set=0, binding=1, rgba32f) uniform image2D colCurr; // Output image: m_rtColCurrBuffer
+layout(set=0, binding=2, scalar) buffer buffer_emitter{Emitter list[];} emitter;
+layout(set=0, binding=3, rgba32f) uniform image2D colPrev; // Output image: eOutPrevImage
+// NdCurr, NdPrev, KdCurr and sampleCurr take their format from the
+// image (VkApp::createScreenTargets): full precision, or packed
+layout(set=0, binding=4) uniform image2D NdCurr; // Output image: eOutCurrNd (nd_packing.glsl)
+layout(set=0, binding=5) uniform image2D NdPrev; // Output image: eOutPrevNd 
+layout(set=0, binding=6) uniform image2D KdCurr; // Output image: eOutCurrKd 
+layout(set=0, binding=7, scalar) buffer Reservoirs_ { Reservoir r[]; } reservoirs; // eReservoirs
+layout(set=0, binding=8, scalar) buffer SamplerTables_  // eSamplerTables
+{
+    uint sobol[SOBOL_DIMS*32];                        // Generator matrix columns, 32 per dimension
+    uint blueNoise[BLUE_NOISE_SIZE*BLUE_NOISE_SIZE];  // Void-and-cluster ranks of a tile
+} samplerTables;
+layout(set=0, binding=9, rgba32f) uniform image2D moments; // eMoments: mean L, mean L^2, count
+layout(set=0, binding=10, scalar) buffer AdaptiveList_     // eAdaptiveList
+{
+    AdaptiveCounters counters;
+    AdaptiveItem     items[];
+} adaptiveList;
+layout(set=0, binding=11, rgba32f) uniform image2D gbPos; // eGbPos: world position, eye distance
+layout(set=0, binding=12, rg32ui) uniform uimage2D gbIds; // eGbIds: instance index+1, primitive index
+layout(set=0, binding=13) uniform image2D sampleCurr;             // eSampleCurr: this frame's mean radiance, path count
+layout(set=0, binding=14, rgba32f) uniform image2D motionVectors; // eMotion: screen motion, valid, frame
+layout(set=0, binding=15, rgba32f) uniform image2D lumMomCurr;    // eLumMomCurr: mean L, mean L^2, variance
+layout(set=0, binding=16, rgba32f) uniform image2D lumMomPrev;    // eLumMomPrev
+
+#include "nd_packing.glsl"
+
+const float motionEpsilon = 0.01;  // Pixels of motion under which a pixel is still
+
+#ifdef WAVEFRONT
+// Wavefront descriptor set: the queues and path state exchanged between stages
+layout(set=2, binding=0, scalar) buffer WfRays_ { WfRay r[]; } rays;  // Two queues of capacity rays
+layout(set=2, binding=1, scalar) buffer WfHits_ { WfHit h[]; } hits;
+layout(set=2, binding=2, scalar) buffer WfShadowRays_ { WfShadowRay s[]; } shadowRays;
+layout(set=2, binding=3, scalar) buffer WfPaths_ { WfPath p[]; } paths;
+layout(set=2, binding=4, scalar) buffer WfCounters_ { WfCounters counters; };
+layout(set=2, binding=5, scalar) buffer WfSort_
+{
+    uint hist[WF_SORT_BINS];    // Rays per material bucket
+    uint offset[WF_SORT_BINS];  // Start of each bucket in sorted[]
+    uint sorted[];              // Ray indices in material order
+} matSort;
+#endif
+
+// Object model descriptor set: 0: matrices, 1:object buffer addresses, 2: texture list
+layout(set=1, binding=0) uniform _MatrixUniforms { MatrixUniforms mats; };
+layout(set=1, binding=1, scalar) buffer ObjDesc_ { ObjDesc i[]; } objDesc;
+layout(set=1, binding=2) uniform sampler2D textureSamplers[];
+layout(set=1, binding=3, scalar) buffer InstDesc_ { InstDesc i[]; } instDesc;
+layout(set=1, binding=4) buffer TexFeedback_ { uint level[]; } texFeedback;
+layout(set=1, binding=5) buffer TexMinLod_ { float minLod[]; } texMinLod;
+
+// Requests the level of texture txtId sampled at lod be streamed in
+// (vkapp_texstream.cpp).  Read before the atomic: most samples ask for
+// no finer a level than another already has this frame.
+void textureFeedback(uint txtId, float lod)
+{
+    uint level = uint(clamp(floor(lod) + TEX_FEEDBACK_BIAS, 0.0, 2.0*TEX_FEEDBACK_BIAS));
+    if (level < texFeedback.level[txtId])
+        atomicMin(texFeedback.level[txtId], level);
+}
+
+// lod, no finer than texture txtId's resident levels: the finer ones
+// are in its image, but not (or no longer) uploaded
+float textureResidentLod(uint txtId, float lod)
+{
+    return max(lod, texMinLod.minLod[txtId]);
+}
+
+// Object buffered data; dereferenced from ObjDesc addresses
+layout(buffer_reference, scalar) buffer Vertices {Vertex v[]; }; // Position, normals, ..
+layout(buffer_reference, scalar) buffer Indices {ivec3 i[]; }; // Triangle indices
+layout(buffer_reference, scalar) buffer Materials {Material m[]; }; // Array of all materials
+layout(buffer_reference, scalar) buffer MatIndices {int i[]; }; // Material ID for each triangle
+
+float pi = 3.14159;
+
+// Generate a random unsigned int from two unsigned int values, using 16 pairs
+// of rounds of the Tiny Encryption Algorithm. See Zafar, Olano, and Curtis,
+// "GPU Random Numbers via the Tiny Encryption Algorithm"
+uint tea(uint val0, uint val1)
+{
+  uint v0 = val0;
+  uint v1 = val1;
+  uint s0 = 0;
+
+  for(uint n = 0; n < 16; n++)
+  {
+    s0 += 0x9e3779b9;
+    v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+    v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+  }
+
+  return v0;
+}
+
+// Generate a random unsigned int in [0, 2^24) given the previous RNG state
+// using the Numerical Recipes linear congruential generator
+uint lcg(inout uint prev)
+{
+    uint LCG_A = 1664525u;
+    uint LCG_C = 1013904223u;
+    prev       = (LCG_A * prev + LCG_C);
+    return prev & 0x00FFFFFF;
+}
+
+// @@ Every random number of a path is drawn by rnd(seed), whatever
+// the sampler.  With eSamplerRandom the seed is an lcg state started
+// by tea.  With the Sobol samplers the seed counts the dimensions
+// used so far, and rnd returns dimension seed of the pixel's sample
+// number pcRay.sampleIndex.
+ivec2 samplerPixel;  // Pixel of the current path, set by samplerSeed or samplerResume
+uint  samplerIndex;  // Its sample number in the pixel's sequence
+
+// Integer hash (Wellons' lowbias32)
+uint hashU(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint hashCombine(uint seed, uint v)
+{
+    return seed ^ (hashU(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// Nested uniform (Owen) scrambling of the bits of x, as a hash-based
+// permutation; see Burley, "Practical Hash-based Owen Scrambling"
+uint owenScramble(uint x, uint seed)
+{
+    x = bitfieldReverse(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return bitfieldReverse(x);
+}
+
+// Point index of Sobol dimension dim < SOBOL_DIMS, as a 0.32 fixed point
+uint sobol(uint index, uint dim)
+{
+    uint x = 0;
+    for (uint j=0;  index != 0;  j++, index >>= 1)
+        if ((index & 1) != 0) x ^= samplerTables.sobol[dim*32 + j];
+    return x;
+}
+
+// Dimension d of the current pixel's sample.  The dimensions come in
+// blocks of SOBOL_DIMS, each a 4D Sobol sequence whose index is shuffled
+// and whose values are scrambled with seeds of its own, so the blocks
+// are uncorrelated and paths can use any number of them.
+float sobolRnd(uint d)
+{
+    uint block = d / uint(SOBOL_DIMS);
+    uint seed  = 0;  // Blue noise: the same sequence for all pixels
+    if (featureSampler() == eSamplerSobol)
+        seed = hashU(uint(samplerPixel.y)*0x10000u + uint(samplerPixel.x));
+    uint blockSeed = hashCombine(seed, block);
+
+    uint index = owenScramble(samplerIndex, blockSeed);
+    uint x = owenScramble(sobol(index, d % uint(SOBOL_DIMS)), hashCombine(blockSeed, d));
+    float u = float(x >> 8) / float(0x01000000);
+
+    // Blue noise: a toroidal shift by the pixel's rank in the tile, with
+    // the tile offset differently for each dimension
+    if (featureSampler() == eSamplerBlueNoise) {
+        uint offset = hashU(d);
+        uvec2 t = (uvec2(samplerPixel) + uvec2(offset, offset >> 16)) % uint(BLUE_NOISE_SIZE);
+        uint rank = samplerTables.blueNoise[t.y*BLUE_NOISE_SIZE + t.x];
+        u = fract(u + (float(rank) + 0.5)/float(BLUE_NOISE_SIZE*BLUE_NOISE_SIZE)); }
+
+    return u;
+}
+
+// Generate a random float in [0, 1) given the previous sampler state
+float rnd(inout uint prev)
+{
+    if (featureSampler() == eSamplerRandom)
+        return (float(lcg(prev)) / float(0x01000000));
+    return sobolRnd(prev++);
+}
+
+// A random integer in [0, n)
+uint rndIndex(inout uint prev, uint n)
+{
+    return min(uint(rnd(prev)*n), n-1);
+}
+
+// Start the sampler state of sample number index of the path through pixel
+uint samplerSeed(ivec2 pixel, ivec2 size, uint index)
+{
+    samplerPixel = pixel;
+    samplerIndex = index;
+    if (featureSampler() == eSamplerRandom)
+        return tea(pixel.y * size.x + pixel.x, uint(pcRay.frameSeed) + index);
+    return 0;
+}
+
+// Checkerboard mode: the pixel of a half width launch, traced (parity
+// 0) or reconstructed (parity 1) this frame.  The pattern flips every
+// frame, so each pixel is traced every other frame.
+ivec2 checkerPixel(ivec2 launch, int parity)
+{
+    return ivec2(2*launch.x + ((launch.y + pcRay.frame + parity) & 1), launch.y);
+}
+
+// Continue, in another invocation, the path through the pixel of linear index p
+void samplerResume(uint p)
+{
+    uint width = uint(imageSize(colCurr).x);
+    samplerPixel = ivec2(p % width, p / width);
+    samplerIndex = pcRay.sampleIndex;
+}
+
+// Barycentric coordinates of P, a point in the plane of triangle (A,B,C)
+vec3 barycentrics(vec3 P, vec3 A, vec3 B, vec3 C)
+{
+    vec3 e0 = B-A, e1 = C-A, e2 = P-A;
+    float d00 = dot(e0,e0), d01 = dot(e0,e1), d11 = dot(e1,e1);
+    float d20 = dot(e2,e0), d21 = dot(e2,e1);
+    float denom = d00*d11 - d01*d01;
+    float v = (d11*d20 - d01*d21)/denom;
+    float w = (d00*d21 - d01*d20)/denom;
+    return vec3(1.0-v-w, v, w);
+}
+
+// Returns a vector around A, at a "polar" angle cos=cTheta, and an "equatorial" angle Phi
+vec3 SampleLobe(vec3 A, float cTheta, float Phi)
+{
+    float sTheta = sqrt(1 - cTheta*cTheta); // Sine of Theta
+    vec3 K = vec3(sTheta*cos(Phi), sTheta*sin(Phi), cTheta); // Vector centered on Z instead of A
+
+
+    // Form coordinate frame around A
+    if (abs(A.z-1.0) < 1e-3) return K;
+    if (abs(A.z+1.0) < 1e-3) return vec3(K[0], -K[1], -K[2]);
+    vec3 B = normalize(vec3(-A[1], A[0], 0.0)); // Z x A
+    vec3 C = cross(A,B);
+    
+    // Rotate Z to A, taking K along with
+    return K[0]*B + K[1]*C + K[2]*A;
+}
+
+
+float approx_tan(vec3 V, vec3 N)
+{
+    float VN = dot(V,N);
+    return sqrt( 1.0-pow(VN,2) )/VN;
+}
+float G_GGX(vec3 V, vec3 M , float a)
+{
+    float alphaG = sqrt(2.0/ (a+2));
+    float vTan = approx_tan(V,M);
+
+    return 2.0/ (1.0+ sqrt(1+alphaG*alphaG*vTan*vTan));
+}
+float D_GGX(vec3 N, vec3 H , float alpha)
+{
+    float alphaG = sqrt(2.0/ (alpha+2));
+    float aGaG = pow(alphaG,2);
+    float invAG = pow(alphaG-1.0,2);
+    float NdotH = dot(N,H);
+
+    return aGaG / (pi*pow( NdotH*NdotH*(aGaG-1.0) + 1.0  , 2));
+}
+vec3 GGXBRDF(vec3 L ,vec3 V , vec3 H , vec3 N , float alpha , vec3 Kd , vec3 Ks)
+{
+    float LH = dot(L,H);
+    
+    float D = D_GGX(N,H,alpha);
+    vec3 F = Ks + (1.0-Ks) * pow(1-LH,5);
+    float G = G_GGX(L,H,alpha) * G_GGX(V,H,alpha);
+    
+    return Kd/pi + D*F/4.0 * G;
+}
+
+// returns full  NL*(Kd/pi+F*G*D/den);  or diffuse only NL*(Kd/pi) lighting calc.
+vec3 EvalBrdf(vec3 N, vec3 L, vec3 V, Material mat) 
+{
+    const float alpha = mat.shininess;
+    float NL = max(dot(N,L),0.0);
+    vec3 H = normalize(L+V);
+    vec3 Kd = mat.diffuse;
+    vec3 Ks = mat.specular;
+    return NL * GGXBRDF(L,V,H,N,alpha,Kd,Ks);
+}
+
+// The GGX roughness used by D_GGX and G_GGX for a material's shininess
+float GGXRoughness(float shininess)
+{
+    return sqrt(2.0/ (shininess+2));
+}
+
+// @@ Ray cones (Akenine-Moller et al., "Texture Level of Detail
+// Strategies for Real-Time Ray Tracing"): a path carries the width of
+// the cone of rays around it, and the cone's spread angle.  The width
+// grows by spread*t along each ray, and selects the texture LOD at
+// each hit, since ray tracing shaders have no derivatives to do it.
+
+// Spread angle of the camera rays: the angle one pixel subtends
+float pixelSpreadAngle(ivec2 size)
+{
+    return atan(2.0*abs(mats.projInverse[1][1])/size.y);
+}
+
+// Texture LOD of a cone of the given width hitting, along direction D,
+// the triangle with world corners P0, P1, P2 and texture coordinates
+// T0, T1, T2, in a texture of texSize texels.
+float rayConeLod(float width, vec3 D, vec3 P0, vec3 P1, vec3 P2,
+                 vec2 T0, vec2 T1, vec2 T2, vec2 texSize)
+{
+    vec3 Ng = cross(P1-P0, P2-P0);
+    float pa = length(Ng);  // Twice the triangle's world area
+    float ta = abs((T1.x-T0.x)*(T2.y-T0.y) - (T2.x-T0.x)*(T1.y-T0.y))
+        * texSize.x*texSize.y;  // Twice its texel area
+    float cosTheta = max(abs(dot(Ng/pa, D)), 1e-4);
+    return 0.5*log2(ta/pa) + log2(abs(width)/cosTheta);
+}
+
+// Spread a bounce off mat adds to the cone: about its lobe's width.
+// Diffuse bounces make a wide cone, so what they see is sampled coarsely.
+float rayConeBounce(Material mat)
+{
+    return GGXRoughness(mat.shininess);
+}
+
+// Smith masking of the direction V for GGX; the normalization of the
+// visible normal distribution sampled by SampleGGXVNDF.
+float G1_Smith(vec3 V, vec3 N, float alphaG)
+{
+    float NV = dot(N,V);
+    if (NV <= 0.0) return 0.0;
+    float aa = alphaG*alphaG;
+    return 2.0*NV / (NV + sqrt(aa + (1.0-aa)*NV*NV));
+}
+
+// Probability of sampling the specular lobe rather than the diffuse one,
+// proportional to the lobes' weights.
+float SpecularProbability(Material mat)
+{
+    const vec3 lum = vec3(0.2126, 0.7152, 0.0722);
+    float d = dot(mat.diffuse, lum);
+    float s = dot(mat.specular, lum);
+    return (d+s > 0.0) ? s/(d+s) : 0.0;
+}
+
+// Sample a microfacet normal from the GGX distribution of normals
+// visible from Ve (Heitz 2018), in the frame where the normal is +Z.
+vec3 SampleGGXVNDF(vec3 Ve, float alphaG, float U1, float U2)
+{
+    vec3 Vh = normalize(vec3(alphaG*Ve.x, alphaG*Ve.y, Ve.z));
+    float lensq = Vh.x*Vh.x + Vh.y*Vh.y;
+    vec3 T1 = lensq > 0.0 ? vec3(-Vh.y, Vh.x, 0.0)/sqrt(lensq) : vec3(1.0, 0.0, 0.0);
+    vec3 T2 = cross(Vh, T1);
+    
+    float r = sqrt(U1);
+    float phi = 2.0*pi*U2;
+    float t1 = r*cos(phi);
+    float t2 = r*sin(phi);
+    float s = 0.5*(1.0 + Vh.z);
+    t2 = (1.0-s)*sqrt(1.0 - t1*t1) + s*t2;
+    
+    vec3 Nh = t1*T1 + t2*T2 + sqrt(max(0.0, 1.0 - t1*t1 - t2*t2))*Vh;
+    return normalize(vec3(alphaG*Nh.x, alphaG*Nh.y, max(0.0, Nh.z)));
+}
+
+// Sample the diffuse lobe (cosine around N) or the specular lobe
+// (GGX visible normals, reflected about Wo), chosen by lobe weight.
+vec3 SampleBrdf(inout uint seed, in vec3 N, in vec3 Wo, Material mat) 
+{
+    if (rnd(seed) >= SpecularProbability(mat))
+        return SampleLobe(N, sqrt(rnd(seed)), 2*pi *rnd(seed));
+
+    // Express Wo in a frame around N, as SampleLobe does
+    vec3 B = abs(N.z) < 0.999 ? normalize(vec3(-N.y, N.x, 0.0)) : vec3(1.0, 0.0, 0.0);
+    vec3 C = cross(N,B);
+    vec3 Ve = vec3(dot(Wo,B), dot(Wo,C), dot(Wo,N));
+
+    vec3 He = SampleGGXVNDF(Ve, GGXRoughness(mat.shininess), rnd(seed), rnd(seed));
+    vec3 H = He.x*B + He.y*C + He.z*N;
+    return reflect(-Wo, H);
+}
+
+// The probability distribution (solid angle) of the SampleBrdf function.
+float PdfBrdf(vec3 N, vec3 Wi, vec3 Wo, Material mat) 
+{
+    float pSpec = SpecularProbability(mat);
+    float pdf = (1.0-pSpec) * max(dot(N, Wi), 0.0)/pi;
+
+    float NV = dot(N, Wo);
+    if (pSpec > 0.0 && NV > 0.0) {
+        float alphaG = GGXRoughness(mat.shininess);
+        vec3 H = normalize(Wi+Wo);
+        // D_GGX takes the shininess, and does its own conversion to alphaG
+        pdf += pSpec * G1_Smith(Wo, N, alphaG) * max(D_GGX(N, H, mat.shininess), 0.0)
+            / (4.0*NV); }
+    return pdf;
+}
+
+Emitter SampleLight(inout uint seed)
+{
+     uint i = rndIndex(seed, emitter.list.length());
+     return emitter.list[i];
+}
+
+vec3 SampleTriangle(vec3 A, vec3 B ,vec3 C, inout uint seed)
+{
+    float b1 = rnd(seed);
+    float b2 = rnd(seed);
+    float b0 = 1-b1-b2;
+    if(b0 < 0)
+    {
+        b1 = 1-b1;
+        b2 = 1-b2;
+        b0 = 1 - b1 -b2;
+    }
+    return b0*A + b1*B +b2*C;
+}
+
+float PdfLight(Emitter L)
+{
+    return 1.0/(L.area * emitter.list.length());
+}
+
+// The probability (solid angle, seen from P) of choosing point Pl, on a
+// light of normal Nl, whose PdfLight (area measure) is pdfArea.
+float PdfLightSolidAngle(float pdfArea, vec3 P, vec3 Pl, vec3 Nl)
+{
+    vec3 D = Pl-P;
+    float d2 = dot(D,D);
+    float cosL = abs(dot(Nl,D))/sqrt(d2);
+    return (cosL > 0.0) ? pdfArea*d2/cosL : 0.0;
+}
+
+// Multiple importance sampling weight of a sample from the strategy of
+// pdf pa, when strategy pb could also have produced it.
+float MisWeight(float pa, float pb)
+{
+    if (featureMis() == eMisBalance) return pa/(pa+pb);
+    if (featureMis() == eMisPower)   return pa*pa/(pa*pa+pb*pb);
+    return 0.5;  // eMisHalf: a fixed 50/50 split
+}
+
+float GeometryFactor(vec3 Pa, vec3 Na, vec3 Pb, vec3 Nb)
+{
+    vec3 D = Pa-Pb;
+    return abs( dot(D,Na) * dot(D,Nb) / pow(dot(D,D),2) );
+}
+
+vec3 EvalLight(Emitter L)
+{
+    return L.emission;
+}
+
+// Empty the pixel's ReSTIR reservoir for this frame (see restir.glsl),
+// where restirDirect won't write one: the next frame must not reuse
+// the one left from two frames back.
+void restirClear(ivec2 pixel, ivec2 size)
+{
+    uint count = size.x*size.y;
+    reservoirs.r[(pcRay.frame & 1)*count + pixel.y*size.x + pixel.x].M = 0.0;
+}
+
+void accumulateSample(vec3 firstNorm, float firstDepth, // Projected point's normal and depth
+ ivec2 loc, // The pixel's location (one of the four)
+ float bilinearWeight, // The pixel's bilinear weight
+ inout vec4 sumC, inout vec2 sumM, inout float sumW // To receive the accumulated values
+ )
+ {
+   vec4 col = imageLoad( colPrev,loc);
+   vec2 mom = imageLoad(lumMomPrev,loc).xy;
+   vec4 Nd = decodeNd(imageLoad(NdPrev,loc));
+   float w = bilinearWeight;
+
+   if(dot(firstNorm,Nd.xyz) < pcRay.n_threshold) w = 0.0;
+  
+   if(abs(firstDepth - Nd.w) > pcRay.d_threshold) w = 0.0;
+
+   sumC += w*col;
+   sumM += w*mom;
+   sumW += w;
+ }
+
+float luminance(vec3 c)
+{
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Russian roulette on the throughput W, after the path's bounce
+// number bounce: dim paths are likely to end, bright ones to continue.
+// A surviving path's W is divided by its survival probability.
+bool russianRoulette(int bounce, inout vec3 W, inout uint seed)
+{
+    if (bounce+1 >= pcRay.maxDepth) return false;
+    if (bounce+1 < pcRay.minDepth) return true;
+
+    float survive = min(luminance(W), pcRay.rr);
+    if (rnd(seed) >= survive) return false;
+    W /= survive;
+    return true;
+}
+
+// Relative standard error of a pixel's mean luminance, from its moments
+float relativeError(vec4 m)
+{
+    float n = m.z;
+    if (n < 2.0) return 1e30;
+    float variance = max(m.y - m.x*m.x, 0.0) * n/(n-1.0);  // Unbiased sample variance
+    return sqrt(variance/n) / (m.x + 1e-3);
+}
+
+// Stores the mean radiance C of the pixel's n paths for temporal.comp
+// to blend into the history, with the first hit's motion vector (its
+// move on screen since the previous frame, through priorViewProj), and
+// its normal/depth and Kd for the history rejection and the denoiser.
+// lum holds the sum of the paths' luminances and of their squares.
+void storeSample(ivec2 pixel, ivec2 size, vec3 C, float n, vec2 lum,
+                 vec3 firstPos, vec3 firstNorm, float firstDepth, vec3 firstCol)
+{
+    // A path that hit nothing has no valid motion, so no history
+    vec2 motion = vec2(0.0);
+    float valid = 0.0;
+    if (dot(firstPos,firstPos) != 0.0) {
+        vec4 screenH = mats.priorViewProj * vec4(firstPos,1.0);
+        vec2 prior   = ((screenH.xy/screenH.w) + vec2(1.0))/2.0;
+        motion = (vec2(pixel) + vec2(0.5))/vec2(size) - prior;
+        valid  = 1.0; }
+    imageStore(motionVectors, pixel, vec4(motion, valid, intBitsToFloat(pcRay.frame)));
+
+    // The luminance moments restart with any motion: adaptive sampling
+    // only pays off on a static view.  A miss (the sky) has none of its
+    // own, and accumulates like any static pixel until the camera moves.
+    bool still = length(motion*vec2(size)) < motionEpsilon;
+    vec4 m = imageLoad(moments, pixel);
+    if (!still || pcRay.moved == int(true))
+        m = vec4(0.0);
+    if (pcRay.moved == int(false) && !any(isnan(lum))) {
+        m.z += n;
+        m.xy += (lum - n*m.xy)/m.z; }
+    imageStore(moments, pixel, m);
+
+    // A NaN sample counts as none: temporal.comp keeps the history.
+    // (Clamped to the largest half, for the packed RGBA16F target.)
+    imageStore(sampleCurr, pixel, any(isnan(C)) ? vec4(0.0) : vec4(min(C, vec3(65504.0)), n));
+    if(any(isnan(firstCol)) == false)
+    {
+         imageStore(KdCurr,  pixel,vec4(firstCol, 0.0));
+    }
+    if(any(isnan(firstNorm)) == false)
+    {
+         imageStore(NdCurr,  pixel,encodeNd(firstNorm,firstDepth));
+    }
+}
@@ -16,6 +16,10 @@ layout(push_constant) uniform _PushConstantRaster
   PushConstantRaster pcRaster;
 };
 
+// The BRDF's sign, fixed by a specialized pipeline variant, or read
+// per draw from the push constant by the generic pipeline.
+layout(constant_id = SPEC_BRDF) const int specBRDF = SPEC_DYNAMIC;
+
 // clang-format off
 // Incoming 
 layout(location=1) in vec3 worldPos;
@@ -32,6 +36,8 @@ layout(buffer_reference, scalar) buffer MatIndices {int i[]; };     // Material
 
 layout(binding=eObjDescs, scalar) buffer ObjDesc_ { ObjDesc i[]; } objDesc;
 layout(binding=eTextures) uniform sampler2D[] textureSamplers;
+layout(binding=eTexFeedback) buffer TexFeedback_ { uint level[]; } texFeedback;
+layout(binding=eTexMinLod) buffer TexMinLod_ { float minLod[]; } texMinLod;
 
 float pi = 3.14159;
 
@@ -164,16 +170,25 @@ void main()
   {
     int  txtOffset  = obj.txtOffset;
     uint txtId      = txtOffset + mat.textureId;
-    Kd = texture(textureSamplers[nonuniformEXT(txtId)], texCoord).xyz;
+
+    // The level sampled, for texture streaming (as textureFeedback in
+    // rt_common.glsl), and sampled no finer than the resident levels
+    float lod  = textureQueryLod(textureSamplers[nonuniformEXT(txtId)], texCoord).y;
+    uint level = uint(clamp(floor(lod) + TEX_FEEDBACK_BIAS, 0.0, 2.0*TEX_FEEDBACK_BIAS));
+    if (level < texFeedback.level[txtId])
+      atomicMin(texFeedback.level[txtId], level);
+    Kd = textureLod(textureSamplers[nonuniformEXT(txtId)], texCoord,
+                    max(lod, texMinLod.minLod[txtId])).xyz;
   }
   
   vec3 ambient = vec3(0.005);
 
   // This very minimal lighting calculation should be replaced with a modern BRDF calculation. 
   //fragColor.xyz = pcRaster.lightIntensity*NL*Kd/pi;
-  if(pcRaster.BRDF > 0){
+  int brdf = specBRDF == SPEC_DYNAMIC ? pcRaster.BRDF : specBRDF;
+  if(brdf > 0){
     fragColor.xyz = ambient+pcRaster.lightIntensity*NL*BeckhamBRDF(L,V,H,N,alpha,Kd,Ks);
-  }else if(pcRaster.BRDF < 0){ 
+  }else if(brdf < 0){ 
     fragColor.xyz = ambient+pcRaster.lightIntensity*NL*PhongBRDF(L,V,H,N,alpha,Kd,Ks);
   }else{
     fragColor.xyz = ambient+pcRaster.lightIntensity*NL*GGXBRDF(L,V,H,N,alpha,Kd,Ks);
@@ -40,7 +40,7 @@ void main()
   worldPos = vec3(pcRaster.modelMatrix * vec4(i_position, 1.0));
   viewDir  = vec3(eye - worldPos);
   texCoord = i_texCoord;
-  worldNrm = mat3(pcRaster.modelMatrix) * i_normal;
+  worldNrm = transpose(inverse(mat3(pcRaster.modelMatrix))) * i_normal;
 
   gl_Position = mats.viewProj * vec4(worldPos, 1.0);
 }
@@ -30,9 +30,16 @@ using uint = unsigned int;
 START_ENUM(ScBindings)
   eMatrices  = 0,  // Global uniform containing camera matrices
   eObjDescs = 1,  // Access to the object descriptions
-  eTextures = 2   // Access to textures
+  eTextures = 2,  // Access to textures
+  eInstDescs = 3, // Access to the instance descriptions
+  eTexFeedback = 4, // Finest level sampled of each texture (texture streaming)
+  eTexMinLod = 5    // Finest level resident of each texture: its minimum LOD
 END_ENUM();
 
+// A texture feedback entry is TEX_FEEDBACK_BIAS + the finest LOD it was
+// sampled at, relative to its level 0; ~0u when not sampled.
+#define TEX_FEEDBACK_BIAS 32
+
 START_ENUM(RtBindings)
   eTlas     = 0,  // Top-level acceleration structure
   eOutCurrImage = 1,   // Ray tracer output image
@@ -41,14 +48,38 @@ START_ENUM(RtBindings)
   eOutPrevImage = 3,
   eOutCurrNd = 4,
   eOutPrevNd = 5,
-  eOutCurrKd = 6
+  eOutCurrKd = 6,
+  eReservoirs = 7,  // ReSTIR reservoirs: two halves, alternating by frame
+  eSamplerTables = 8,  // Sobol generator matrices and blue noise ranks
+  eMoments = 9,        // Per-pixel luminance moments, for adaptive sampling
+  eAdaptiveList = 10,  // Adaptive sampling work list
+  eGbPos = 11,         // Hybrid G-buffer: world position and eye distance
+  eGbIds = 12,         // Hybrid G-buffer: instance and primitive IDs
+  eSampleCurr = 13,    // This frame's samples, before temporal accumulation
+  eMotion = 14,        // Per-pixel motion vectors to the previous frame
+  eLumMomCurr = 15,    // Temporal luminance moments and variance, for the denoiser
+  eLumMomPrev = 16     // Last frame's eLumMomCurr
+END_ENUM();
+
+START_ENUM(WfBindings)
+  eWfRays = 0,        // Ray queues (two halves, current and next)
+  eWfHits = 1,        // Closest hit of each current ray
+  eWfShadowRays = 2,  // Shadow ray queue
+  eWfPaths = 3,       // Per-pixel path state
+  eWfCounters = 4,    // Queue counters and indirect arguments
+  eWfSort = 5         // Material sort histogram and sorted ray indices
 END_ENUM();
 
 START_ENUM(DenoiseBindings)
-eInImage     = 0,  // Top-level acceleration structure
-eOutDenoiseImage = 1,   // Ray tracer output image
-eInCurrKd = 2,
-eInCurrNd = 3
+eImages   = 0,   // Input and ping-pong images, indexed by DENOISE_IMAGE_*
+eInCurrKd = 1,
+eInCurrNd = 2,
+eInVariance = 3  // The temporal pass's luminance variance (eLumMomCurr)
+END_ENUM();
+
+START_ENUM(PostBindings)
+ePostSources   = 0,  // The images post can show, indexed by POST_SOURCE_*
+ePostSwapchain = 1   // post.comp: this frame's swapchain image, as a storage image
 END_ENUM();
 // clang-format on
 
@@ -64,6 +95,14 @@ struct ObjDesc
   uint64_t materialIndexAddress;  // Address of the triangle material index buffer
 };
 
+// Information of an object instance when referenced in a shader
+struct InstDesc
+{
+  mat4 transform;        // Object-to-world matrix of the instance
+  mat4 normalTransform;  // Inverse-transpose of transform, for normals
+  uint objIndex;         // Index of the instanced object's ObjDesc
+};
+
 // Uniform buffer set at each frame
 struct MatrixUniforms
 {
@@ -85,12 +124,20 @@ struct PushConstantRaster
 };
 
 
+// Push constant structure for the hybrid renderer's G-buffer pass
+struct PushConstantGBuffer
+{
+  mat4 modelMatrix;    // matrix of the instance
+  uint instanceIndex;  // Index of the instance in InstDesc, and in the TLAS
+};
+
 // Push constant structure for the ray tracer
 struct PushConstantRay
 {
   int   frameSeed;
-  int   depth;
-  float rr;
+  int   maxDepth;  // Bounces after which every path ends
+  float rr;        // Highest survival probability of Russian roulette
+  int   minDepth;  // Bounces before Russian roulette starts
   int   moved;
   int   frame;
   BOOL(historyView);
@@ -99,6 +146,127 @@ struct PushConstantRay
   float n_threshold;
   float d_threshold;
   BOOL(useHistory);
+  int   mis;  // How explicit light and BRDF samples are combined: eMis...
+  BOOL(useRestir);        // ReSTIR direct light at the first hit (needs ExplicitLightRays)
+  int   restirCandidates; // Initial light candidates per pixel
+  int   sampler;      // Random number source: eSampler...
+  uint  sampleIndex;  // Index of this frame's sample in the pixel's sequence
+  BOOL(adaptive);            // Trace the adaptive work list instead of every pixel
+  float adaptiveThreshold;   // Relative error under which a pixel is converged
+  int   adaptiveMaxSpp;      // Most samples a pixel gets in one frame
+  int   adaptiveMinSamples;  // Samples before a pixel's error estimate is trusted
+  BOOL(hybrid);  // Camera rays' hits come from the rasterized G-buffer
+  BOOL(checkerboard);  // Trace half the pixels, in a pattern alternating by frame
+  int   historyCap;    // Longest history a moving pixel keeps: its EMA weight floor is 1/historyCap
+};
+
+// Values of PushConstantRay::mis
+#define eMisHalf    0  // Fixed 0.5/0.5 weights
+#define eMisBalance 1  // Balance heuristic
+#define eMisPower   2  // Power heuristic (beta=2)
+
+// Values of PushConstantRay::sampler
+#define eSamplerRandom    0  // tea seed and lcg stream per pixel
+#define eSamplerSobol     1  // Owen-scrambled Sobol, scrambled per pixel
+#define eSamplerBlueNoise 2  // One scrambled Sobol, shifted by per-pixel blue noise
+
+#define SOBOL_DIMS      4   // Dimensions of the Sobol generator matrices table
+#define BLUE_NOISE_SIZE 64  // Side of the blue noise rank tile
+
+// Specialization constant IDs of the feature toggles a pipeline variant
+// fixes at creation (vkapp_variants.cpp).  A constant left at its
+// default SPEC_DYNAMIC reads the push constant instead.
+#define SPEC_EXPLICIT_LIGHTS 0  // PushConstantRay::ExplicitLightRays
+#define SPEC_RESTIR          1  // PushConstantRay::useRestir
+#define SPEC_MIS             2  // PushConstantRay::mis
+#define SPEC_SAMPLER         3  // PushConstantRay::sampler
+#define SPEC_BRDF            4  // PushConstantRaster::BRDF, as its sign
+#define SPEC_DYNAMIC 0x7fffffff
+
+// Push constant structure for the wavefront stages (follows PushConstantRay)
+struct PushConstantWavefront
+{
+  int  bounce;    // Current bounce; 0 for camera rays
+  int  queue;     // Which half of the ray queue holds the current rays
+  uint capacity;  // Rays per queue half (the pixel count)
+  int  pass;      // Material sort pass: 0 count, 1 scan, 2 scatter
+};
+
+#define ADAPTIVE_GROUP_SIZE 64  // Invocations per workgroup of the ray query backend
+
+// Adaptive sampling: the work list's length, and the indirect
+// arguments derived from it
+struct AdaptiveCounters
+{
+  uint count;            // Pixels in the work list
+  uint traceArgs[3];     // VkTraceRaysIndirectCommandKHR for the megakernel
+  uint dispatchArgs[3];  // VkDispatchIndirectCommand for the ray query backend
+  uint pad;
+};
+
+// Adaptive sampling: a pixel still above the error threshold
+struct AdaptiveItem
+{
+  uint pixel;  // Linear pixel index
+  uint spp;    // Samples to trace this frame
+};
+
+// Wavefront: a ray waiting in a queue
+struct WfRay
+{
+  vec3 origin;
+  vec3 direction;
+  uint pixel;  // Linear index of the pixel whose path this ray extends
+};
+
+// Wavefront: the closest hit of a queued ray
+struct WfHit
+{
+  int   instanceIndex;  // -1 on a miss
+  int   primitiveIndex;
+  vec2  bc;             // Barycentric coordinates (y,z) of the hit
+  float t;              // Hit distance
+  uint  key;            // Material sort key
+};
+
+// Wavefront: a shadow ray, and the radiance it carries if unoccluded
+struct WfShadowRay
+{
+  vec3  origin;
+  vec3  direction;
+  float tmax;
+  vec3  contribution;
+  uint  pixel;
+};
+
+// Wavefront: per-pixel path state carried between the stages
+struct WfPath
+{
+  vec3  C;  // Accumulated radiance
+  vec3  W;  // Path throughput
+  uint  seed;
+  vec3  firstPos;
+  vec3  firstNorm;
+  float firstDepth;
+  vec3  firstCol;
+  float lastPdf;  // Pdf of the BRDF sample that started the current ray; 0 for camera rays
+  float coneWidth;   // Ray cone width at the current ray's origin
+  float coneSpread;  // Ray cone spread angle
+};
+
+#define WF_GROUP_SIZE 256  // Workgroup size of the wavefront compute stages
+#define WF_SORT_BINS  256  // Material buckets of the shade stage's sort
+
+// Wavefront: queue counters, and the indirect arguments derived from them
+struct WfCounters
+{
+  uint rayCount;        // Rays in the current queue
+  uint nextRayCount;    // Rays appended to the next queue by shade
+  uint shadowCount;     // Shadow rays appended by shade
+  uint pad;
+  uint traceArgs[3];    // VkTraceRaysIndirectCommandKHR for extend
+  uint shadowArgs[3];   // VkTraceRaysIndirectCommandKHR for connect
+  uint shadeArgs[3];    // VkDispatchIndirectCommand for sort and shade
 };
 
 struct Vertex  // Created by readModel; used in shaders
@@ -126,13 +294,34 @@ struct PushConstantDenoise
 	float lumenFactor;
 	int stepwidth;
 	BOOL(demodulate);
+	BOOL(varianceGuided);  // Luminance edge stopping, scaled by the variance
+	int src;  // DENOISE_IMAGE_* read
+	int dst;  // DENOISE_IMAGE_* written
+};
+
+#define DENOISE_TILE 16  // Pixels per side of a denoiser workgroup's tile
+
+// The denoiser's images (DenoiseBindings::eImages)
+#define DENOISE_IMAGE_INPUT 0  // The temporal pass's output, colCurr
+#define DENOISE_IMAGE_PING  1  // m_denoiseBuffer
+#define DENOISE_IMAGE_PONG  2  // m_scImageBuffer, which post shows
+
+// Push constant structure for post (post.frag, or post.comp)
+struct PushConstantPost
+{
+	int src;  // POST_SOURCE_* shown
 };
 
+// The images post can show (PostBindings::ePostSources)
+#define POST_SOURCE_SC       0  // m_scImageBuffer: the scanline or denoiser output
+#define POST_SOURCE_COLCURR  1  // The temporal pass's output, undenoised
+#define POST_TILE 8             // Pixels per side of a post.comp workgroup
+
 struct RayPayload
 {
 	bool hit; // Does the ray intersect anything or not?
 	vec3 hitPos; // The world coordinates of the hit point.
-	int instanceIndex; // Index of the object instance hit (we have only one, so =0)
+	int instanceIndex; // Index of the object instance hit (into the InstDesc array)
 	int primitiveIndex; // Index of the hit triangle primitive within object
 	vec3 bc; // Barycentric coordinates of the hit point within triangle
 	uint seed; // random seed
@@ -140,6 +329,16 @@ struct RayPayload
 	float depth;
 };
 
+// A ReSTIR reservoir: the light sample chosen so far, and its weights
+struct Reservoir
+{
+  vec3  lightPoint;  // The chosen point on a light
+  uint  light;       // Index of its emitter
+  float wSum;        // Sum of the resampling weights seen
+  float M;           // Number of candidates seen
+  float W;           // Contribution weight of the chosen sample; 0 if occluded
+};
+
 struct Emitter
 {
 	vec3 v0, v1, v2; // Vertices of light emitting triangle
@@ -40,23 +40,21 @@ VkApp::VkApp(App* _app) : app(_app)
 
     getSurface();
     createCommandPool();
+    createUploader();
+    createPipelineCache();
     
     createSwapchain();
     createDepthResource();
     createPostRenderPass();
     createPostFrameBuffers();
 
-    createScBuffer();
-    createPostDescriptor();
-    createPostPipeline();
+    createRenderGraph();  // And its transient images: sc, denoise, the G-buffer
 
     #ifdef GUI
     initGUI();
     #endif
     
-    myloadModel("models/living_room.obj", glm::mat4());
-
-    createLightbuffer();
+    createEmptyScene();  // Until loadScene's scene streams in
 
     createMatrixBuffer();
     createObjDescriptionBuffer();
@@ -64,9 +62,15 @@ VkApp::VkApp(App* _app) : app(_app)
     createScDescriptorSet();
     createScPipeline();
 
+    chooseTargetFormats();
     createRtBuffers();
-    
-    createDenoiseBuffer();
+    createSamplerTables();
+    createAdaptiveBuffers();
+    createGBuffer();
+
+    createPostDescriptor();  // After the images it shows
+    createPostPipeline();
+    createPostComputePipeline();
 
     // createStuff();
 
@@ -75,22 +79,63 @@ VkApp::VkApp(App* _app) : app(_app)
      initRayTracing();
      createRtAccelerationStructure();
      createRtDescriptorSet();
-     createRtPipeline();
-     createRtShaderBindingTable();
+     if (m_hasRtPipeline) {
+         createRtPipeline();
+         createRtShaderBindingTable(); }
+     else
+         rtBackend = prevRtBackend = eRayQuery;  // The only backend this device can run
+     if (m_hasRayQuery)
+         createRqPipeline();
+     createAdaptivePipelines();
+     createCheckerboardPipeline();
+     createTemporalPipeline();
 
     createDenoiseDescriptorSet();
     createDenoiseCompPipeline();
 
+    createAsyncCompute();  // After the denoise and post pipelines it shares
+
+    loadScene(app->modelPath);
 }
 
 void VkApp::drawFrame()
 {        
+    applySceneUpdates();  // What's streamed in since the last frame
+
+    if (runDenoiseBenchmark) {
+        runDenoiseBenchmark = false;
+        benchmarkDenoise(); }
+    if (runCpuDenoiseCompare) {
+        runCpuDenoiseCompare = false;
+        bool agree = compareCpuDenoise();
+        assert(agree && "The CPU and GPU denoisers disagree");
+        (void)agree; }
+    if (runPrecisionCompare) {
+        runPrecisionCompare = false;
+        comparePrecision(); }
+    updateScreenTargets();  // Repacked, if the GUI changed their formats
+
+    // Denoise and post on the compute queue, overlapping the next trace.
+    // (Not with the swapchain out of date: this frame recreates it.)
+    if (useAsyncCompute && m_asyncTimeline && useRaytracer && useComputePost
+        && drawFrameAsync())
+        return;
+    if (m_asyncPending) {  // Back on one queue: show the last async frame first
+        finishAsyncFrames();
+        // (Not vkDeviceWaitIdle: the upload thread submits to its own queue)
+        vkQueueWaitIdle(m_queue);
+        if (m_computeQueue)
+            vkQueueWaitIdle(m_computeQueue); }
+
     prepareFrame();
     
     VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
     {   // Extra indent for recording commands into m_commandBuffer
+        acquireUploads(m_commandBuffer);  // Finished since the last frame
+        streamTextures(m_commandBuffer);
+        m_graph.newFrame();
         updateCameraBuffer();
         
         // Draw scene
@@ -178,6 +223,8 @@ VkCommandBuffer VkApp::createTempCmdBuffer()
 
 void VkApp::submitTempCmdBuffer(VkCommandBuffer cmdBuffer)
 {
+    flushUploads();  // So cmdBuffer may use them
+
     vkEndCommandBuffer(cmdBuffer);
 
     VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
@@ -208,14 +255,21 @@ void VkApp::submitFrame()
     vkResetFences(m_device, 1, &m_waitFence);
 
     // Pipeline stage at which the queue submission will wait (via pWaitSemaphores)
-    const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    const VkPipelineStageFlags waitStageMask[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                                  VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+    // And the uploads acquired: their batches' copies (see vkapp_upload.cpp)
+    const VkSemaphore waitSemaphores[] = {m_readSemaphore, m_uploadTimeline};
+    const uint64_t waitValues[] = {0, m_uploadWait};
+    VkTimelineSemaphoreSubmitInfo timelineInfo{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.waitSemaphoreValueCount = 2;
+    timelineInfo.pWaitSemaphoreValues    = waitValues;
      
     // The submit info structure specifies a command buffer queue submission batch
     VkSubmitInfo _si_{VK_STRUCTURE_TYPE_SUBMIT_INFO};
-    _si_.pNext             = nullptr;
-    _si_.pWaitDstStageMask = &waitStageMask; //  pipeline stages to wait for
-    _si_.waitSemaphoreCount   = 1;  
-    _si_.pWaitSemaphores = &m_readSemaphore;  // waited upon before execution
+    _si_.pNext             = m_uploadTimeline ? &timelineInfo : nullptr;
+    _si_.pWaitDstStageMask = waitStageMask; //  pipeline stages to wait for
+    _si_.waitSemaphoreCount   = m_uploadTimeline ? 2 : 1;
+    _si_.pWaitSemaphores = waitSemaphores;  // waited upon before execution
     _si_.signalSemaphoreCount = 1;
     _si_.pSignalSemaphores    = &m_writtenSemaphore; // signaled when execution finishes
     _si_.commandBufferCount = 1;
@@ -2,6 +2,16 @@
 #pragma once
 
 #include <algorithm>
+#include <random>
+#include <map>
+#include <set>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
 #include "vulkan/vulkan_core.h"
 //#include <vulkan/vulkan.hpp>  // A modern C++ API for Vulkan. Beware 14K lines of code
 
@@ -23,6 +33,7 @@
 #include "buffer_wrap.h"
 #include "image_wrap.h"
 #include "descriptor_wrap.h"
+#include "render_graph.h"
 #include "acceleration_wrap.h"
 
 //#include "raytracing_wrap.h"
@@ -37,7 +48,6 @@ struct ObjData
     glm::mat4 transform;      // Instance matrix of the object
     BufferWrap vertexBuffer;    // Device buffer of all 'Vertex'
     BufferWrap indexBuffer;     // Device buffer of the indices forming triangles
-    BufferWrap matColorBuffer;  // Device buffer of array of 'Wavefront material'
     BufferWrap matIndexBuffer;  // Device buffer of array of 'Wavefront material'
 };
 
@@ -49,6 +59,21 @@ struct ObjInst
 
 class App;
 
+// Ways to run the path tracer
+enum RtBackend
+{
+    eMegakernel = 0,  // One raygen invocation traces a pixel's whole path
+    eWavefront  = 1,  // Per-bounce stages communicating through ray queues
+    eRayQuery   = 2   // The megakernel in a compute shader, using inline ray queries
+};
+
+// Ways to schedule the denoiser's A-Trous iterations (vkapp_denoise.cpp)
+enum DenoiseSchedule
+{
+    eDenoisePerIteration = 0,  // A dispatch per iteration, copied back to its input
+    eDenoiseFused        = 1   // Steps 1 and 2 in one dispatch, the rest ping-ponged
+};
+
 class VkApp
 {
 public:
@@ -64,8 +89,11 @@ public:
     std::vector<const char*> reqDeviceExtensions = {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,		 // Presentation engine; draws to screen
         VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,	 // Ray tracing extension
-        VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,	 // Ray tracing extension
-        VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME}; // Required by ray tracing pipeline;
+        VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME}; // Required by acceleration structures;
+    // createPhysicalDevice appends VK_KHR_ray_tracing_pipeline and/or VK_KHR_ray_query
+    bool m_hasRtPipeline{false};  // Megakernel and wavefront backends available
+    bool m_hasRayQuery{false};    // Ray query backend available
+    bool m_hasFloat16{false};     // shaderFloat16: denoiseX_fp16
     
     App* app;
     VkApp(App* _app);
@@ -91,12 +119,17 @@ public:
     void createPhysicalDevice();
 
     uint32_t m_graphicsQueueIndex{VK_QUEUE_FAMILY_IGNORED};
+    uint32_t m_computeQueueIndex{VK_QUEUE_FAMILY_IGNORED};  // Compute only, for async compute
+    bool m_computeTimestamps = false;  // Its queue writes timestamps
+    uint32_t m_transferQueueIndex{VK_QUEUE_FAMILY_IGNORED};  // Transfer only, for the upload thread
     void chooseQueueIndex();
 
     VkDevice m_device{};
     void createDevice();
 
     VkQueue m_queue{};
+    VkQueue m_computeQueue{};
+    VkQueue m_transferQueue{};  // The upload thread's
     void getCommandQueue();
     
     void loadExtensions();
@@ -135,6 +168,52 @@ public:
 
     VkPipeline m_postPipeline{VK_NULL_HANDLE};
     void createPostPipeline();
+
+    // Post as a compute pass, straight to the swapchain, see vkapp_post.cpp
+    bool m_storageSwapchain = false;  // Swapchain images created with VK_IMAGE_USAGE_STORAGE_BIT
+    VkPipeline m_postComputePipeline{VK_NULL_HANDLE};  // Only with m_storageSwapchain
+    PushConstantPost m_pcPost{};
+    bool storageSwapchainSupported(const VkSurfaceCapabilitiesKHR& capabilities, VkFormat format);
+    void createPostComputePipeline();
+    int postSource();
+    void postCompute();
+
+    // Async compute: denoise and post on a compute queue, overlapping
+    // the next frame's trace, see vkapp_async.cpp
+    struct AsyncFrame
+    {
+        VkCommandBuffer trace{};    // Graphics: the trace, temporal pass and copies
+        VkCommandBuffer handoff{};  // Graphics: the filter's inputs, released to compute
+        VkCommandBuffer filter{};   // Compute: denoise and post, into the swapchain image
+        VkCommandBuffer gui{};      // Graphics: the swapchain image acquired back, the GUI
+        VkSemaphore acquired{};     // Binary: the swapchain image, acquired
+        VkSemaphore written{};      // Binary: the swapchain image, ready to present
+        uint32_t swapchainIndex{0};
+        uint64_t frame{0};          // The frame it holds: timeline values 2*frame+1..2, done frame+1
+        bool timed{true};           // Its timestamps have been read
+    };
+    static const int ASYNC_FRAMES = 2;  // Frames in flight
+    AsyncFrame m_asyncFrames[ASYNC_FRAMES];
+    VkCommandPool m_computeCmdPool{VK_NULL_HANDLE};
+    VkSemaphore m_asyncTimeline{VK_NULL_HANDLE};  // Traced, filtered
+    VkSemaphore m_asyncDone{VK_NULL_HANDLE};      // The gui's: a slot is free again
+    uint64_t m_asyncFrame{0};      // Frames drawn async so far
+    bool m_asyncPending = false;   // The last frame's GUI and present are still to submit
+    bool m_asyncActive = false;    // The frame being recorded is drawn async
+    ImageWrap m_asyncColorBuffer{}, m_asyncKdBuffer{}, m_asyncNdBuffer{}, m_asyncVarBuffer{};  // The filter's inputs
+    ImageWrap m_asyncPingBuffer{}, m_asyncPongBuffer{};  // The denoiser's, on the compute queue
+    DescriptorWrap m_asyncDenoiseDesc{};
+    std::vector<DescriptorWrap> m_asyncPostDescs{};  // One per swapchain image
+    VkQueryPool m_asyncQueryPool{VK_NULL_HANDLE};   // Per frame in flight: trace, filter begin/end
+    double m_asyncPrevFilter[2]{0, 0};  // The last filter's begin and end, ns
+    double m_asyncTraceMs{0}, m_asyncFilterMs{0}, m_asyncOverlapMs{0};
+    int m_asyncTimed{0};
+    bool asyncComputeAvailable() const { return m_computeQueue && m_postComputePipeline; }
+    void createAsyncCompute();
+    void destroyAsyncCompute();
+    bool drawFrameAsync();  // False: skipped, the swapchain's out of date
+    void finishAsyncFrames();
+    void readAsyncTimestamps(AsyncFrame& f);
     
     VkCommandBuffer beginSingleTimeCommands();
 
@@ -152,8 +231,13 @@ public:
     VkFramebuffer m_scanlineFramebuffer{VK_NULL_HANDLE};
     void createScanlineRenderPass();
 
-    ImageWrap m_scImageBuffer{};
-    void createScBuffer();
+    ImageWrap m_scImageBuffer{};  // Transient, see vkapp_graph.cpp
+
+    // The frame's passes and the images they use, see vkapp_graph.cpp
+    RenderGraph m_graph{};
+    int m_rgRaytrace{-1}, m_rgRaytraceHybrid{-1}, m_rgDenoise{-1}, m_rgRasterize{-1};
+    int m_rgPostSc{-1}, m_rgPostColCurr{-1};  // Post, by postSource
+    void createRenderGraph();
     
     ImageWrap m_rtColCurrBuffer{}; 
     ImageWrap m_rtColPrevBuffer{}; 
@@ -162,27 +246,188 @@ public:
     ImageWrap m_rtNdPrevBuffer{};
 
     ImageWrap m_rtKdCurrBuffer{};
+    ImageWrap m_rtSampleBuffer{};  // This frame's samples, blended into colCurr by temporal.comp
+
+    // The screen targets that can be packed (vkapp_formats.cpp): Nd,
+    // Kd and the samples, at full precision or smaller.  The rest stay
+    // rgba32f.
+    bool packNd = true, packKd = true, packSample = true;  // Set by the GUI
+    bool m_canPackNd{false}, m_canPackKd{false}, m_canPackSample{false};  // The formats' storage support
+    VkFormat m_ndFormat = VK_FORMAT_R32G32B32A32_SFLOAT;  // As created
+    VkFormat m_kdFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+    VkFormat m_sampleFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+    bool runPrecisionCompare = false;  // Set by the GUI, run before the next frame
+    void chooseTargetFormats();
+    void createScreenTargets();
+    void destroyScreenTargets();
+    void updateScreenTargets();
+    void comparePrecision();
+    ImageWrap m_rtMotionBuffer{};  // Per-pixel motion vectors
+    ImageWrap m_rtLumMomCurrBuffer{};  // Luminance moments and variance, see temporal.comp
+    ImageWrap m_rtLumMomPrevBuffer{};
     //ImageWrap m_rtKdPrevBuffer{}; not needed
 
+    BufferWrap m_reservoirBW{};  // ReSTIR reservoirs, 2 per pixel (current and previous frame)
+
+    BufferWrap m_samplerBW{};  // Sobol matrices and blue noise ranks, see vkapp_sampler.cpp
+
+    // Adaptive sampling, see vkapp_adaptive.cpp
+    ImageWrap m_rtMomentsBuffer{};  // Per-pixel luminance moments
+    BufferWrap m_adaptiveListBW{};  // AdaptiveCounters, then the work list
+    VkDeviceAddress m_adaptiveListAddress{};
+    VkPipelineLayout m_adaptivePipelineLayout{};
+    VkPipeline m_adaptivePlanPipeline{};
+    VkPipeline m_adaptiveArgsPipeline{};
+    void createAdaptiveBuffers();
+    void createAdaptivePipelines();
+    void buildAdaptiveList();
+    void destroyAdaptive();
+
+    // Hybrid renderer's G-buffer, see vkapp_gbuffer.cpp
+    ImageWrap m_gbPosBuffer{};  // Transient
+    ImageWrap m_gbIdBuffer{};   // Transient
+    VkRenderPass m_gbRenderPass{VK_NULL_HANDLE};
+    VkFramebuffer m_gbFramebuffer{VK_NULL_HANDLE};
+    VkPipelineLayout m_gbPipelineLayout{};
+    VkPipeline m_gbPipeline{};
+    void createGBuffer();
+    void rasterizeGBuffer();
+    void destroyGBuffer();
+
+    // Checkerboard rendering's reconstruction, see vkapp_checkerboard.cpp
+    VkPipelineLayout m_checkerPipelineLayout{};
+    VkPipeline m_checkerPipeline{};
+    void createCheckerboardPipeline();
+    void reconstructCheckerboard();
+    void destroyCheckerboard();
+
+    // Temporal accumulation, see vkapp_temporal.cpp
+    VkPipelineLayout m_temporalPipelineLayout{};
+    VkPipeline m_temporalPipeline{};
+    void createTemporalPipeline();
+    void temporalAccumulate();
+    void destroyTemporal();
+    void createSamplerTables();
+    std::mt19937 m_frameRng{};  // Full 32 bit frame seeds for eSamplerRandom
+
     ImageWrap m_rtColHistBuffer{};
     ImageWrap m_rtPosHistBuffer{};
     void createRtBuffers();
     
-    ImageWrap m_denoiseBuffer{};
-    void createDenoiseBuffer();
+    ImageWrap m_denoiseBuffer{};  // Transient
 
     // Arrays of objects instances and textures in the scene
     std::vector<ObjData>  m_objData{};  // Obj data in Vulkan Buffers
     std::vector<ObjDesc>  m_objDesc{};  // Device-addresses of those buffers
     std::vector<ImageWrap>  m_objText{};  // All textures of the scene
     std::vector<ObjInst>  m_objInst{};  // Instances paring an object and a transform
+    std::vector<BufferWrap> m_objMaterials{};  // One material buffer per model, shared by its objects
     std::vector<Emitter> m_emitterList;
     BufferWrap m_lightBuffer;
 
-    void myloadModel(const std::string& filename, glm::mat4 transform);
+    uint32_t m_maxClusterTriangles = 1<<16;  // Larger meshes are split into several BLASes
+    void myloadModel(const std::string& filename, glm::mat4 transform, uint64_t generation);
     void createLightbuffer();
 
+    // Texture streaming, see vkapp_texstream.cpp.  A texture arrives
+    // with its coarse levels only; finer ones are streamed in as the
+    // shaders ask for them (eTexFeedback), within a memory budget, and
+    // the shaders sample no finer than its resident ones (eTexMinLod).
+    struct TextureMips  // Decoded RGBA8, the whole chain, kept in memory
+    {
+        int width{0}, height{0};
+        std::vector<std::vector<uint8_t>> levels;  // Level 0 first
+    };
+    struct StreamedTexture  // By slot, as m_objText
+    {
+        std::shared_ptr<const TextureMips> mips;  // None: not arrived (or not streamed)
+        int resident{0};       // The finest level the shaders sample: its min LOD
+        int uploaded{0};       // The finest level whose data are in its image
+        int requested{0};      // The finest level the feedback asks for
+        int pending{-1};       // A level being uploaded into its image, or -1
+        uint64_t lastUsed{0};  // Frame (m_texFrame) it was last sampled in
+    };
+    struct StreamedLevel  // Uploaded into its slot's image
+    {
+        uint64_t generation{0};
+        int slot{0};
+        int level{0};
+        bool uploaded{false};  // False: its upload failed
+        VkImage image{VK_NULL_HANDLE};
+    };
+    std::vector<StreamedTexture> m_texStream;
+    BufferWrap m_texFeedbackBW{};             // Device local, written by the shaders
+    BufferWrap m_texReadbackBW{};             // Host visible, copied from it each frame
+    const uint32_t* m_texReadback{nullptr};   // Mapped
+    BufferWrap m_texMinLodBW{};               // Device local, by slot: the resident level
+    std::vector<float> m_texMinLod;           // As last written to it
+    int m_texBudgetMB{256};                   // GUI
+    VkDeviceSize m_texResidentBytes{0};       // GUI
+    uint64_t m_texFrame{0};
+    std::vector<StreamedLevel> m_texReady;    // Waiting for streamTextures
+    std::vector<ImageWrap> m_texOrphans;      // Of a replaced scene, a level still uploading
+    std::deque<std::function<void()>> m_texJobs;
+    std::mutex m_texMutex;
+    std::condition_variable m_texCv;
+    std::thread m_texThread;
+    bool m_texQuit{false};
+    static std::shared_ptr<const TextureMips> loadTextureMips(const std::string& fileName);
+    static int coarseLevel(const TextureMips& mips);
+    ImageWrap createStreamedImage(const TextureMips& mips);
+    void uploadTextureLevels(const TextureMips& mips, VkImage image, int firstLevel, int lastLevel,
+                             bool created, std::function<void()> done);
+    void createTexStreaming();
+    void streamTextures(VkCommandBuffer cmd);
+    void streamTextureLevel(int slot, int level);
+    void texStreamWorker();
+    void destroyTexStreaming();
+
+    // Streamed scene loading, see vkapp_scene.cpp.  A loader thread
+    // parses the model and queues its meshes and textures as streamed
+    // uploads; each joins the scene between frames once it's on the GPU.
+    struct SceneLoad  // Posted once parsed, and its materials uploaded
+    {
+        uint64_t generation{0};
+        std::string path;
+        std::vector<Emitter> emitters;
+        BufferWrap materials{};
+        uint32_t nbParts{0};     // Objects to come
+        uint32_t nbTextures{0};  // Textures to come
+        std::vector<ObjInst> instances;  // objIndex is the part's index
+    };
+    struct SceneArrival  // A part (object) or a texture, uploaded
+    {
+        uint64_t generation{0};
+        int part{-1};
+        int texture{-1};
+        ObjData object{};
+        ObjDesc desc{};
+        ImageWrap image{};
+        std::shared_ptr<const TextureMips> mips;  // The texture's, and its image's level 0
+        int level{0};
+    };
+    std::atomic<uint64_t> m_sceneGeneration{0};  // Of the latest loadScene; older loaders stop
+    uint64_t m_sceneShown{0};                    // Of the scene in m_objData etc.
+    std::string m_scenePath;
+    std::vector<std::shared_ptr<SceneLoad>> m_sceneLoads;  // Waiting for applySceneUpdates
+    std::vector<SceneArrival> m_sceneArrivals;             //   likewise
+    std::mutex m_sceneMutex;
+    std::vector<std::thread> m_sceneThreads;
+    std::vector<std::thread::id> m_sceneThreadsDone;  // Finished, to join (m_sceneMutex)
+    std::vector<int> m_scenePartObject;          // Each part's index in m_objData, or -1
+    std::vector<ObjInst> m_sceneInstances;       // By part, as in SceneLoad
+    uint32_t m_textureSlots{0};                  // Size of the eTextures binding
+    ImageWrap m_placeholderTexture{};            // In every slot without a texture (yet)
+    bool m_sceneChanged = false;                 // Restarts accumulation
+    void createEmptyScene();
+    void loadScene(const std::string& path);
+    void applySceneUpdates();
+    void writeSceneDescriptors();
+    void destroyScene();
+    void destroySceneLoader();
+
     BufferWrap m_objDescriptionBW{};  // Device buffer of the OBJ descriptions
+    BufferWrap m_instDescriptionBW{};  // Device buffer of the instance descriptions
     void createObjDescriptionBuffer();
 
     DescriptorWrap m_scDesc{};
@@ -192,6 +437,7 @@ public:
     VkPipelineLayout            m_scanlinePipelineLayout{};
     VkPipeline                  m_scanlinePipeline{};
     void createScPipeline();
+    VkPipeline buildScPipeline(const VkSpecializationInfo* spec);
 
     BufferWrap m_matrixBW{};  // Device-Host of the camera matrices
     void   createMatrixBuffer();
@@ -222,13 +468,93 @@ public:
     VkPipelineLayout                                  m_rtPipelineLayout{};
     VkPipeline                                        m_rtPipeline{};
     void createRtPipeline();
+    VkPipeline buildRtPipeline(const VkSpecializationInfo* spec);
     
+    VkPipelineLayout m_rqPipelineLayout{};
+    VkPipeline       m_rqPipeline{};
+    void createRqPipeline();
+    VkPipeline buildRqPipeline(const VkSpecializationInfo* spec);
+
     BufferWrap m_shaderBindingTableBW;
     VkStridedDeviceAddressRegionKHR m_rgenRegion{};
     VkStridedDeviceAddressRegionKHR m_missRegion{};
     VkStridedDeviceAddressRegionKHR m_hitRegion{};
     VkStridedDeviceAddressRegionKHR m_callRegion{};
     void createRtShaderBindingTable();
+    void writeShaderBindingTable(VkPipeline pipeline, uint8_t* mappedMemAddress);
+
+    // Pipeline variants specialized for the feature toggles, see
+    // vkapp_variants.cpp.  Built on a worker thread, on first use.
+    struct RtVariant
+    {
+        VkPipeline pipeline{};
+        BufferWrap sbt{};  // Host visible: written by the worker, with no queue
+        VkStridedDeviceAddressRegionKHR rgen{}, miss{}, hit{};
+    };
+    VkPipelineCache m_pipelineCache{};
+    std::map<uint32_t, RtVariant> m_rtVariants;   // By rtVariantKey()
+    std::map<uint32_t, VkPipeline> m_rqVariants;  // By rtVariantKey()
+    std::map<int, VkPipeline> m_scVariants;       // By the BRDF's sign
+    std::set<uint64_t> m_variantsRequested;
+    std::deque<std::function<void()>> m_variantJobs;
+    std::mutex m_variantMutex;
+    std::condition_variable m_variantCv;
+    std::thread m_variantThread;
+    bool m_variantQuit{false};
+    void createPipelineCache();
+    uint32_t rtVariantKey();
+    const RtVariant* rtVariant();
+    VkPipeline rqVariant();
+    VkPipeline scVariant();
+    void requestVariant(uint64_t id, std::function<void()> build);
+    void variantWorker();
+    void destroyVariants();
+
+    // Uploads to device local memory, see vkapp_upload.cpp.  Copied on
+    // a transfer-only queue by a worker thread where there's one, and
+    // handed to the graphics queue at the start of a frame.
+    struct Upload
+    {
+        std::vector<BufferWrap> staging;                // Host visible sources, destroyed once copied
+        std::function<void(VkCommandBuffer)> copy;      // Transfer commands
+        std::vector<VkBufferMemoryBarrier> buffers;     // Handed to the graphics queue after the copies
+        std::vector<VkImageMemoryBarrier> images;       //   (their dstAccessMask, layouts and ranges)
+        std::function<void(VkCommandBuffer)> acquired;  // Graphics commands after the handover (mipmaps)
+        std::function<void()> done;                     // Render thread, once handed over
+        uint64_t batch{0};                              // Its batch's value on m_uploadTimeline
+    };
+    struct UploadBatch  // Submitted by the upload thread, its copies maybe not finished
+    {
+        uint64_t value{0};
+        VkCommandBuffer cmd{VK_NULL_HANDLE};
+        std::vector<BufferWrap> staging;
+    };
+    VkCommandPool m_transferCmdPool{VK_NULL_HANDLE};  // The upload thread's
+    VkSemaphore m_uploadTimeline{VK_NULL_HANDLE};     // Signalled by each batch of copies
+    uint64_t m_uploadValue{0};                        // The last batch's
+    uint64_t m_uploadWait{0};                         // The last batch acquired: graphics submits wait on it
+    std::deque<UploadBatch> m_uploadsInFlight;        // The upload thread's, to free once copied
+    std::deque<Upload> m_uploadJobs;    // Queued
+    std::deque<Upload> m_uploadStream;  // Queued behind them, a few per batch (scene streaming)
+    std::deque<Upload> m_uploadsCopied; // Released, waiting to be handed over
+    int m_uploadsBusy{0};               // Being recorded and submitted
+    uint64_t m_uploadBatches{0};        // Batches released so far
+    std::mutex m_uploadMutex;
+    std::condition_variable m_uploadCv;      // New jobs, or quit
+    std::condition_variable m_uploadIdleCv;  // A batch released
+    std::thread m_uploadThread;
+    bool m_uploadQuit{false};
+    void createUploader();
+    static const int UPLOAD_STREAM_BATCH = 16;  // Streamed uploads per batch
+    static const int UPLOAD_RETIRE_MS = 2;      // How often the batches in flight are checked
+    void queueUpload(Upload upload, bool stream=false);
+    void uploadWorker();
+    void retireUploads(bool wait);
+    bool acquireUploads(VkCommandBuffer cmd);
+    void flushUploads();
+    void flushStreamedUploads();
+    void waitUploadsAcquired();
+    void destroyUploader();
 
     DescriptorWrap m_postDesc{};
     void createPostDescriptor();
@@ -238,13 +564,64 @@ public:
     
     VkPipelineLayout            m_denoiseCompPipelineLayout{};
     VkPipeline                  m_denoisePipelineX{}, m_denoisePipelineY{};
+    VkPipeline                  m_denoisePipelineFused{};  // Steps 1 and 2 in one dispatch
+    VkPipeline                  m_denoisePipelineX16{};    // denoiseX in half precision, with m_hasFloat16
     void createDenoiseCompPipeline();
+    void recordDenoise(VkCommandBuffer cmd, VkDescriptorSet descSet, VkExtent2D size,
+                       ImageWrap& ping, ImageWrap& pong, int schedule,
+                       VkPipelineStageFlags readers = 0);
+    void benchmarkDenoise();
+    std::vector<float> readbackImage(ImageWrap& image,  // vkapp_denoise_cpu.cpp
+                                     VkFormat format=VK_FORMAT_R32G32B32A32_SFLOAT);
+    bool compareCpuDenoise();  // False: they differ by more than the tolerance
+
+    // Wavefront path tracer (vkapp_wavefront.cpp), created on first use
+    uint32_t m_wfCapacity{0};  // Paths in flight: one per pixel
+    BufferWrap m_wfRaysBW{};
+    BufferWrap m_wfHitsBW{};
+    BufferWrap m_wfShadowRaysBW{};
+    BufferWrap m_wfPathsBW{};
+    BufferWrap m_wfCountersBW{};
+    BufferWrap m_wfSortBW{};
+    VkDeviceAddress m_wfCountersAddress{0};
+    void createWavefrontBuffers();
+
+    DescriptorWrap m_wfDesc{};
+    void createWavefrontDescriptorSet();
+
+    VkPipelineLayout m_wfPipelineLayout{VK_NULL_HANDLE};
+    VkPipeline m_wfRtPipeline{}, m_wfGeneratePipeline{}, m_wfSortPipeline{};
+    VkPipeline m_wfShadePipeline{}, m_wfArgsPipeline{}, m_wfResolvePipeline{};
+    void createWavefrontPipelines();
+
+    BufferWrap m_wfShaderBindingTableBW{};
+    VkStridedDeviceAddressRegionKHR m_wfExtendRegion{};
+    VkStridedDeviceAddressRegionKHR m_wfConnectRegion{};
+    VkStridedDeviceAddressRegionKHR m_wfMissRegion{};
+    VkStridedDeviceAddressRegionKHR m_wfHitRegion{};
+    void createWavefrontShaderBindingTable();
+
+    PushConstantWavefront m_pcWf{};
+    void wavefrontBarrier();
+    void raytraceWavefront();
+    void destroyWavefront();
 
     // Run loop 
     bool useRaytracer = true;
+    int rtBackend = eMegakernel;
+    int prevRtBackend = eMegakernel;
     bool useExplicit = true;
+    bool useRestir = false;
+    int sampler = eSamplerSobol;
+    bool useAdaptive = false;
+    bool useHybrid = false;
+    bool useCheckerboard = false;
+    bool useVariants = true;  // Specialized pipelines, when built; else the generic ones
+    int prevSampler = eSamplerSobol;
     bool useHistory = true;
     bool useDenoise = true;
+    bool useComputePost = true;  // Where the swapchain allows it; else post.frag's render pass
+    bool useAsyncCompute = true;  // Where there's a compute queue, and post runs in compute
     bool prevUseDenoise = true;
     bool prevUseHistory = true;
     float f_nThreshold =0.95f;
@@ -252,8 +629,13 @@ public:
 
     float f_normFactor =0.003f;
     float f_depthFactor = 0.007f;
-    float f_lumenFactor = 0.0f;
+    float f_lumenFactor = 4.0f;  // Standard deviations of luminance, with useVarianceGuided
     bool useDemodulate = true;
+    bool useVarianceGuided = true;
+    int denoiseSchedule = eDenoiseFused;
+    bool runDenoiseBenchmark = false;  // Set by the GUI, run before the next frame
+    bool runCpuDenoiseCompare = false;  // Likewise: the CPU denoiser against the GPU's
+    bool useFp16Denoise = true;  // denoiseX_fp16 for the per-iteration passes, with m_hasFloat16
 
     void prepareFrame();
     void ResetRtAccumulation();
@@ -262,11 +644,14 @@ public:
     void updateCameraBuffer();
     void rasterize();
     void raytrace();
+    void raytraceMegakernel();
+    void raytraceRayQuery();
     void denoise();
     
     uint32_t m_swapchainIndex{0};
     
     void postProcess();
+    void recordGUI();
     void submitFrame();
 
        
@@ -285,6 +670,14 @@ public:
     {
         return createStagedBufferWrap(cmdBuf, sizeof(T)*data.size(), data.data(), usage);
     }
+    // A device local buffer, with its staging buffer and copy added to upload
+    BufferWrap stageBuffer(Upload& upload, VkDeviceSize size, const void* data,
+                           VkBufferUsageFlags usage);
+    template <typename T>
+    BufferWrap stageBuffer(Upload& upload, const std::vector<T>& data, VkBufferUsageFlags usage)
+    {
+        return stageBuffer(upload, sizeof(T)*data.size(), data.data(), usage);
+    }
     
 
     BufferWrap createBufferWrap(VkDeviceSize size, VkBufferUsageFlags usage,
@@ -303,23 +696,36 @@ public:
         VkImageLayout newImageLayout,
         VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT);
 
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    void copyBufferToImage(VkCommandBuffer cmd, VkBuffer buffer, VkImage image,
+                           uint32_t width, uint32_t height);
     
-    void CmdCopyImage(ImageWrap& src, ImageWrap& dst);
-
-    ImageWrap createTextureImage(std::string fileName);
-    ImageWrap createBufferImage(VkExtent2D& size);
+    void CmdCopyImage(VkCommandBuffer cmd, ImageWrap& src, ImageWrap& dst, VkExtent2D size,
+                      VkPipelineStageFlags2 writers = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                      VkPipelineStageFlags2 readers = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+    void CmdCopyImages(VkCommandBuffer cmd, const std::vector<std::pair<ImageWrap*, ImageWrap*>>& copies,
+                       VkExtent2D size, VkPipelineStageFlags2 writers, VkPipelineStageFlags2 readers,
+                       bool convert = false);
+
+    ImageWrap createTextureImage(std::string fileName,
+                                 std::function<void(const ImageWrap&)> done=nullptr,
+                                 bool stream=false);
+    ImageWrap createTextureFromPixels(const void* pixels, int width, int height,
+                                      std::function<void(const ImageWrap&)> done=nullptr,
+                                      bool stream=false);
+    ImageWrap createBufferImage(VkExtent2D& size, bool transient=false,
+                                VkFormat format=VK_FORMAT_R32G32B32A32_SFLOAT);
     
     ImageWrap createImageWrap(uint32_t width, uint32_t height,
                               VkFormat format,
                               VkImageUsageFlags usage,
                               VkMemoryPropertyFlags properties,
-                              uint32_t mipLevels=1);
+                              uint32_t mipLevels=1, bool bind=true);
 
     VkImageView createImageView(VkImage image, VkFormat format,
-                                VkImageAspectFlagBits aspect=VK_IMAGE_ASPECT_COLOR_BIT);
-    VkSampler createTextureSampler();
+                                VkImageAspectFlagBits aspect=VK_IMAGE_ASPECT_COLOR_BIT,
+                                uint32_t mipLevels=1);
+    VkSampler createTextureSampler(uint32_t mipLevels=1);
     
-    void generateMipmaps(VkImage image, VkFormat imageFormat,
+    void generateMipmaps(VkCommandBuffer cmd, VkImage image, VkFormat imageFormat,
                          int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
 };
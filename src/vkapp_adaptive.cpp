@@ -0,0 +1,133 @@
+// Adaptive sampling: spend the frame's rays where the image is
+// still noisy.
+//
+//   storeSample accumulates each pixel's luminance moments (mean,
+//   mean square, count) in m_rtMomentsBuffer, next to colCurr.
+//   plan:   compact the pixels whose relative standard error is over
+//           the threshold into a work list, with a sample count that
+//           grows with the error; converged pixels are left out.
+//   args:   turn the list's length into indirect arguments.
+//   trace:  the megakernel or ray query backend, launched indirectly
+//           over the list instead of over the whole image.
+//
+// On a static view the work shrinks to the few pixels that still
+// need it.  The wavefront backend always traces every pixel.
+
+#include <vector>
+
+#include "vkapp.h"
+
+#include "shaders/shared_structs.h"
+
+void VkApp::createAdaptiveBuffers()
+{
+    m_rtMomentsBuffer = createBufferImage(windowSize);
+    transitionImageLayout(m_rtMomentsBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+                          VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_GENERAL, 1);
+
+    // The counters double as indirect arguments, read by device address for trace rays.
+    VkDeviceSize size = sizeof(AdaptiveCounters)
+        + sizeof(AdaptiveItem)*windowSize.width*windowSize.height;
+    m_adaptiveListBW = createBufferWrap(size,
+                                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                                        | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+                                        | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                                        | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkBufferDeviceAddressInfo info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
+    info.buffer = m_adaptiveListBW.buffer;
+    m_adaptiveListAddress = vkGetBufferDeviceAddress(m_device, &info);
+
+    // No moments yet: every pixel starts in the work list.
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    VkClearColorValue zero{};
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdClearColorImage(cmdBuf, m_rtMomentsBuffer.image, VK_IMAGE_LAYOUT_GENERAL,
+                         &zero, 1, &range);
+    submitTempCmdBuffer(cmdBuf);
+}
+
+// The plan and args passes see the ray tracer's descriptor sets and
+// push constants, as the ray query backend does.
+void VkApp::createAdaptivePipelines()
+{
+    VkPushConstantRange pushConstant{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantRay)};
+
+    std::vector<VkDescriptorSetLayout> descSetLayouts =
+        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
+        {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges    = &pushConstant;
+    pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descSetLayouts.size());
+    pipelineLayoutCreateInfo.pSetLayouts    = descSetLayouts.data();
+    vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_adaptivePipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_adaptivePipelineLayout;
+
+    std::vector<std::pair<std::string, VkPipeline*>> computeShaders = {
+        {"spv/adaptive_plan.comp.spv", &m_adaptivePlanPipeline},
+        {"spv/adaptive_args.comp.spv", &m_adaptiveArgsPipeline}};
+
+    for (auto& [file, pipeline] : computeShaders) {
+        cpCreateInfo.stage = createShaderStageInfo(loadFile(file), VK_SHADER_STAGE_COMPUTE_BIT);
+        vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, pipeline);
+        vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr); }
+}
+
+void VkApp::destroyAdaptive()
+{
+    vkDestroyPipeline(m_device, m_adaptivePlanPipeline, nullptr);
+    vkDestroyPipeline(m_device, m_adaptiveArgsPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_adaptivePipelineLayout, nullptr);
+
+    m_rtMomentsBuffer.destroy(m_device);
+    m_adaptiveListBW.destroy(m_device);
+}
+
+// Build this frame's work list, and its indirect arguments.
+void VkApp::buildAdaptiveList()
+{
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+
+    vkCmdFillBuffer(m_commandBuffer, m_adaptiveListBW.buffer, 0, sizeof(uint), 0);
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_adaptivePipelineLayout, 0, (uint32_t)descSets.size(),
+                            descSets.data(), 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_adaptivePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantRay), &m_pcRay);
+
+    // Plan: this MUST match the shader's local_size of 8x8
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_adaptivePlanPipeline);
+    vkCmdDispatch(m_commandBuffer, (windowSize.width+7)/8, (windowSize.height+7)/8, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // Args
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_adaptiveArgsPipeline);
+    vkCmdDispatch(m_commandBuffer, 1, 1, 1);
+
+    // The trace reads the list, and the arguments as indirect commands
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    VkPipelineStageFlags readers = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+        | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+    if (m_hasRtPipeline) readers |= VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, readers,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
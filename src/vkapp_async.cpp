@@ -0,0 +1,462 @@
+// Async compute: the denoiser and post on a compute-only queue family,
+// overlapping the next frame's trace on the graphics queue.
+//
+// A frame is four submissions, ordered by two timeline semaphores.
+// m_asyncTimeline takes values 2N+1 (traced) and 2N+2 (filtered) for
+// frame N, m_asyncDone N+1 (done).  Done needs one of its own: frame
+// N's gui is submitted after frame N+1's handoff, so on one timeline
+// it would signal a lower value after a higher one.
+//
+//   trace    (graphics):  the camera, the trace and the temporal pass,
+//                         as in the one queue frame.  Waits on nothing.
+//   handoff  (graphics):  copies the filter's inputs (colCurr, KdCurr,
+//                         NdCurr, the variance) to images of their own,
+//                         and releases them to the compute family.
+//                         Waits for frame N-1's filter to be done with
+//                         them; signals traced.
+//   filter   (compute):   acquires the inputs and the swapchain image,
+//                         denoises (the fused schedule) and runs
+//                         post.comp into the swapchain image, and
+//                         releases that to the graphics family.  Signals
+//                         filtered.
+//   gui      (graphics):  acquires the swapchain image, draws the GUI
+//                         over it, and presents.  Signals done.
+//
+// Frame N's gui goes in after frame N+1's trace and handoff, so the
+// graphics queue never idles waiting for the filter: frame N's filter
+// runs beside frame N+1's trace.  The frame shown is one frame later
+// for it.  Two frames are in flight, each with its own command buffers
+// and binary semaphores.
+//
+// The swapchain image is acquired first, before anything is recorded.
+// An out of date swapchain skips the frame, with no timeline value
+// spent, and drawFrame falls back to the one queue frame, whose
+// prepareFrame recreates the swapchain.
+//
+// The trace's and the filter's GPU times and their overlap are printed
+// every so many frames, from timestamps on both queues (comparable on
+// the usual desktop GPUs, though Vulkan doesn't promise it).
+
+#include <vector>
+#include <algorithm>
+
+#include "vkapp.h"
+
+#include "shaders/shared_structs.h"
+
+static const int ASYNC_REPORT_FRAMES = 300;  // Frames per overlap report
+
+void VkApp::createAsyncCompute()
+{
+    if (!asyncComputeAvailable()) {
+        printf("Async compute: no %s, denoise and post on the graphics queue\n",
+               m_computeQueue ? "storage swapchain" : "compute-only queue family");
+        return; }
+
+    VkCommandPoolCreateInfo poolCreateInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolCreateInfo.queueFamilyIndex = m_computeQueueIndex;
+    if (vkCreateCommandPool(m_device, &poolCreateInfo, nullptr, &m_computeCmdPool) != VK_SUCCESS)
+        throw std::runtime_error("failed to create compute command pool!");
+
+    VkSemaphoreTypeCreateInfo typeInfo{VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue  = 0;
+    VkSemaphoreCreateInfo timelineCreateInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    timelineCreateInfo.pNext = &typeInfo;
+    if (vkCreateSemaphore(m_device, &timelineCreateInfo, nullptr, &m_asyncTimeline) != VK_SUCCESS
+        || vkCreateSemaphore(m_device, &timelineCreateInfo, nullptr, &m_asyncDone) != VK_SUCCESS)
+        throw std::runtime_error("failed to create timeline semaphore!");
+
+    for (AsyncFrame& f : m_asyncFrames) {
+        VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocateInfo.commandPool        = m_cmdPool;
+        allocateInfo.commandBufferCount = 1;
+        allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        vkAllocateCommandBuffers(m_device, &allocateInfo, &f.trace);
+        vkAllocateCommandBuffers(m_device, &allocateInfo, &f.handoff);
+        vkAllocateCommandBuffers(m_device, &allocateInfo, &f.gui);
+        allocateInfo.commandPool        = m_computeCmdPool;
+        vkAllocateCommandBuffers(m_device, &allocateInfo, &f.filter);
+
+        VkSemaphoreCreateInfo semCreateInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+        if (vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &f.acquired) != VK_SUCCESS
+            || vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &f.written) != VK_SUCCESS)
+            throw std::runtime_error("failed to create semaphore!"); }
+
+    // The filter's own images.  Their layouts are set each frame, by
+    // the handoff's copies, or discarded (UNDEFINED) on the compute queue.
+    m_asyncColorBuffer = createBufferImage(windowSize);
+    m_asyncKdBuffer    = createBufferImage(windowSize, false, m_kdFormat);  // As the targets they copy
+    m_asyncNdBuffer    = createBufferImage(windowSize, false, m_ndFormat);
+    m_asyncVarBuffer   = createBufferImage(windowSize);
+    m_asyncPingBuffer  = createBufferImage(windowSize);
+    m_asyncPongBuffer  = createBufferImage(windowSize);
+
+    // The denoiser's descriptor set, and post's (one per swapchain
+    // image), on those images.  Same bindings, so the same pipelines.
+    m_asyncDenoiseDesc.setBindings(m_device, m_denoiseDesc.bindingTable);
+    m_asyncDenoiseDesc.write(m_device, DenoiseBindings::eImages,
+                             std::vector<ImageWrap>{m_asyncColorBuffer, m_asyncPingBuffer, m_asyncPongBuffer});
+    m_asyncDenoiseDesc.write(m_device, DenoiseBindings::eInCurrKd, m_asyncKdBuffer.Descriptor());
+    m_asyncDenoiseDesc.write(m_device, DenoiseBindings::eInCurrNd, m_asyncNdBuffer.Descriptor());
+    m_asyncDenoiseDesc.write(m_device, DenoiseBindings::eInVariance, m_asyncVarBuffer.Descriptor());
+
+    m_asyncPostDescs.resize(m_imageCount);
+    for (uint32_t i = 0; i < m_imageCount; i++) {
+        m_asyncPostDescs[i].setBindings(m_device, m_postDesc.bindingTable);
+        m_asyncPostDescs[i].write(m_device, PostBindings::ePostSources,
+                                  std::vector<ImageWrap>{m_asyncPongBuffer, m_asyncColorBuffer});
+        VkDescriptorImageInfo swapchainImage{VK_NULL_HANDLE, m_imageViews[i], VK_IMAGE_LAYOUT_GENERAL};
+        m_asyncPostDescs[i].write(m_device, PostBindings::ePostSwapchain, swapchainImage); }
+
+    if (m_computeTimestamps) {
+        VkQueryPoolCreateInfo queryInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+        queryInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+        queryInfo.queryCount = 4*ASYNC_FRAMES;
+        if (vkCreateQueryPool(m_device, &queryInfo, nullptr, &m_asyncQueryPool) != VK_SUCCESS)
+            throw std::runtime_error("failed to create query pool!"); }
+
+    printf("Async compute: denoise and post on queue family %u\n", m_computeQueueIndex);
+}
+
+void VkApp::destroyAsyncCompute()
+{
+    if (!m_asyncTimeline)
+        return;
+
+    for (AsyncFrame& f : m_asyncFrames) {
+        vkDestroySemaphore(m_device, f.acquired, nullptr);
+        vkDestroySemaphore(m_device, f.written, nullptr); }
+    vkDestroySemaphore(m_device, m_asyncTimeline, nullptr);
+    vkDestroySemaphore(m_device, m_asyncDone, nullptr);
+    vkDestroyCommandPool(m_device, m_computeCmdPool, nullptr);
+    vkDestroyQueryPool(m_device, m_asyncQueryPool, nullptr);
+
+    m_asyncColorBuffer.destroy(m_device);
+    m_asyncKdBuffer.destroy(m_device);
+    m_asyncNdBuffer.destroy(m_device);
+    m_asyncVarBuffer.destroy(m_device);
+    m_asyncPingBuffer.destroy(m_device);
+    m_asyncPongBuffer.destroy(m_device);
+    m_asyncDenoiseDesc.destroy(m_device);
+    for (DescriptorWrap& desc : m_asyncPostDescs)
+        desc.destroy(m_device);
+}
+
+// A barrier on a whole single-mip color image, possibly handing it
+// from one queue family to another
+static VkImageMemoryBarrier imageBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+                                         VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                                         uint32_t srcFamily = VK_QUEUE_FAMILY_IGNORED,
+                                         uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED)
+{
+    VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    barrier.srcAccessMask       = srcAccess;
+    barrier.dstAccessMask       = dstAccess;
+    barrier.oldLayout           = oldLayout;
+    barrier.newLayout           = newLayout;
+    barrier.srcQueueFamilyIndex = srcFamily;
+    barrier.dstQueueFamilyIndex = dstFamily;
+    barrier.image               = image;
+    barrier.subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    return barrier;
+}
+
+// Submit a batch of one command buffer, with binary and timeline
+// semaphores mixed (the binary ones' values are ignored)
+static void submitAsync(VkQueue queue, VkCommandBuffer cmd,
+                        const std::vector<VkSemaphore>& waits, const std::vector<uint64_t>& waitValues,
+                        const std::vector<VkPipelineStageFlags>& waitStages,
+                        const std::vector<VkSemaphore>& signals, const std::vector<uint64_t>& signalValues)
+{
+    VkTimelineSemaphoreSubmitInfo timelineInfo{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.waitSemaphoreValueCount   = uint32_t(waitValues.size());
+    timelineInfo.pWaitSemaphoreValues      = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = uint32_t(signalValues.size());
+    timelineInfo.pSignalSemaphoreValues    = signalValues.data();
+
+    VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.pNext                = &timelineInfo;
+    submitInfo.waitSemaphoreCount   = uint32_t(waits.size());
+    submitInfo.pWaitSemaphores      = waits.data();
+    submitInfo.pWaitDstStageMask    = waitStages.data();
+    submitInfo.commandBufferCount   = 1;
+    submitInfo.pCommandBuffers      = &cmd;
+    submitInfo.signalSemaphoreCount = uint32_t(signals.size());
+    submitInfo.pSignalSemaphores    = signals.data();
+    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        throw std::runtime_error("failed to submit async command buffer!");
+}
+
+// Submit the last frame's GUI, and present it
+void VkApp::finishAsyncFrames()
+{
+    if (!m_asyncPending)
+        return;
+    AsyncFrame& f = m_asyncFrames[(m_asyncFrame + ASYNC_FRAMES - 1) % ASYNC_FRAMES];
+
+    submitAsync(m_queue, f.gui,
+                {m_asyncTimeline}, {2*f.frame + 2}, {VK_PIPELINE_STAGE_ALL_COMMANDS_BIT},
+                {m_asyncDone, f.written}, {f.frame + 1, 0});
+
+    VkPresentInfoKHR presentInfo{VK_STRUCTURE_TYPE_PRESENT_INFO_KHR};
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores    = &f.written;
+    presentInfo.swapchainCount     = 1;
+    presentInfo.pSwapchains        = &m_swapchain;
+    presentInfo.pImageIndices      = &f.swapchainIndex;
+    // Out of date is left to the next acquire to notice
+    VkResult result = vkQueuePresentKHR(m_queue, &presentInfo);
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR)
+        throw std::runtime_error("failed to present swap chain image!");
+
+    m_asyncPending = false;
+}
+
+bool VkApp::drawFrameAsync()
+{
+    VkCommandBuffer syncCommandBuffer = m_commandBuffer;  // Restored at the end
+    int slot = int(m_asyncFrame % ASYNC_FRAMES);
+    AsyncFrame& f = m_asyncFrames[slot];
+
+    // Wait for the slot's last frame to be done: its command buffers
+    // and semaphores are free again
+    if (m_asyncFrame >= ASYNC_FRAMES) {
+        uint64_t value = f.frame + 1;
+        VkSemaphoreWaitInfo waitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores    = &m_asyncDone;
+        waitInfo.pValues        = &value;
+        vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX);
+        readAsyncTimestamps(f); }
+
+    // (Frame N-1's image is still held, for its gui: the swapchain's one
+    // image over minImageCount allows that.)  Suboptimal still presents.
+    VkResult result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, f.acquired,
+                                            VK_NULL_HANDLE, &f.swapchainIndex);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+        return false;
+
+    f.frame = m_asyncFrame;
+    f.timed = false;
+    uint64_t traced = 2*f.frame + 1, filtered = 2*f.frame + 2;
+    uint64_t lastFiltered = f.frame > 0 ? 2*(f.frame - 1) + 2 : 0;
+    m_asyncActive = true;
+
+    VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    // Trace: just as drawFrame
+    m_commandBuffer = f.trace;
+    vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+    {
+        // After the last handoff's copies out of the images it rewrites.
+        // (The one queue frame had its fence; this waits only on work
+        // on the graphics queue, not on the filter.)
+        VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+    if (m_asyncQueryPool) {
+        vkCmdResetQueryPool(m_commandBuffer, m_asyncQueryPool, 4*slot, 4);
+        vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_asyncQueryPool, 4*slot); }
+    acquireUploads(m_commandBuffer);
+    streamTextures(m_commandBuffer);
+    m_graph.newFrame();
+    updateCameraBuffer();
+    raytrace();
+    if (m_asyncQueryPool)
+        vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_asyncQueryPool, 4*slot + 1);
+    vkEndCommandBuffer(m_commandBuffer);
+
+    // Handoff: the filter's inputs, copied and released to the compute
+    // family.  Their old contents (last frame's, left with the compute
+    // family) are discarded, so there's nothing to acquire back.
+    ImageWrap* sources[] = {&m_rtColCurrBuffer, &m_rtKdCurrBuffer, &m_rtNdCurrBuffer, &m_rtLumMomCurrBuffer};
+    ImageWrap* inputs[]  = {&m_asyncColorBuffer, &m_asyncKdBuffer, &m_asyncNdBuffer, &m_asyncVarBuffer};
+    m_commandBuffer = f.handoff;
+    vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+    {
+        std::vector<VkImageMemoryBarrier> barriers;
+        for (ImageWrap* input : inputs)
+            barriers.push_back(imageBarrier(input->image, VK_IMAGE_LAYOUT_UNDEFINED,
+                                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                            0, VK_ACCESS_TRANSFER_WRITE_BIT));
+        // The sources, last written by the trace's passes and copies
+        VkMemoryBarrier written{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        written.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        written.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 1, &written, 0, nullptr, uint32_t(barriers.size()), barriers.data());
+
+        VkImageCopy region{};
+        region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.extent = {windowSize.width, windowSize.height, 1};
+        for (int i = 0; i < 4; i++)
+            vkCmdCopyImage(m_commandBuffer, sources[i]->image, VK_IMAGE_LAYOUT_GENERAL,
+                           inputs[i]->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        barriers.clear();
+        for (ImageWrap* input : inputs)
+            barriers.push_back(imageBarrier(input->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                            VK_IMAGE_LAYOUT_GENERAL, VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+                                            m_graphicsQueueIndex, m_computeQueueIndex));
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0, 0, nullptr, 0, nullptr, uint32_t(barriers.size()), barriers.data());
+    }
+    vkEndCommandBuffer(m_commandBuffer);
+
+    if (m_uploadTimeline)  // The uploads acquired: their batches' copies
+        submitAsync(m_queue, f.trace, {m_uploadTimeline}, {m_uploadWait},
+                    {VK_PIPELINE_STAGE_ALL_COMMANDS_BIT}, {}, {});
+    else
+        submitAsync(m_queue, f.trace, {}, {}, {}, {}, {});
+    submitAsync(m_queue, f.handoff,
+                {m_asyncTimeline}, {lastFiltered}, {VK_PIPELINE_STAGE_TRANSFER_BIT},
+                {m_asyncTimeline}, {traced});
+
+    // Last frame's GUI and present, now that the graphics queue has this
+    // frame's trace to work on
+    finishAsyncFrames();
+
+    m_swapchainIndex = f.swapchainIndex;
+    VkImage swapchainImage = m_swapchainImages[f.swapchainIndex];
+
+#ifdef GUI
+    VkImageLayout presentLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;  // The GUI's render pass loads it
+#else
+    VkImageLayout presentLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+#endif
+
+    // Filter, on the compute queue
+    m_commandBuffer = f.filter;
+    vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+    {
+        if (m_asyncQueryPool)
+            vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_asyncQueryPool, 4*slot + 2);
+
+        // Acquire the inputs; discard the ping-pong images' and the
+        // swapchain image's old contents
+        std::vector<VkImageMemoryBarrier> barriers;
+        for (ImageWrap* input : inputs)
+            barriers.push_back(imageBarrier(input->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                            VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_READ_BIT,
+                                            m_graphicsQueueIndex, m_computeQueueIndex));
+        barriers.push_back(imageBarrier(m_asyncPingBuffer.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                        0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT));
+        barriers.push_back(imageBarrier(m_asyncPongBuffer.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                        0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT));
+        barriers.push_back(imageBarrier(swapchainImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                        0, VK_ACCESS_SHADER_WRITE_BIT));
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 0, nullptr, 0, nullptr, uint32_t(barriers.size()), barriers.data());
+
+        // Denoise, always on the fused schedule: it reads its input in
+        // place, where the per-iteration schedule wants it copied
+        bool denoised = useDenoise && m_num_atrous_iterations > 0;
+        if (denoised) {
+            m_pcDenoise.normFactor = f_normFactor;
+            m_pcDenoise.depthFactor = f_depthFactor;
+            m_pcDenoise.lumenFactor = f_lumenFactor;
+            m_pcDenoise.demodulate = useDemodulate;
+            m_pcDenoise.varianceGuided = useVarianceGuided;
+            recordDenoise(m_commandBuffer, m_asyncDenoiseDesc.descSet, windowSize,
+                          m_asyncPingBuffer, m_asyncPongBuffer, eDenoiseFused, 0); }
+
+        // Post, into the swapchain image
+        m_pcPost.src = denoised ? POST_SOURCE_SC : POST_SOURCE_COLCURR;
+        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_postComputePipeline);
+        vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_postPipelineLayout,
+                                0, 1, &m_asyncPostDescs[f.swapchainIndex].descSet, 0, nullptr);
+        vkCmdPushConstants(m_commandBuffer, m_postPipelineLayout,
+                           VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(PushConstantPost), &m_pcPost);
+        vkCmdDispatch(m_commandBuffer, (windowSize.width + POST_TILE - 1)/POST_TILE,
+                      (windowSize.height + POST_TILE - 1)/POST_TILE, 1);
+
+        // Release the swapchain image to the graphics family
+        VkImageMemoryBarrier release = imageBarrier(swapchainImage, VK_IMAGE_LAYOUT_GENERAL, presentLayout,
+                                                    VK_ACCESS_SHADER_WRITE_BIT, 0,
+                                                    m_computeQueueIndex, m_graphicsQueueIndex);
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &release);
+
+        if (m_asyncQueryPool)
+            vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_asyncQueryPool, 4*slot + 3);
+    }
+    vkEndCommandBuffer(m_commandBuffer);
+
+    submitAsync(m_computeQueue, f.filter,
+                {m_asyncTimeline, f.acquired}, {traced, 0},
+                {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT},
+                {m_asyncTimeline}, {filtered});
+
+    // GUI: acquire the swapchain image back, and draw over it.  Recorded
+    // now, submitted with the next frame (or by finishAsyncFrames).
+    m_commandBuffer = f.gui;
+    vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+    {
+        VkImageMemoryBarrier acquire = imageBarrier(swapchainImage, VK_IMAGE_LAYOUT_GENERAL, presentLayout, 0,
+#ifdef GUI
+                                                    VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+#else
+                                                    0,
+#endif
+                                                    m_computeQueueIndex, m_graphicsQueueIndex);
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &acquire);
+        recordGUI();
+    }
+    vkEndCommandBuffer(m_commandBuffer);
+    m_asyncPending = true;
+
+    m_asyncFrame++;
+    m_asyncActive = false;
+    m_commandBuffer = syncCommandBuffer;
+    return true;
+}
+
+// The GPU times of a finished frame: its trace, its filter, and how
+// much of its trace the previous frame's filter overlapped
+void VkApp::readAsyncTimestamps(AsyncFrame& f)
+{
+    if (!m_asyncQueryPool || f.timed)
+        return;
+    f.timed = true;
+
+    int slot = int(&f - m_asyncFrames);
+    uint64_t stamps[4];
+    if (vkGetQueryPoolResults(m_device, m_asyncQueryPool, 4*slot, 4, sizeof(stamps), stamps,
+                              sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+        return;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    double period = properties.limits.timestampPeriod;  // ns per tick
+    double trace[2]  = {stamps[0]*period, stamps[1]*period};
+    double filter[2] = {stamps[2]*period, stamps[3]*period};
+
+    double overlap = std::max(0.0, std::min(trace[1], m_asyncPrevFilter[1])
+                                   - std::max(trace[0], m_asyncPrevFilter[0]));
+    m_asyncTraceMs   += (trace[1] - trace[0])*1e-6;
+    m_asyncFilterMs  += (filter[1] - filter[0])*1e-6;
+    m_asyncOverlapMs += overlap*1e-6;
+    m_asyncPrevFilter[0] = filter[0];
+    m_asyncPrevFilter[1] = filter[1];
+
+    if (++m_asyncTimed == ASYNC_REPORT_FRAMES) {
+        double n = m_asyncTimed;
+        printf("Async compute, %d frames: trace %.3f ms, denoise+post %.3f ms, overlapped %.3f ms (%.0f%%)\n",
+               m_asyncTimed, m_asyncTraceMs/n, m_asyncFilterMs/n, m_asyncOverlapMs/n,
+               m_asyncFilterMs > 0 ? 100.0*m_asyncOverlapMs/m_asyncFilterMs : 0.0);
+        m_asyncTraceMs = m_asyncFilterMs = m_asyncOverlapMs = 0;
+        m_asyncTimed = 0; }
+}
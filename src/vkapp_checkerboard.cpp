@@ -0,0 +1,80 @@
+// Checkerboard rendering: trace half the pixels each frame.
+//
+//   trace:        the megakernel or ray query backend, launched at half
+//                 width; checkerPixel (rt_common.glsl) spreads the
+//                 launch over the pixels of one parity, flipping the
+//                 pattern every frame.
+//   reconstruct:  checkerboard.comp estimates the other half's motion
+//                 vectors and G-buffer from their traced neighbours;
+//                 temporal.comp then carries their history along, and
+//                 falls back to the neighbours' average where the
+//                 history is disoccluded.
+//
+// About half the rays per frame.  A static view converges at half the
+// rate, and a moving one loses a little detail at disocclusions.  Not
+// available with adaptive sampling (which picks its own pixels) or the
+// wavefront backend.
+
+#include <vector>
+
+#include "vkapp.h"
+
+#include "shaders/shared_structs.h"
+
+// The reconstruction sees the ray tracer's descriptor sets and push
+// constants, as the ray query backend does.
+void VkApp::createCheckerboardPipeline()
+{
+    VkPushConstantRange pushConstant{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantRay)};
+
+    std::vector<VkDescriptorSetLayout> descSetLayouts =
+        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
+        {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges    = &pushConstant;
+    pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descSetLayouts.size());
+    pipelineLayoutCreateInfo.pSetLayouts    = descSetLayouts.data();
+    vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_checkerPipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_checkerPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/checkerboard.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr,
+                             &m_checkerPipeline);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+void VkApp::destroyCheckerboard()
+{
+    vkDestroyPipeline(m_device, m_checkerPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_checkerPipelineLayout, nullptr);
+}
+
+// Fill in the pixels the trace skipped this frame
+void VkApp::reconstructCheckerboard()
+{
+    // The traced pixels' colCurr, NdCurr and KdCurr are read next
+    VkPipelineStageFlags traceStage = rtBackend == eRayQuery
+        ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, traceStage, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_checkerPipeline);
+    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_checkerPipelineLayout, 0, (uint32_t)descSets.size(),
+                            descSets.data(), 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_checkerPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantRay), &m_pcRay);
+
+    // This MUST match the shader's local_size of 8x8, over half the width
+    vkCmdDispatch(m_commandBuffer, ((windowSize.width+1)/2+7)/8, (windowSize.height+7)/8, 1);
+
+    // temporalAccumulate follows, with its own barrier
+}
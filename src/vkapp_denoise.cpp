@@ -1,3 +1,20 @@
+// The A-Trous denoiser, and how its iterations are scheduled.
+//
+//   per iteration:  the original schedule: a dispatch per iteration
+//                   from m_scImageBuffer to m_denoiseBuffer, copied
+//                   back for the next.
+//   fused:          denoise_fused.comp does steps 1 and 2 in one
+//                   dispatch through shared memory, reading the
+//                   temporal pass's output directly; the larger steps
+//                   ping-pong between m_denoiseBuffer and
+//                   m_scImageBuffer, in the order that leaves the last
+//                   in m_scImageBuffer for post.  No copies.
+//
+// Either schedule's denoiseX dispatches run in half precision
+// (denoiseX_fp16) where the device has it and useFp16Denoise is set.
+//
+// benchmarkDenoise times both, at 1080p and 4K.
+
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -15,30 +32,27 @@ using namespace glm;
 #include "app.h"
 #include "shaders/shared_structs.h"
 
-#define GROUP_SIZE 128
-
 
-void VkApp::createDenoiseBuffer()
+// The bindings, shared by the frame's set and the benchmark's
+static std::vector<VkDescriptorSetLayoutBinding> denoiseBindings()
 {
-    m_denoiseBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_denoiseBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_GENERAL, 1);
+    return {
+        {DenoiseBindings::eImages, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3, VK_SHADER_STAGE_COMPUTE_BIT},
+        {DenoiseBindings::eInCurrKd, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+        {DenoiseBindings::eInCurrNd, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+        {DenoiseBindings::eInVariance, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}};
 }
 
 void VkApp::createDenoiseDescriptorSet()
 {
-    m_denoiseDesc.setBindings(m_device, {
-            {DenoiseBindings::eInImage, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
-            {DenoiseBindings::eOutDenoiseImage, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
-            {DenoiseBindings::eInCurrKd, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT},
-            {DenoiseBindings::eInCurrNd, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
-        });
-
-    m_denoiseDesc.write(m_device, DenoiseBindings::eInImage, m_scImageBuffer.Descriptor());   // The input image
-    m_denoiseDesc.write(m_device, DenoiseBindings::eOutDenoiseImage, m_denoiseBuffer.Descriptor());   // The output image
+    m_denoiseDesc.setBindings(m_device, denoiseBindings());
+
+    // The input, and the ping-pong pair, in DENOISE_IMAGE_* order
+    m_denoiseDesc.write(m_device, DenoiseBindings::eImages,
+                        std::vector<ImageWrap>{m_rtColCurrBuffer, m_denoiseBuffer, m_scImageBuffer});
     m_denoiseDesc.write(m_device, DenoiseBindings::eInCurrNd, m_rtNdCurrBuffer.Descriptor());  // The normal:depth buffer
     m_denoiseDesc.write(m_device, DenoiseBindings::eInCurrKd, m_rtKdCurrBuffer.Descriptor());  // The color buffer
+    m_denoiseDesc.write(m_device, DenoiseBindings::eInVariance, m_rtLumMomCurrBuffer.Descriptor());  // The temporal variance
 
 }
 
@@ -58,82 +72,201 @@ void VkApp::createDenoiseCompPipeline()
 
     cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/denoiseX.comp.spv"),
                                                VK_SHADER_STAGE_COMPUTE_BIT);
-    vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_denoisePipelineX);
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &m_denoisePipelineX);
     vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
 
+    // The same, in half precision (denoiseX.comp built with DENOISE_FP16)
+    if (m_hasFloat16) {
+        cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/denoiseX_fp16.comp.spv"),
+                                                   VK_SHADER_STAGE_COMPUTE_BIT);
+        vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr,
+                                 &m_denoisePipelineX16);
+        vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr); }
+    else
+        useFp16Denoise = false;
+
     // Note: The original plan was to split the denoising shader into
-    // horizontal and vertical sub steps. Hence the need for two
-    // pipelines, each with its own shader (1 horizontal, one
-    // vertical.  Choosing to do all the work in a single shader means
-    // the first shader denoiseX is now oddly named, and the second
-    // shader denoiseY in unnecessary.
-    
-    //cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/denoiseY.comp.spv"),
-    //                                           VK_SHADER_STAGE_COMPUTE_BIT);
-    //vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, &m_denoisePipelineY);
-    //vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
-
-    // @@ destroy m_denoisePipelineX, and m_denoisePipelineY,
+    // horizontal and vertical sub steps.  Choosing to do all the work
+    // in a single shader means denoiseX is now oddly named.  The
+    // second pipeline runs the first two iterations at once.
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/denoise_fused.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr,
+                             &m_denoisePipelineFused);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
 }
 
 void VkApp::denoise()
 {
-
-    // Wait for RT to finish
-    VkImageSubresourceRange range{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-    VkImageMemoryBarrier    imgMemBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-    imgMemBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-    imgMemBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    imgMemBarrier.image = m_scImageBuffer.image;
-    imgMemBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-    imgMemBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-    imgMemBarrier.subresourceRange = range;
-
-    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        VK_DEPENDENCY_DEVICE_GROUP_BIT, 0, nullptr, 0, nullptr, 1, &imgMemBarrier);
-
     m_pcDenoise.normFactor = f_normFactor;
     m_pcDenoise.depthFactor = f_depthFactor;
     m_pcDenoise.lumenFactor = f_lumenFactor;
     m_pcDenoise.demodulate = useDemodulate;
+    m_pcDenoise.varianceGuided = useVarianceGuided;
 
-    int stepwidth = 1;
-    for (int a = 0; a < m_num_atrous_iterations; a++)
-    {
+    if (m_num_atrous_iterations < 1)
+        return;  // Post shows colCurr
+    m_graph.begin(m_commandBuffer, m_rgDenoise);
 
+    // The per-iteration schedule works in place on sc, so it gets a
+    // copy.  The fused one reads colCurr directly.
+    if (denoiseSchedule == eDenoisePerIteration)
+        CmdCopyImage(m_commandBuffer, m_rtColCurrBuffer, m_scImageBuffer, windowSize,
+                     0, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+    recordDenoise(m_commandBuffer, m_denoiseDesc.descSet, windowSize,
+                  m_denoiseBuffer, m_scImageBuffer, denoiseSchedule);
+}
+
+// Record m_num_atrous_iterations iterations on the images of descSet,
+// of the given size, leaving the result in its DENOISE_IMAGE_PONG.
+// ping and pong are the images bound there, for the copies of the
+// per-iteration schedule.  readers are the stages that read the
+// result, besides compute.  (None, in a frame: the render graph's
+// barrier before post covers post.frag.)  The inputs must be ready:
+// the graph's denoise pass, or the caller's own barrier.
+void VkApp::recordDenoise(VkCommandBuffer cmd, VkDescriptorSet descSet, VkExtent2D size,
+                          ImageWrap& ping, ImageWrap& pong, int schedule,
+                          VkPipelineStageFlags readers)
+{
+    readers |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    // The dispatches: their step widths, and whether fused with the next
+    struct Pass { int stepwidth; bool fused; };
+    std::vector<Pass> passes;
+    for (int a = 0; a < m_num_atrous_iterations; a++) {
+        if (schedule == eDenoiseFused && a == 0 && m_num_atrous_iterations >= 2) {
+            passes.push_back({1, true});
+            a++; }
+        else
+            passes.push_back({1 << a, false}); }
+
+    VkPipeline iteration = useFp16Denoise && m_denoisePipelineX16 ? m_denoisePipelineX16 : m_denoisePipelineX;
+
+    VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+        m_denoiseCompPipelineLayout, 0, 1, &descSet, 0, nullptr);
+
+    int src = schedule == eDenoiseFused ? DENOISE_IMAGE_INPUT : DENOISE_IMAGE_PONG;
+    for (size_t k = 0; k < passes.size(); k++)
+    {
         // Tell the A-Trous algorithm its "hole" size
-        m_pcDenoise.stepwidth = stepwidth;
-        stepwidth *= 2;
-
-        // Select the compute shader, and its descriptor set and push constant
-        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_denoisePipelineX);
-        vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-            m_denoiseCompPipelineLayout, 0, 1,
-            &m_denoiseDesc.descSet, 0, nullptr);
-        vkCmdPushConstants(m_commandBuffer, m_denoiseCompPipelineLayout,
+        int s = passes[k].stepwidth;
+        m_pcDenoise.stepwidth = s;
+        m_pcDenoise.src = src;
+        if (schedule == eDenoiseFused)
+            m_pcDenoise.dst = (passes.size() - 1 - k) % 2 == 0 ? DENOISE_IMAGE_PONG : DENOISE_IMAGE_PING;
+        else
+            m_pcDenoise.dst = DENOISE_IMAGE_PING;
+
+        // Select the compute shader, and its push constant
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+            passes[k].fused ? m_denoisePipelineFused : iteration);
+        vkCmdPushConstants(cmd, m_denoiseCompPipelineLayout,
             VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantDenoise),
             &m_pcDenoise);
 
-        // Dispatch the shader in batches of 128x1 (WHY???)
-        // This MUST match the shaders's line:
-        //    layout(local_size_x=GROUP_SIZE, local_size_y=1, local_size_z=1) in;
-        vkCmdDispatch(m_commandBuffer,
-            (windowSize.width + GROUP_SIZE - 1) / GROUP_SIZE,
-            windowSize.height, 1);
-
-        // Wait until denoise shader is done writing to m_denoiseBuffer
-        imgMemBarrier.image = m_denoiseBuffer.image;
-        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            VK_DEPENDENCY_DEVICE_GROUP_BIT,
-            0, nullptr, 0, nullptr, 1, &imgMemBarrier);
-
-        // @@ Copy the denoised results (in m_denoiseBuffer) back to
-        // the input buffer (m_scImageBuffer) for the next denoising
-        // loop pass.  See VkApp::raytrace for 4 examples of using
-        // VkApp::CmdCopyImage to copy an image.
-        CmdCopyImage(m_denoiseBuffer, m_scImageBuffer);
+        if (passes[k].fused)
+            // A dense DENOISE_TILE^2 tile per workgroup
+            vkCmdDispatch(cmd,
+                (size.width  + DENOISE_TILE - 1) / DENOISE_TILE,
+                (size.height + DENOISE_TILE - 1) / DENOISE_TILE, 1);
+        else {
+            // A tile of DENOISE_TILE^2 pixels, s apart, per
+            // workgroup: s*s tiles per block of DENOISE_TILE*s pixels
+            // square.  At large step widths the blocks overhang the
+            // image, and some tiles are mostly empty.
+            uint32_t blockSize = DENOISE_TILE * s;
+            vkCmdDispatch(cmd,
+                (size.width  + blockSize - 1) / blockSize * s,
+                (size.height + blockSize - 1) / blockSize * s, 1); }
 
+        if (schedule == eDenoisePerIteration) {
+            // Copy the denoised results back to the input for the next
+            CmdCopyImage(cmd, ping, pong, size, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, readers); }
+        else {
+            // The next pass (or post.frag) reads this one's output
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, readers,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+            src = m_pcDenoise.dst; }
     }
 }
+
+// Time both schedules with the current settings, at 1080p and 4K, on
+// images of their own.  The timings don't depend much on the images'
+// content, so they're cleared to a plain gray surface.
+void VkApp::benchmarkDenoise()
+{
+    const VkExtent2D sizes[] = {{1920, 1080}, {3840, 2160}};
+    const int schedules[] = {eDenoisePerIteration, eDenoiseFused};
+    const char* names[] = {"per iteration", "fused"};
+    const int repeats = 20;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+    VkQueryPoolCreateInfo queryInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    queryInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    queryInfo.queryCount = 4;  // Before and after each schedule
+    VkQueryPool queryPool;
+    if (vkCreateQueryPool(m_device, &queryInfo, nullptr, &queryPool) != VK_SUCCESS)
+        throw std::runtime_error("failed to create query pool!");
+
+    m_pcDenoise.normFactor = f_normFactor;
+    m_pcDenoise.depthFactor = f_depthFactor;
+    m_pcDenoise.lumenFactor = f_lumenFactor;
+    m_pcDenoise.demodulate = useDemodulate;
+    m_pcDenoise.varianceGuided = useVarianceGuided;
+
+    printf("Denoise benchmark, %d iterations, %d repeats:\n", m_num_atrous_iterations, repeats);
+    for (VkExtent2D size : sizes) {
+        std::vector<ImageWrap> images;  // DENOISE_IMAGE_*, Kd, Nd, variance
+        for (int i = 0; i < 6; i++)
+            images.push_back(createBufferImage(size));
+
+        DescriptorWrap desc{};
+        desc.setBindings(m_device, denoiseBindings());
+        desc.write(m_device, DenoiseBindings::eImages,
+                   std::vector<ImageWrap>{images[0], images[1], images[2]});
+        desc.write(m_device, DenoiseBindings::eInCurrKd, images[3].Descriptor());
+        desc.write(m_device, DenoiseBindings::eInCurrNd, images[4].Descriptor());
+        desc.write(m_device, DenoiseBindings::eInVariance, images[5].Descriptor());
+
+        VkCommandBuffer cmd = createTempCmdBuffer();
+        const VkClearColorValue clears[] = {
+            {{0.5f, 0.5f, 0.5f, 0.0f}}, {{0.5f, 0.5f, 0.5f, 0.0f}}, {{0.5f, 0.5f, 0.5f, 0.0f}},
+            {{0.5f, 0.5f, 0.5f, 0.0f}}, {{0.0f, 0.0f, 1.0f, 1.0f}}, {{0.0f, 0.0f, 0.01f, 0.0f}}};  // Nd: +z, depth 1, encoded
+        VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        for (int i = 0; i < 6; i++) {
+            imageLayoutBarrier(cmd, images[i].image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+            vkCmdClearColorImage(cmd, images[i].image, VK_IMAGE_LAYOUT_GENERAL, &clears[i], 1, &range); }
+        VkMemoryBarrier cleared{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        cleared.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        cleared.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &cleared, 0, nullptr, 0, nullptr);
+        vkCmdResetQueryPool(cmd, queryPool, 0, 4);
+
+        for (int j = 0; j < 2; j++) {
+            recordDenoise(cmd, desc.descSet, size, images[1], images[2], schedules[j]);  // Warm up
+            vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2*j);
+            for (int r = 0; r < repeats; r++)
+                recordDenoise(cmd, desc.descSet, size, images[1], images[2], schedules[j]);
+            vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2*j+1); }
+        submitTempCmdBuffer(cmd);
+
+        uint64_t stamps[4];
+        vkGetQueryPoolResults(m_device, queryPool, 0, 4, sizeof(stamps), stamps, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        for (int j = 0; j < 2; j++) {
+            double ms = (stamps[2*j+1] - stamps[2*j]) * properties.limits.timestampPeriod * 1e-6 / repeats;
+            printf("  %ux%u %-14s %8.3f ms\n", size.width, size.height, names[j], ms); }
+
+        desc.destroy(m_device);
+        for (ImageWrap& image : images)
+            image.destroy(m_device);
+    }
+
+    vkDestroyQueryPool(m_device, queryPool, nullptr);
+}
@@ -0,0 +1,186 @@
+// The CPU denoiser (cpu_denoise.cpp) against the GPU's.
+//
+//   compareCpuDenoise:  reads back the temporal pass's output and the
+//                       denoiser's other inputs, denoises them on the
+//                       GPU (the current schedule) and on the CPU with
+//                       the same settings, and prints how far apart the
+//                       two are; then times the CPU denoiser on 1, 2,
+//                       4, ... threads, in Mpix/s.  False if any pixel's
+//                       color differs by more than the tolerance.
+//
+// The GPU's result is read from m_scImageBuffer: both schedules leave
+// the last iteration there (DENOISE_IMAGE_PONG), m_denoiseBuffer only
+// holds the one before.
+
+#include <iostream>
+#include <cstring>              // for memcpy
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <math.h>
+
+#include "vkapp.h"
+#include "cpu_denoise.h"
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+
+// An image of windowSize, read back to the host as rgba32f, row after
+// row.  One of another format (a packed target) is converted first.
+std::vector<float> VkApp::readbackImage(ImageWrap& image, VkFormat format)
+{
+    if (format != VK_FORMAT_R32G32B32A32_SFLOAT) {
+        ImageWrap converted = createBufferImage(windowSize);
+        VkCommandBuffer cmd = createTempCmdBuffer();
+        imageLayoutBarrier(cmd, converted.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        CmdCopyImages(cmd, {{&image, &converted}}, windowSize, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                      VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, true);
+        submitTempCmdBuffer(cmd);
+        std::vector<float> pixels = readbackImage(converted);
+        converted.destroy(m_device);
+        return pixels; }
+
+    VkDeviceSize size = VkDeviceSize(windowSize.width)*windowSize.height*4*sizeof(float);
+    BufferWrap staging = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                          | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    VkCommandBuffer cmd = createTempCmdBuffer();
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {windowSize.width, windowSize.height, 1};
+    imageLayoutBarrier(cmd, image.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    vkCmdCopyImageToBuffer(cmd, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           staging.buffer, 1, &region);
+    imageLayoutBarrier(cmd, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+    submitTempCmdBuffer(cmd);
+
+    std::vector<float> pixels(size/sizeof(float));
+    void* data;
+    vkMapMemory(m_device, staging.memory, 0, size, 0, &data);
+    memcpy(pixels.data(), data, size);
+    vkUnmapMemory(m_device, staging.memory);
+
+    staging.destroy(m_device);
+    return pixels;
+}
+
+// The normal:depth target's (octahedral normal, depth, valid), as
+// nd_packing.glsl's decodeNd, into the (normal, depth) cpuDenoise reads
+static void decodeNd(std::vector<float>& nd)
+{
+    for (size_t p = 0; p < nd.size(); p += 4) {
+        float x = nd[p], y = nd[p+1], z = 1.0f - fabsf(x) - fabsf(y);
+        if (z < 0.0f) {
+            float wx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float wy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = wx;  y = wy; }
+        float length = sqrtf(x*x + y*y + z*z);
+        bool valid = nd[p+3] != 0.0f;
+        float depth = nd[p+2];
+        nd[p]   = valid ? x/length : 0.0f;
+        nd[p+1] = valid ? y/length : 0.0f;
+        nd[p+2] = valid ? z/length : 0.0f;
+        nd[p+3] = depth; }
+}
+
+bool VkApp::compareCpuDenoise()
+{
+    if (m_num_atrous_iterations < 1) {
+        printf("CPU denoise: no A-Trous iterations to compare\n");
+        return true; }
+
+    // The last frame's images, finished.  (Not vkDeviceWaitIdle: the
+    // upload thread submits to its own queue.)
+    vkQueueWaitIdle(m_queue);
+    if (m_computeQueue)
+        vkQueueWaitIdle(m_computeQueue);
+
+    m_pcDenoise.normFactor = f_normFactor;
+    m_pcDenoise.depthFactor = f_depthFactor;
+    m_pcDenoise.lumenFactor = f_lumenFactor;
+    m_pcDenoise.demodulate = useDemodulate;
+    m_pcDenoise.varianceGuided = useVarianceGuided;
+
+    // Denoise the last frame again on the GPU, from the temporal
+    // pass's output, as raytrace() and denoise() would.  (post may have
+    // left m_scImageBuffer undenoised.)  In float: the CPU's isn't
+    // half precision.
+    bool fp16 = useFp16Denoise;
+    useFp16Denoise = false;
+    VkCommandBuffer cmd = createTempCmdBuffer();
+    m_graph.newFrame();  // sc and the denoise image are the render graph's
+    m_graph.begin(cmd, m_rgDenoise);
+    CmdCopyImage(cmd, m_rtColCurrBuffer, m_scImageBuffer, windowSize,
+                 0, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+    recordDenoise(cmd, m_denoiseDesc.descSet, windowSize,
+                  m_denoiseBuffer, m_scImageBuffer, denoiseSchedule);
+    submitTempCmdBuffer(cmd);
+    useFp16Denoise = fp16;
+
+    std::vector<float> color   = readbackImage(m_rtColCurrBuffer);
+    std::vector<float> kd      = readbackImage(m_rtKdCurrBuffer, m_kdFormat);
+    std::vector<float> nd      = readbackImage(m_rtNdCurrBuffer, m_ndFormat);
+    decodeNd(nd);
+    std::vector<float> moments = readbackImage(m_rtLumMomCurrBuffer);
+    std::vector<float> gpu     = readbackImage(m_scImageBuffer);
+
+    CpuDenoiseParams params;
+    params.normFactor = f_normFactor;
+    params.depthFactor = f_depthFactor;
+    params.lumenFactor = f_lumenFactor;
+    params.demodulate = useDemodulate;
+    params.varianceGuided = useVarianceGuided;
+    params.iterations = m_num_atrous_iterations;
+
+    int width = int(windowSize.width), height = int(windowSize.height);
+    std::vector<float> cpu(color.size());
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    {
+        ThreadPool pool(cores);
+        cpuDenoise(width, height, color.data(), kd.data(), nd.data(), moments.data(),
+                   params, cpu.data(), pool);
+    }
+
+    // The difference, relative to the GPU's value (the radiance isn't
+    // bounded), in color and in the filtered variance
+    const float tolerance = 1e-3f;
+    double maxColor = 0.0, sumColor = 0.0, maxVar = 0.0;
+    size_t over = 0, pixels = size_t(width)*height;
+    for (size_t p = 0; p < pixels; p++) {
+        double worst = 0.0;
+        for (int c = 0; c < 3; c++) {
+            double d = fabs(cpu[4*p + c] - gpu[4*p + c]) / std::max(1e-3, fabs(gpu[4*p + c]));
+            worst = std::max(worst, d);
+            sumColor += d; }
+        maxColor = std::max(maxColor, worst);
+        maxVar = std::max(maxVar, fabs(cpu[4*p + 3] - gpu[4*p + 3]) / std::max(1e-6, fabs(gpu[4*p + 3])));
+        if (worst > tolerance) over++; }
+
+    printf("CPU denoise vs GPU (%s), %dx%d, %d iterations:\n",
+           denoiseSchedule == eDenoiseFused ? "fused" : "per iteration",
+           width, height, m_num_atrous_iterations);
+    printf("  color: max %.3g, mean %.3g relative; %zu pixels over %g\n",
+           maxColor, sumColor/(3*pixels), over, tolerance);
+    printf("  variance: max %.3g relative\n", maxVar);
+    bool agree = maxColor <= tolerance;
+    if (!agree)
+        printf("  FAILED: the CPU and GPU denoisers disagree\n");
+
+    // Mpix/s by thread count, best of a few runs
+    printf("CPU denoise benchmark (%s), %u cores:\n", cpuDenoiseIsa(), cores);
+    for (unsigned threads = 1; ; threads = std::min(2*threads, cores)) {
+        ThreadPool pool(threads);
+        double best = 1e30;
+        for (int r = 0; r < 3; r++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            cpuDenoise(width, height, color.data(), kd.data(), nd.data(), moments.data(),
+                       params, cpu.data(), pool);
+            auto end = std::chrono::high_resolution_clock::now();
+            best = std::min(best, std::chrono::duration<double>(end - start).count()); }
+        printf("  %2u threads %8.1f ms %8.2f Mpix/s\n", threads, best*1e3, pixels/best*1e-6);
+        if (threads == cores) break; }
+    return agree;
+}
@@ -31,15 +31,29 @@ throw std::runtime_error("Failed Vulkan Check");\
 void VkApp::destroyAllVulkanResources()
 {
     // @@
-     vkDeviceWaitIdle(m_device);  // Uncomment this when you have an m_device created.
+     // The frames in flight.  (Not vkDeviceWaitIdle yet: the upload
+     // thread still submits to its own queue.)
+     vkQueueWaitIdle(m_queue);
+     if (m_computeQueue)
+         vkQueueWaitIdle(m_computeQueue);
+
+     destroyVariants();  // First: stops the worker that builds them
+     destroyTexStreaming();  // Likewise, and before the scene's loader
+     destroySceneLoader();  // Before the uploader, which its uploads need
+     destroyAsyncCompute();
+     destroyUploader();
+     vkDeviceWaitIdle(m_device);  // Safe now: no thread but this one submits
 
-     m_denoiseBuffer.destroy(m_device);
      m_denoiseDesc.destroy(m_device);
 
      vkDestroyPipelineLayout(m_device, m_denoiseCompPipelineLayout, nullptr);
      vkDestroyPipeline(m_device, m_denoisePipelineX, nullptr);
+     vkDestroyPipeline(m_device, m_denoisePipelineX16, nullptr);
+     vkDestroyPipeline(m_device, m_denoisePipelineFused, nullptr);
 
-     m_rtBuilder.destroy();
+     destroyWavefront();
+
+     destroyScene();
      m_shaderBindingTableBW.destroy(m_device);
 
      m_scratch1.destroy(m_device);
@@ -53,14 +67,22 @@ void VkApp::destroyAllVulkanResources()
      vkDestroyPipelineLayout(m_device, m_rtPipelineLayout, nullptr);
      vkDestroyPipeline(m_device, m_rtPipeline, nullptr);
 
+     vkDestroyPipelineLayout(m_device, m_rqPipelineLayout, nullptr);
+     vkDestroyPipeline(m_device, m_rqPipeline, nullptr);
+
 	 m_rtColCurrBuffer.destroy(m_device);
 	 m_rtColPrevBuffer.destroy(m_device);
 
-	 m_rtNdCurrBuffer.destroy(m_device);
-
-	 m_rtNdPrevBuffer.destroy(m_device);
-
-	 m_rtKdCurrBuffer.destroy(m_device);
+     destroyScreenTargets();
+     m_rtMotionBuffer.destroy(m_device);
+     m_rtLumMomCurrBuffer.destroy(m_device);
+     m_rtLumMomPrevBuffer.destroy(m_device);
+     m_reservoirBW.destroy(m_device);
+     m_samplerBW.destroy(m_device);
+     destroyAdaptive();
+     destroyGBuffer();
+     destroyCheckerboard();
+     destroyTemporal();
 
      m_scDesc.destroy(m_device);
 
@@ -68,41 +90,22 @@ void VkApp::destroyAllVulkanResources()
      vkDestroyFramebuffer(m_device, m_scanlineFramebuffer, nullptr);
      
      m_objDescriptionBW.destroy(m_device);
+     m_instDescriptionBW.destroy(m_device);
 
      m_matrixBW.destroy(m_device);
 
-     for (size_t i = 0; i < m_objText.size(); i++)
-     {
-         m_objText[i].destroy(m_device);
-     }
-
-     m_lightBuffer.destroy(m_device);
-
-     for (size_t i = 0; i < m_objData.size(); i++)
-     {
-		 ObjData& obj = m_objData[i];
-		 obj.vertexBuffer.destroy(m_device);
-		 obj.indexBuffer.destroy(m_device);
-		 obj.matColorBuffer.destroy(m_device);
-		 obj.matIndexBuffer.destroy(m_device);
-     }
-
-
-     for (size_t i = 0; i < m_objDesc.size(); i++)
-     {
-         // TODO::destroy description
-         //m_objDesc[i].destroy(m_device);
-     }
+     m_placeholderTexture.destroy(m_device);  // The scene's went with destroyScene
 
 #ifdef GUI
      destroyGUI();
 #endif
 
-     m_scImageBuffer.destroy(m_device);
+     m_graph.destroy(m_device);  // sc, denoise and the G-buffer: the transient images
      m_postDesc.destroy(m_device);
 
      vkDestroyPipelineLayout(m_device, m_postPipelineLayout, nullptr);
      vkDestroyPipeline(m_device, m_postPipeline, nullptr);
+     vkDestroyPipeline(m_device, m_postComputePipeline, nullptr);
 
      for(uint32_t i = 0; i < m_framebuffers.size(); i++) 
      {
@@ -217,24 +220,26 @@ void VkApp::createPhysicalDevice()
     }
     std::cout << std::endl;
 
-	std::vector<uint32_t> compatibleDevices;
+    // Either of these is enough to ray trace: the ray tracing
+    // pipeline (preferred), or else ray queries from a compute shader.
+    const char* rtPipelineExt = VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME;
+    const char* rayQueryExt   = VK_KHR_RAY_QUERY_EXTENSION_NAME;
 
 	std::cout<< physicalDevicesCount << " devices found." <<std::endl;
-	int i = 0;
+
+	int bestScore = -1;
+	uint32_t bestDevice = 0;
+	bool bestHasRtPipeline = false, bestHasRayQuery = false;
 
 	// For each GPU:
-	for (auto physicalDevice : physicalDevices)
+	for (uint32_t i = 0; i < physicalDevicesCount; i++)
 	{
+		VkPhysicalDevice physicalDevice = physicalDevices[i];
 
 		// Get the GPU's properties
 		VkPhysicalDeviceProperties GPUproperties;
 		vkGetPhysicalDeviceProperties(physicalDevice, &GPUproperties);
 
-		if (GPUproperties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
-		{
-			continue;
-		}
-
 		// Get the GPU's extension list;  Another two-step list retrieval procedure:
 		uint extCount;
 		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extCount, nullptr);
@@ -242,56 +247,74 @@ void VkApp::createPhysicalDevice()
 		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
 			&extCount, extensionProperties.data());
 
+		auto hasExtension = [&](const char* name) {
+			for (size_t j = 0; j < extCount; ++j)
+				if (strcmp(extensionProperties[j].extensionName, name) == 0)
+					return true;
+			return false; };
+
 		// @@ This code is in a loop iterating variable physicalDevice
 		// through a list of all physicalDevices.  The
 		// physicalDevice's properties (GPUproperties) and a list of
 		// its extension properties (extensionProperties) are retrieve
 		// above, and here we judge if the physicalDevice (i.e.. GPU)
 		// is compatible with our requirements. We consider a GPU to be
-		// compatible if it satisfies both:
+		// compatible if all reqDeviceExtensions can be found in its
+		// extensionProperties list, and it has at least one of the
+		// two ways of tracing rays.
 
 		bool deviceOK = true;
-		for (size_t i = 0; i < reqDeviceExtensions.size(); i++)
+		for (const char* ext : reqDeviceExtensions)
 		{
-			bool exists = false;
-			for (size_t j = 0; j < extCount; ++j)
-			{
-				//    All reqDeviceExtensions can be found in the GPUs extensionProperties list
-				if (strcmp(extensionProperties[j].extensionName, reqDeviceExtensions[i]) == 0)
-					exists = true;
-			}
-			if (exists == false)
+			if (!hasExtension(ext))
 			{
 				// we failed to find a suitable extension
 				deviceOK = false;
-				std::cout << "Device [" << GPUproperties.deviceName << "] missing required Ext " << "[" << reqDeviceExtensions[i] << "]" << std::endl;
+				std::cout << "Device [" << GPUproperties.deviceName << "] missing required Ext " << "[" << ext << "]" << std::endl;
 				break;
 			}
 		}
-		if (deviceOK)
+
+		bool hasRtPipeline = hasExtension(rtPipelineExt);
+		bool hasRayQuery   = hasExtension(rayQueryExt);
+		if (deviceOK && !hasRtPipeline && !hasRayQuery)
 		{
-			compatibleDevices.push_back(i);
+			deviceOK = false;
+			std::cout << "Device [" << GPUproperties.deviceName << "] has neither ["
+			          << rtPipelineExt << "] nor [" << rayQueryExt << "]" << std::endl;
 		}
-		++i;
+		if (!deviceOK)
+			continue;
+
+		// Prefer a discrete GPU, then the ray tracing pipeline.
+		int score = (GPUproperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ? 4 : 0)
+			+ (hasRtPipeline ? 2 : 0) + (hasRayQuery ? 1 : 0);
+		std::cout << "Device [" << GPUproperties.deviceName << "] is compatible ("
+		          << (hasRtPipeline ? "ray tracing pipeline" : "ray query only") << ")" << std::endl;
 
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestDevice = i;
+			bestHasRtPipeline = hasRtPipeline;
+			bestHasRayQuery = hasRayQuery;
+		}
 	}
 
     //  If a GPU is found to be compatible
-    //  Return it (physicalDevice), or continue the search and then return the best GPU.
+    //  Return the best one (physicalDevice), or
     //    raise an exception of none were found
-    //    tell me all about your system if more than one was found.
-    if (compatibleDevices.empty())
+    if (bestScore < 0)
     {
         throw std::runtime_error("Could not find suitable GPU");
     }
 
-    if (compatibleDevices.size() > 1)
-    {
-        std::cout << "[Interest] This system has [" << compatibleDevices.size() << "] compatible devices" << std::endl;
-    }
+    m_physicalDevice = physicalDevices[bestDevice];
+    m_hasRtPipeline  = bestHasRtPipeline;
+    m_hasRayQuery    = bestHasRayQuery;
+    if (m_hasRtPipeline) reqDeviceExtensions.push_back(rtPipelineExt);
+    if (m_hasRayQuery)   reqDeviceExtensions.push_back(rayQueryExt);
 
-    // we take first one for now. maybe find a better way to select GPU
-    m_physicalDevice = physicalDevices[compatibleDevices.front()];
     {
         VkPhysicalDeviceProperties GPUproperties;
         vkGetPhysicalDeviceProperties(m_physicalDevice, &GPUproperties);
@@ -331,6 +354,25 @@ void VkApp::chooseQueueIndex()
     // Select this queue
     m_graphicsQueueIndex = selectedQueue;
 
+    // A compute family without graphics, for async compute (see
+    // vkapp_async.cpp), if there's one
+    for (uint32_t i = 0; i < mpCount; i++)
+        if ((queueProperties[i].queueFlags & VK_QUEUE_COMPUTE_BIT)
+            && !(queueProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+            m_computeQueueIndex = i;
+            m_computeTimestamps = queueProperties[i].timestampValidBits > 0;
+            break; }
+
+    // A transfer family without graphics or compute, for the upload
+    // thread (see vkapp_upload.cpp), if there's one
+    for (uint32_t i = 0; i < mpCount; i++)
+        if ((queueProperties[i].queueFlags & VK_QUEUE_TRANSFER_BIT)
+            && !(queueProperties[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            m_transferQueueIndex = i;
+            break; }
+    printf("Queue families: graphics %u, async compute %d, transfer %d\n", m_graphicsQueueIndex,
+           m_computeQueueIndex == VK_QUEUE_FAMILY_IGNORED ? -1 : int(m_computeQueueIndex),
+           m_transferQueueIndex == VK_QUEUE_FAMILY_IGNORED ? -1 : int(m_transferQueueIndex));
 }
 
 
@@ -342,6 +384,9 @@ void VkApp::createDevice()
     
     VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeature{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
+
+    VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeature{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR};
     
     VkPhysicalDeviceVulkan13Features features13{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES};
@@ -362,7 +407,15 @@ void VkApp::createDevice()
     features11.pNext = &features12;
     features12.pNext = &features13;
     features13.pNext = &accelFeature;
-    accelFeature.pNext = &rtPipelineFeature;
+    // Chain only the features of the extensions being enabled: the
+    // ray tracing pipeline and/or ray query, as chosen in createPhysicalDevice.
+    void** next = &accelFeature.pNext;
+    if (m_hasRtPipeline) {
+        *next = &rtPipelineFeature;
+        next = &rtPipelineFeature.pNext; }
+    if (m_hasRayQuery) {
+        *next = &rayQueryFeature;
+        next = &rayQueryFeature.pNext; }
 
     // Fill in all structures on the pNext chain
     vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features2);
@@ -373,17 +426,38 @@ void VkApp::createDevice()
     // Turn off robustBufferAccess (WHY?)
     features2.features.robustBufferAccess = VK_FALSE;
 
+    // Async compute and the upload thread need timeline semaphores
+    // (core in 1.2, but optional)
+    if (!features12.timelineSemaphore)
+        m_computeQueueIndex = m_transferQueueIndex = VK_QUEUE_FAMILY_IGNORED;
+
+    // The render graph's barriers are vkCmdPipelineBarrier2's (core in
+    // 1.3, and required of any 1.3 device)
+    if (!features13.synchronization2)
+        throw std::runtime_error("synchronization2 is not supported!");
+
+    // Half precision arithmetic, for denoiseX_fp16
+    m_hasFloat16 = features12.shaderFloat16;
+
     float priority = 1.0;
+    std::vector<VkDeviceQueueCreateInfo> queueInfos;
     VkDeviceQueueCreateInfo queueInfo{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
     queueInfo.queueFamilyIndex = m_graphicsQueueIndex;
     queueInfo.queueCount       = 1;
     queueInfo.pQueuePriorities = &priority;
+    queueInfos.push_back(queueInfo);
+    if (m_computeQueueIndex != VK_QUEUE_FAMILY_IGNORED) {
+        queueInfo.queueFamilyIndex = m_computeQueueIndex;
+        queueInfos.push_back(queueInfo); }
+    if (m_transferQueueIndex != VK_QUEUE_FAMILY_IGNORED) {
+        queueInfo.queueFamilyIndex = m_transferQueueIndex;
+        queueInfos.push_back(queueInfo); }
     
     VkDeviceCreateInfo deviceCreateInfo{VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
     deviceCreateInfo.pNext            = &features2; // This is the whole pNext chain
   
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pQueueCreateInfos    = &queueInfo;
+    deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueInfos.size());
+    deviceCreateInfo.pQueueCreateInfos    = queueInfos.data();
     
     deviceCreateInfo.enabledExtensionCount   = static_cast<uint32_t>(reqDeviceExtensions.size());
     deviceCreateInfo.ppEnabledExtensionNames = reqDeviceExtensions.data();
@@ -395,6 +469,10 @@ void VkApp::createDevice()
 void VkApp::getCommandQueue()
 {
     vkGetDeviceQueue(m_device, m_graphicsQueueIndex, 0, &m_queue);
+    if (m_computeQueueIndex != VK_QUEUE_FAMILY_IGNORED)
+        vkGetDeviceQueue(m_device, m_computeQueueIndex, 0, &m_computeQueue);
+    if (m_transferQueueIndex != VK_QUEUE_FAMILY_IGNORED)
+        vkGetDeviceQueue(m_device, m_transferQueueIndex, 0, &m_transferQueue);
     // Returns void -- nothing to verify
     // Nothing to destroy -- the queue is owned by the device.
 }
@@ -454,7 +532,9 @@ void VkApp::createSwapchain()
 {
     VkSwapchainKHR oldSwapchain = m_swapchain;
 
-    vkDeviceWaitIdle(m_device);  // Probably unnecessary
+    // Probably unnecessary.  (Not vkDeviceWaitIdle: the upload thread
+    // submits to its own queue.)
+    vkQueueWaitIdle(m_queue);
 
     // Get the surface's capabilities
     VkSurfaceCapabilitiesKHR capabilities;
@@ -583,9 +663,12 @@ void VkApp::createSwapchain()
     // the situation that caused it.  
 
     // Create the swap chain
+    // Storage too, where the surface and format allow it, for post.comp
+    m_storageSwapchain = storageSwapchainSupported(capabilities, surfaceFormat);
     VkImageUsageFlags imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
-        | VK_IMAGE_USAGE_STORAGE_BIT
         | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (m_storageSwapchain)
+        imageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
 
     VkSwapchainCreateInfoKHR _i = {VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR};
     _i.surface                  = m_surface;
@@ -691,7 +774,7 @@ void VkApp::createSwapchain()
 
 void VkApp::destroySwapchain()
 {
-    vkDeviceWaitIdle(m_device);
+    vkQueueWaitIdle(m_queue);  // (Also run by recreateSwapchain, as above)
 
     // @@
     // Destroy all (3)  m_imageView'Ss with vkDestroyImageView(m_device, imageView, nullptr)
@@ -714,7 +797,11 @@ void VkApp::destroySwapchain()
 
 bool VkApp::recreateSwapchain()
 {
-    vkDeviceWaitIdle(m_device);
+    // The frames in flight.  (Not vkDeviceWaitIdle: the upload thread
+    // submits to its own queue.)
+    vkQueueWaitIdle(m_queue);
+    if (m_computeQueue)
+        vkQueueWaitIdle(m_computeQueue);
 
     VkSwapchainKHR oldSwapchain = m_swapchain;
 
@@ -804,9 +891,12 @@ bool VkApp::recreateSwapchain()
     // the situation that caused it.  
 
     // Create the swap chain
+    // Storage too, where the surface and format allow it, for post.comp
+    m_storageSwapchain = storageSwapchainSupported(capabilities, surfaceFormat);
     VkImageUsageFlags imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
-        | VK_IMAGE_USAGE_STORAGE_BIT
         | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (m_storageSwapchain)
+        imageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
 
     VkSwapchainCreateInfoKHR _i = {VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR};
     _i.surface                  = m_surface;
@@ -955,11 +1045,12 @@ uint32_t VkApp::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags proper
 // A factory function for an ImageWrap, this creates a VkImage and
 // creates and binds an associated VkDeviceMemory object.  The
 // VkImageView and VkSampler are left empty to be created elsewhere as
-// needed.
+// needed.  Without bind, the memory is left to the caller too (the
+// render graph's, for a transient image).
 ImageWrap VkApp::createImageWrap(uint32_t width, uint32_t height,
     VkFormat format,
     VkImageUsageFlags usage,
-    VkMemoryPropertyFlags properties, uint mipLevels)
+    VkMemoryPropertyFlags properties, uint mipLevels, bool bind)
 {
     ImageWrap myImage;
 
@@ -978,6 +1069,8 @@ ImageWrap VkApp::createImageWrap(uint32_t width, uint32_t height,
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
     VK_CHK(vkCreateImage(m_device, &imageInfo, nullptr, &myImage.image));
+    if (!bind)
+        return myImage;
 
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(m_device, myImage.image, &memRequirements);
@@ -998,7 +1091,7 @@ ImageWrap VkApp::createImageWrap(uint32_t width, uint32_t height,
 }
 
 VkImageView VkApp::createImageView(VkImage image, VkFormat format,
-    VkImageAspectFlagBits aspect)
+    VkImageAspectFlagBits aspect, uint32_t mipLevels)
 {
     VkImageViewCreateInfo viewInfo{VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
     viewInfo.image = image;
@@ -1006,7 +1099,7 @@ VkImageView VkApp::createImageView(VkImage image, VkFormat format,
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = aspect;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
@@ -1113,8 +1206,11 @@ void VkApp::createPostPipeline()
     // What we can do now as a first pass:
     createInfo.setLayoutCount         = 1;
     createInfo.pSetLayouts            = &m_postDesc.descSetLayout;
-    createInfo.pushConstantRangeCount = 0;
-    createInfo.pPushConstantRanges    = nullptr;
+    // Shared with post.comp's pipeline (see vkapp_post.cpp)
+    VkPushConstantRange pushConstantRange{
+        VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantPost)};
+    createInfo.pushConstantRangeCount = 1;
+    createInfo.pPushConstantRanges    = &pushConstantRange;
 
     vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_postPipelineLayout);
 
@@ -1434,44 +1530,58 @@ std::string VkApp::loadFile(const std::string& filename)
 // Post processing pass: tone mapper, UI
 void VkApp::postProcess()
 {
-    std::array<VkClearValue, 2> clearValues{};
-    clearValues[0].color        = {{1,1,1,1}};
-    clearValues[1].depthStencil = {1.0f, 0};
-
-    VkRenderPassBeginInfo _i{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
-    _i.clearValueCount = 2;
-    _i.pClearValues    = clearValues.data();
-    _i.renderPass      = m_postRenderPass;
-    _i.framebuffer     = m_framebuffers[m_swapchainIndex];
-    _i.renderArea      = {{0, 0}, windowSize};
-
-    vkCmdBeginRenderPass(m_commandBuffer, &_i, VK_SUBPASS_CONTENTS_INLINE);
-    {   // extra indent for renderpass commands
-        //VkViewport viewport{0.0f, 0.0f,
-        //    static_cast<float>(windowSize.width), static_cast<float>(windowSize.height),
-        //    0.0f, 1.0f};
-        //vkCmdSetViewport(m_commandBuffer, 0, 1, &viewport);
-        //
-        //VkRect2D scissor{{0, 0}, {windowSize.width, windowSize.height}};
-        //vkCmdSetScissor(m_commandBuffer, 0, 1, &scissor);
-
-        auto aspectRatio = static_cast<float>(windowSize.width)
-            / static_cast<float>(windowSize.height);
-        //vkCmdPushConstants(m_commandBuffer, m_postPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0,
-        //                   sizeof(float), &aspectRatio);
-        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipeline);
+    m_pcPost.src = postSource();
+    // After the pass that made it (the render graph's barrier)
+    m_graph.begin(m_commandBuffer, m_pcPost.src == POST_SOURCE_SC ? m_rgPostSc : m_rgPostColCurr);
+
+    if (useComputePost && m_postComputePipeline)
+        postCompute();  // Straight to the swapchain image: no render pass
+    else
+    {
+        std::array<VkClearValue, 2> clearValues{};
+        clearValues[0].color        = {{1,1,1,1}};
+        clearValues[1].depthStencil = {1.0f, 0};
+
+        VkRenderPassBeginInfo _i{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+        _i.clearValueCount = 2;
+        _i.pClearValues    = clearValues.data();
+        _i.renderPass      = m_postRenderPass;
+        _i.framebuffer     = m_framebuffers[m_swapchainIndex];
+        _i.renderArea      = {{0, 0}, windowSize};
+
+        vkCmdBeginRenderPass(m_commandBuffer, &_i, VK_SUBPASS_CONTENTS_INLINE);
+        {   // extra indent for renderpass commands
+            //VkViewport viewport{0.0f, 0.0f,
+            //    static_cast<float>(windowSize.width), static_cast<float>(windowSize.height),
+            //    0.0f, 1.0f};
+            //vkCmdSetViewport(m_commandBuffer, 0, 1, &viewport);
+            //
+            //VkRect2D scissor{{0, 0}, {windowSize.width, windowSize.height}};
+            //vkCmdSetScissor(m_commandBuffer, 0, 1, &scissor);
+
+            vkCmdPushConstants(m_commandBuffer, m_postPipelineLayout,
+                               VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                               sizeof(PushConstantPost), &m_pcPost);
+            vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_postPipeline);
         
-        vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                               m_postPipelineLayout, 0, 1, &m_postDesc.descSet, 0, nullptr);
+            vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                   m_postPipelineLayout, 0, 1, &m_postDesc.descSet, 0, nullptr);
 
-        // Weird! This draws 3 vertices but with no vertices/triangles buffers bound in.
-        // Hint: The vertex shader fabricates vertices from gl_VertexIndex
-        vkCmdDraw(m_commandBuffer, 3, 1, 0, 0);
+            // Weird! This draws 3 vertices but with no vertices/triangles buffers bound in.
+            // Hint: The vertex shader fabricates vertices from gl_VertexIndex
+            vkCmdDraw(m_commandBuffer, 3, 1, 0, 0);
 
+        }
+        vkCmdEndRenderPass(m_commandBuffer);
     }
-    vkCmdEndRenderPass(m_commandBuffer);
+    recordGUI();
+
+}
+
+// The GUI, drawn over the swapchain image (in COLOR_ATTACHMENT_OPTIMAL)
+void VkApp::recordGUI()
+{
 #ifdef GUI
-    {
     VkRenderPassBeginInfo GUIpassInfo = {};
     GUIpassInfo.sType       = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     GUIpassInfo.renderPass  = m_imguiRenderPass;
@@ -1481,9 +1591,7 @@ void VkApp::postProcess()
     ImGui::Render();  // Rendering UI
     ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), m_commandBuffer);
     vkCmdEndRenderPass(m_commandBuffer);
-    }
 #endif
-
 }
 
 // That's all for now!
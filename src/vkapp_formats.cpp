@@ -0,0 +1,285 @@
+// The screen targets' formats.  Everything the tracer and the denoiser
+// keep per pixel was rgba32f; three targets don't need that much:
+//
+//   Nd (NdCurr, NdPrev):  rgba16f: an octahedral normal and a 16 bit
+//                         depth (nd_packing.glsl).  Unpacked, the same
+//                         encoding in rgba32f, with a 32 bit depth.
+//   Kd (KdCurr):          rgba8: the first hit's albedo, in [0,1].
+//   sample (sampleCurr):  rgba16f: one frame's mean radiance, clamped to
+//                         half's range, and its path count.
+//
+// The accumulated color, the luminance moments (which hold L^2), the
+// adaptive sampler's moments, the motion vectors and the G-buffer stay
+// rgba32f: running means over hundreds of frames need float's
+// precision.  The shaders declare the packable targets without a format
+// qualifier, so each format needs format-less storage reads and writes.
+//
+// The GUI packs each target, or not; updateScreenTargets recreates them
+// (and the async filter's copies of Nd and Kd) before the next frame,
+// and restarts the accumulation.
+//
+// comparePrecision: the denoiser at full precision against packed (Nd,
+// Kd, and denoiseX_fp16) on this frame's inputs: the time of each, and
+// how far the packed result is from the full one.  Also the screen
+// targets' bytes per pixel, both ways.
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include "vkapp.h"
+
+#include "shaders/shared_structs.h"
+
+static const VkFormat fullFormat   = VK_FORMAT_R32G32B32A32_SFLOAT;
+static const VkFormat ndPacked     = VK_FORMAT_R16G16B16A16_SFLOAT;
+static const VkFormat kdPacked     = VK_FORMAT_R8G8B8A8_UNORM;
+static const VkFormat samplePacked = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+static const char* formatName(VkFormat format)
+{
+    switch (format) {
+    case VK_FORMAT_R16G16B16A16_SFLOAT: return "rgba16f";
+    case VK_FORMAT_R8G8B8A8_UNORM:      return "rgba8";
+    default:                            return "rgba32f"; }
+}
+
+static int formatBytes(VkFormat format)
+{
+    switch (format) {
+    case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+    case VK_FORMAT_R8G8B8A8_UNORM:      return 4;
+    default:                            return 16; }
+}
+
+// Bytes per pixel of the tracer's persistent targets: the two colors,
+// motion, the two luminance moments and the adaptive moments at
+// rgba32f, and the packable ones
+static int screenTargetBytes(VkFormat nd, VkFormat kd, VkFormat sample)
+{
+    return 6*16 + 2*formatBytes(nd) + formatBytes(kd) + formatBytes(sample);
+}
+
+// Can the shaders read and write images of this format without a
+// format qualifier?
+static bool formatlessStorage(VkPhysicalDevice physicalDevice, VkFormat format)
+{
+    VkFormatProperties3 properties3{VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3};
+    VkFormatProperties2 properties{VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2};
+    properties.pNext = &properties3;
+    vkGetPhysicalDeviceFormatProperties2(physicalDevice, format, &properties);
+
+    const VkFormatFeatureFlags2 needed = VK_FORMAT_FEATURE_2_STORAGE_IMAGE_BIT
+        | VK_FORMAT_FEATURE_2_STORAGE_READ_WITHOUT_FORMAT_BIT
+        | VK_FORMAT_FEATURE_2_STORAGE_WRITE_WITHOUT_FORMAT_BIT;
+    return (properties3.optimalTilingFeatures & needed) == needed;
+}
+
+void VkApp::chooseTargetFormats()
+{
+    if (!formatlessStorage(m_physicalDevice, fullFormat))
+        throw std::runtime_error("format-less storage of rgba32f images is not supported!");
+    m_canPackNd     = formatlessStorage(m_physicalDevice, ndPacked);
+    m_canPackKd     = formatlessStorage(m_physicalDevice, kdPacked);
+    m_canPackSample = formatlessStorage(m_physicalDevice, samplePacked);
+    packNd     = packNd && m_canPackNd;
+    packKd     = packKd && m_canPackKd;
+    packSample = packSample && m_canPackSample;
+    printf("Packed targets: Nd %s, Kd %s, sample %s\n",
+           m_canPackNd ? "yes" : "no", m_canPackKd ? "yes" : "no", m_canPackSample ? "yes" : "no");
+}
+
+void VkApp::createScreenTargets()
+{
+    m_ndFormat     = packNd ? ndPacked : fullFormat;
+    m_kdFormat     = packKd ? kdPacked : fullFormat;
+    m_sampleFormat = packSample ? samplePacked : fullFormat;
+
+    struct Target { ImageWrap* image; VkFormat format; };
+    const Target targets[] = {
+        {&m_rtNdCurrBuffer, m_ndFormat}, {&m_rtNdPrevBuffer, m_ndFormat},
+        {&m_rtKdCurrBuffer, m_kdFormat}, {&m_rtSampleBuffer, m_sampleFormat}};
+    for (const Target& target : targets) {
+        *target.image = createBufferImage(windowSize, false, target.format);
+        transitionImageLayout(target.image->image, target.format,
+                              VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1); }
+}
+
+void VkApp::destroyScreenTargets()
+{
+    m_rtNdCurrBuffer.destroy(m_device);
+    m_rtNdPrevBuffer.destroy(m_device);
+    m_rtKdCurrBuffer.destroy(m_device);
+    m_rtSampleBuffer.destroy(m_device);
+}
+
+// At the start of a frame: the targets at the formats the GUI chose.
+// The render graph keeps pointers to their ImageWraps, so it needn't know.
+void VkApp::updateScreenTargets()
+{
+    packNd     = packNd && m_canPackNd;
+    packKd     = packKd && m_canPackKd;
+    packSample = packSample && m_canPackSample;
+    if ((packNd ? ndPacked : fullFormat) == m_ndFormat
+        && (packKd ? kdPacked : fullFormat) == m_kdFormat
+        && (packSample ? samplePacked : fullFormat) == m_sampleFormat)
+        return;
+
+    if (m_asyncPending)
+        finishAsyncFrames();
+    // The frames in flight use the targets.  (Not vkDeviceWaitIdle: the
+    // upload thread submits to its own queue.)
+    vkQueueWaitIdle(m_queue);
+    if (m_computeQueue)
+        vkQueueWaitIdle(m_computeQueue);
+
+    destroyScreenTargets();
+    createScreenTargets();
+    m_rtDesc.write(m_device, RtBindings::eOutCurrNd, m_rtNdCurrBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eOutPrevNd, m_rtNdPrevBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eOutCurrKd, m_rtKdCurrBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eSampleCurr, m_rtSampleBuffer.Descriptor());
+    m_denoiseDesc.write(m_device, DenoiseBindings::eInCurrNd, m_rtNdCurrBuffer.Descriptor());
+    m_denoiseDesc.write(m_device, DenoiseBindings::eInCurrKd, m_rtKdCurrBuffer.Descriptor());
+
+    // The async filter's copies: the handoff copies, so same formats
+    if (m_asyncTimeline) {
+        m_asyncKdBuffer.destroy(m_device);
+        m_asyncNdBuffer.destroy(m_device);
+        m_asyncKdBuffer = createBufferImage(windowSize, false, m_kdFormat);
+        m_asyncNdBuffer = createBufferImage(windowSize, false, m_ndFormat);
+        m_asyncDenoiseDesc.write(m_device, DenoiseBindings::eInCurrKd, m_asyncKdBuffer.Descriptor());
+        m_asyncDenoiseDesc.write(m_device, DenoiseBindings::eInCurrNd, m_asyncNdBuffer.Descriptor()); }
+
+    m_sceneChanged = true;  // NdPrev is gone, and with it the history
+    printf("Screen targets: Nd %s, Kd %s, sample %s, %d bytes/pixel\n",
+           formatName(m_ndFormat), formatName(m_kdFormat), formatName(m_sampleFormat),
+           screenTargetBytes(m_ndFormat, m_kdFormat, m_sampleFormat));
+}
+
+// The denoiser, with the current settings and schedule, on images of
+// its own at windowSize, with this frame's inputs converted to each
+// configuration's formats.  Nd and Kd are only as precise as the
+// frame's targets: for an exact reference, compare unpacked.
+void VkApp::comparePrecision()
+{
+    if (m_num_atrous_iterations < 1) {
+        printf("Precision compare: no A-Trous iterations to compare\n");
+        return; }
+
+    if (m_asyncPending)
+        finishAsyncFrames();
+    // This frame's inputs, finished.  (Again not vkDeviceWaitIdle.)
+    vkQueueWaitIdle(m_queue);
+    if (m_computeQueue)
+        vkQueueWaitIdle(m_computeQueue);
+
+    struct Config { const char* name; VkFormat nd, kd; bool fp16; };
+    const Config configs[] = {
+        {"full", fullFormat, fullFormat, false},
+        {"packed", m_canPackNd ? ndPacked : fullFormat, m_canPackKd ? kdPacked : fullFormat,
+         m_denoisePipelineX16 != VK_NULL_HANDLE}};
+    const int repeats = 20;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+
+    VkQueryPoolCreateInfo queryInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    queryInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    queryInfo.queryCount = 2;  // Before and after the repeats
+    VkQueryPool queryPool;
+    if (vkCreateQueryPool(m_device, &queryInfo, nullptr, &queryPool) != VK_SUCCESS)
+        throw std::runtime_error("failed to create query pool!");
+
+    m_pcDenoise.normFactor = f_normFactor;
+    m_pcDenoise.depthFactor = f_depthFactor;
+    m_pcDenoise.lumenFactor = f_lumenFactor;
+    m_pcDenoise.demodulate = useDemodulate;
+    m_pcDenoise.varianceGuided = useVarianceGuided;
+
+    bool fp16 = useFp16Denoise;
+    std::vector<float> results[2];
+    double ms[2];
+    for (int c = 0; c < 2; c++) {
+        std::vector<ImageWrap> images;  // DENOISE_IMAGE_*, Kd, Nd, variance
+        for (int i = 0; i < 6; i++)
+            images.push_back(createBufferImage(windowSize, false,
+                                               i == 3 ? configs[c].kd : i == 4 ? configs[c].nd : fullFormat));
+
+        DescriptorWrap desc{};
+        desc.setBindings(m_device, m_denoiseDesc.bindingTable);
+        desc.write(m_device, DenoiseBindings::eImages,
+                   std::vector<ImageWrap>{images[0], images[1], images[2]});
+        desc.write(m_device, DenoiseBindings::eInCurrKd, images[3].Descriptor());
+        desc.write(m_device, DenoiseBindings::eInCurrNd, images[4].Descriptor());
+        desc.write(m_device, DenoiseBindings::eInVariance, images[5].Descriptor());
+
+        // The inputs, converted.  The per-iteration schedule works in
+        // place on its pong, so that gets the color too.
+        VkCommandBuffer cmd = createTempCmdBuffer();
+        for (ImageWrap& image : images)
+            imageLayoutBarrier(cmd, image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        CmdCopyImages(cmd, {{&m_rtColCurrBuffer, &images[0]}, {&m_rtColCurrBuffer, &images[2]},
+                            {&m_rtKdCurrBuffer, &images[3]}, {&m_rtNdCurrBuffer, &images[4]},
+                            {&m_rtLumMomCurrBuffer, &images[5]}},
+                      windowSize, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, true);
+        useFp16Denoise = configs[c].fp16;
+        recordDenoise(cmd, desc.descSet, windowSize, images[1], images[2], denoiseSchedule);
+        submitTempCmdBuffer(cmd);
+        results[c] = readbackImage(images[2]);
+
+        // Then its time, which hardly depends on the content
+        cmd = createTempCmdBuffer();
+        vkCmdResetQueryPool(cmd, queryPool, 0, 2);
+        recordDenoise(cmd, desc.descSet, windowSize, images[1], images[2], denoiseSchedule);  // Warm up
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 0);
+        for (int r = 0; r < repeats; r++)
+            recordDenoise(cmd, desc.descSet, windowSize, images[1], images[2], denoiseSchedule);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+        submitTempCmdBuffer(cmd);
+
+        uint64_t stamps[2];
+        vkGetQueryPoolResults(m_device, queryPool, 0, 2, sizeof(stamps), stamps, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        ms[c] = (stamps[1] - stamps[0]) * properties.limits.timestampPeriod * 1e-6 / repeats;
+
+        desc.destroy(m_device);
+        for (ImageWrap& image : images)
+            image.destroy(m_device); }
+    useFp16Denoise = fp16;
+    vkDestroyQueryPool(m_device, queryPool, nullptr);
+
+    // The packed result against the full one, over the color: RMSE,
+    // the largest difference, and PSNR with the full result's brightest
+    // channel as the peak
+    size_t pixels = size_t(windowSize.width)*windowSize.height;
+    double sum = 0.0, largest = 0.0, peak = 0.0;
+    for (size_t p = 0; p < pixels; p++)
+        for (int ch = 0; ch < 3; ch++) {
+            double full = results[0][4*p + ch], d = results[1][4*p + ch] - full;
+            sum += d*d;
+            largest = std::max(largest, fabs(d));
+            peak = std::max(peak, fabs(full)); }
+    double rmse = sqrt(sum/(3*pixels));
+
+    printf("Precision compare, %ux%u, %d iterations (%s), %d repeats:\n",
+           windowSize.width, windowSize.height, m_num_atrous_iterations,
+           denoiseSchedule == eDenoiseFused ? "fused" : "per iteration", repeats);
+    for (int c = 0; c < 2; c++)
+        printf("  %-7s Nd %-8s Kd %-8s %-6s %8.3f ms\n", configs[c].name,
+               formatName(configs[c].nd), formatName(configs[c].kd),
+               configs[c].fp16 ? "fp16" : "fp32", ms[c]);
+    if (rmse > 0.0)
+        printf("  packed against full: RMSE %.3g, max %.3g, PSNR %.1f dB\n",
+               rmse, largest, 20.0*log10(peak/rmse));
+    else
+        printf("  packed against full: identical\n");
+    printf("  screen targets: full %d, packed %d, now %d bytes/pixel\n",
+           screenTargetBytes(fullFormat, fullFormat, fullFormat),
+           screenTargetBytes(m_canPackNd ? ndPacked : fullFormat, m_canPackKd ? kdPacked : fullFormat,
+                             m_canPackSample ? samplePacked : fullFormat),
+           screenTargetBytes(m_ndFormat, m_kdFormat, m_sampleFormat));
+    if (m_ndFormat != fullFormat || m_kdFormat != fullFormat)
+        printf("  (from this frame's packed Nd/Kd: unpack them for an exact reference)\n");
+}
@@ -0,0 +1,262 @@
+// Hybrid renderer: the camera rays' first hits are rasterized into a
+// G-buffer, and the path tracer starts its paths from there instead
+// of tracing them.
+//
+//   m_gbPosBuffer:  world position, and distance from the eye (the ray's t)
+//   m_gbIdBuffer:   instance index + 1 (0 where nothing was hit), primitive index
+//
+// The path tracer reconstructs the hit's barycentrics from the
+// position and the triangle, and from them everything else, just as
+// for a traced hit, so its outputs (and the denoiser's inputs) are
+// unchanged.
+
+#include <array>
+#include <vector>
+
+#include "vkapp.h"
+
+#include "shaders/shared_structs.h"
+
+// The images are the render graph's (transient), see vkapp_graph.cpp
+void VkApp::createGBuffer()
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////
+    // Render pass: the two G-buffer images, and the depth buffer
+    VkAttachmentDescription colorAttachment{};
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkAttachmentDescription posAttachment = colorAttachment;
+    posAttachment.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    VkAttachmentDescription idAttachment = colorAttachment;
+    idAttachment.format = VK_FORMAT_R32G32_UINT;
+
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format =  VK_FORMAT_X8_D24_UNORM_PACK32;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    std::array<VkAttachmentReference, 2> colorAttachmentRefs{{
+        {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
+        {1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}}};
+    VkAttachmentReference depthAttachmentRef{2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = static_cast<uint32_t>(colorAttachmentRefs.size());
+    subpass.pColorAttachments = colorAttachmentRefs.data();
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    // The previous frame's path tracer read the G-buffer; this one's reads it next.
+    VkPipelineStageFlags tracers = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    if (m_hasRtPipeline) tracers |= VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+    std::array<VkSubpassDependency, 2> dependencies{};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = tracers;
+    dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+        | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = tracers;
+    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    std::array<VkAttachmentDescription, 3> attachmentsDsc = {posAttachment, idAttachment,
+                                                             depthAttachment};
+    VkRenderPassCreateInfo renderPassInfo{VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachmentsDsc.size());
+    renderPassInfo.pAttachments = attachmentsDsc.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+
+    if (vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_gbRenderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create G-buffer render pass!");
+    }
+
+    std::vector<VkImageView> attachments = {m_gbPosBuffer.imageView, m_gbIdBuffer.imageView,
+                                            m_depthImage.imageView};
+
+    VkFramebufferCreateInfo info{VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+    info.renderPass      = m_gbRenderPass;
+    info.attachmentCount = attachments.size();
+    info.pAttachments    = attachments.data();
+    info.width           = windowSize.width;
+    info.height          = windowSize.height;
+    info.layers          = 1;
+    vkCreateFramebuffer(m_device, &info, nullptr, &m_gbFramebuffer);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////
+    // Pipeline: as the scanline pipeline, with positions only and two color outputs
+    VkPushConstantRange pushConstantRanges = {
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantGBuffer)};
+
+    VkPipelineLayoutCreateInfo createInfo{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    createInfo.setLayoutCount         = 1;
+    createInfo.pSetLayouts            = &m_scDesc.descSetLayout;
+    createInfo.pushConstantRangeCount = 1;
+    createInfo.pPushConstantRanges    = &pushConstantRanges;
+    vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_gbPipelineLayout);
+
+    VkShaderModule vertShaderModule = createShaderModule(loadFile("spv/gbuffer.vert.spv"));
+    VkShaderModule fragShaderModule = createShaderModule(loadFile("spv/gbuffer.frag.spv"));
+
+    VkPipelineShaderStageCreateInfo shaderStages[2]{};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = vertShaderModule;
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = fragShaderModule;
+    shaderStages[1].pName = "main";
+
+    VkVertexInputBindingDescription bindingDescription
+        {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX};
+    VkVertexInputAttributeDescription attributeDescription
+        {0, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, pos))};
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexAttributeDescriptionCount = 1;
+    vertexInputInfo.pVertexAttributeDescriptions = &attributeDescription;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    VkViewport viewport{0.0f, 0.0f, (float) windowSize.width, (float) windowSize.height,
+                        0.0f, 1.0f};
+    VkRect2D scissor{{0, 0}, VkExtent2D{windowSize.width, windowSize.height}};
+
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.pViewports = &viewport;
+    viewportState.scissorCount = 1;
+    viewportState.pScissors = &scissor;
+
+    // No culling: rays see back faces too
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
+        | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+    std::array<VkPipelineColorBlendAttachmentState, 2> colorBlendAttachments =
+        {colorBlendAttachment, colorBlendAttachment};
+
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.attachmentCount = static_cast<uint32_t>(colorBlendAttachments.size());
+    colorBlending.pAttachments = colorBlendAttachments.data();
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.layout = m_gbPipelineLayout;
+    pipelineInfo.renderPass = m_gbRenderPass;
+    pipelineInfo.subpass = 0;
+
+    if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+                                  &m_gbPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create G-buffer pipeline!");
+    }
+
+    vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
+    vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
+}
+
+void VkApp::destroyGBuffer()
+{
+    vkDestroyPipeline(m_device, m_gbPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_gbPipelineLayout, nullptr);
+    vkDestroyFramebuffer(m_device, m_gbFramebuffer, nullptr);
+    vkDestroyRenderPass(m_device, m_gbRenderPass, nullptr);
+}
+
+// Draw every instance, in TLAS order, into the G-buffer
+void VkApp::rasterizeGBuffer()
+{
+    VkDeviceSize offset{0};
+
+    std::array<VkClearValue, 3> clearValues{};
+    clearValues[0].color        = {{0,0,0,0}};
+    clearValues[1].color.uint32[0] = 0;  // No instance
+    clearValues[2].depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo _i{VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+    _i.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    _i.pClearValues    = clearValues.data();
+    _i.renderPass      = m_gbRenderPass;
+    _i.framebuffer     = m_gbFramebuffer;
+    _i.renderArea      = {{0, 0}, windowSize};
+    vkCmdBeginRenderPass(m_commandBuffer, &_i, VK_SUBPASS_CONTENTS_INLINE);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_gbPipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_gbPipelineLayout, 0, 1, &m_scDesc.descSet, 0, nullptr);
+
+    for (uint32_t i=0;  i<m_objInst.size();  i++) {
+        const ObjInst& inst = m_objInst[i];
+        auto& object        = m_objData[inst.objIndex];
+
+        PushConstantGBuffer pcGBuffer{inst.transform, i};
+        vkCmdPushConstants(m_commandBuffer, m_gbPipelineLayout,
+                           VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                           sizeof(PushConstantGBuffer), &pcGBuffer);
+        vkCmdBindVertexBuffers(m_commandBuffer, 0, 1, &object.vertexBuffer.buffer, &offset);
+        vkCmdBindIndexBuffer(m_commandBuffer, object.indexBuffer.buffer, 0,
+                             VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexed(m_commandBuffer, object.nbIndices, 1, 0, 0, 0); }
+
+    vkCmdEndRenderPass(m_commandBuffer);
+}
@@ -0,0 +1,107 @@
+// The frame's render graph (render_graph.h): its passes, in the order
+// drawFrame records them, and the images each reads and writes.
+//
+//   raytrace:   everything of raytrace(): the tracer, temporal pass and
+//               history copies.  Its own dispatches are still separated
+//               by barriers of their own.  The hybrid variant also
+//               draws, and reads, the G-buffer.
+//   denoise:    the A-Trous iterations, from colCurr (and its guides)
+//               into sc, through the denoise image.
+//   rasterize:  the scanline render pass, into sc.
+//   post:       reads sc, or colCurr (postSource).
+//
+// sc, the denoise image and the G-buffer are transient: written and
+// read in one frame.  The G-buffer is done before denoise starts, so
+// they share memory.  The tracer's histories, its samples and motion
+// vectors (kept where adaptive sampling skips a pixel) and the
+// moments persist across frames, each in memory of its own.
+
+#include <vector>
+
+#include "vkapp.h"
+
+void VkApp::createRenderGraph()
+{
+    typedef RenderGraph::Access Access;
+    VkPipelineStageFlags2 shaders = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;  // Ray query, wavefront, and the passes
+    if (m_hasRtPipeline)
+        shaders |= VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR;
+    const VkPipelineStageFlags2 copy    = VK_PIPELINE_STAGE_2_COPY_BIT;
+    const VkAccessFlags2 read      = VK_ACCESS_2_SHADER_READ_BIT;
+    const VkAccessFlags2 readWrite = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT;
+
+    // The transient images: created now, bound to the graph's memory
+    // once it's placed them
+    m_scImageBuffer = createBufferImage(windowSize, true);
+    m_denoiseBuffer = createBufferImage(windowSize, true);
+    m_gbPosBuffer   = createBufferImage(windowSize, true);
+    m_gbIdBuffer = createImageWrap(windowSize.width, windowSize.height, VK_FORMAT_R32G32_UINT,
+                                   VK_IMAGE_USAGE_STORAGE_BIT
+                                   | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, false);
+    m_gbIdBuffer.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    int sc      = m_graph.addImage("sc", &m_scImageBuffer, true);
+    int denoise = m_graph.addImage("denoise", &m_denoiseBuffer, true);
+    int gbPos   = m_graph.addImage("gbPos", &m_gbPosBuffer, true);
+    int gbIds   = m_graph.addImage("gbIds", &m_gbIdBuffer, true);
+
+    int colCurr    = m_graph.addImage("colCurr", &m_rtColCurrBuffer, false);
+    int colPrev    = m_graph.addImage("colPrev", &m_rtColPrevBuffer, false);
+    int ndCurr     = m_graph.addImage("ndCurr", &m_rtNdCurrBuffer, false);
+    int ndPrev     = m_graph.addImage("ndPrev", &m_rtNdPrevBuffer, false);
+    int kdCurr     = m_graph.addImage("kdCurr", &m_rtKdCurrBuffer, false);
+    int sample     = m_graph.addImage("sample", &m_rtSampleBuffer, false);
+    int motion     = m_graph.addImage("motion", &m_rtMotionBuffer, false);
+    int lumMomCurr = m_graph.addImage("lumMomCurr", &m_rtLumMomCurrBuffer, false);
+    int lumMomPrev = m_graph.addImage("lumMomPrev", &m_rtLumMomPrevBuffer, false);
+    int moments    = m_graph.addImage("moments", &m_rtMomentsBuffer, false);
+
+    // Curr images are copied to their Prev at the end
+    std::vector<Access> trace = {
+        {colCurr, shaders | copy, readWrite | VK_ACCESS_2_TRANSFER_READ_BIT},
+        {colPrev, shaders | copy, read | VK_ACCESS_2_TRANSFER_WRITE_BIT},
+        {ndCurr, shaders | copy, readWrite | VK_ACCESS_2_TRANSFER_READ_BIT},
+        {ndPrev, shaders | copy, read | VK_ACCESS_2_TRANSFER_WRITE_BIT},
+        {kdCurr, shaders, readWrite},
+        {sample, shaders, readWrite},
+        {motion, shaders, readWrite},
+        {lumMomCurr, shaders | copy, readWrite | VK_ACCESS_2_TRANSFER_READ_BIT},
+        {lumMomPrev, shaders | copy, read | VK_ACCESS_2_TRANSFER_WRITE_BIT},
+        {moments, shaders, readWrite}};
+    m_rgRaytrace = m_graph.addPass("raytrace", trace);
+
+    // Drawn, then read by the tracer
+    const VkPipelineStageFlags2 gbStages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT | shaders;
+    const VkAccessFlags2 gbAccess = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | read;
+    trace.push_back({gbPos, gbStages, gbAccess});
+    trace.push_back({gbIds, gbStages, gbAccess});
+    m_rgRaytraceHybrid = m_graph.addPass("raytrace (hybrid)", trace);
+
+    // The per-iteration schedule copies colCurr into sc first; the
+    // fused one ping-pongs between denoise and sc.  Either leaves the
+    // result in sc.
+    m_rgDenoise = m_graph.addPass("denoise", {
+        {colCurr, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | copy, read | VK_ACCESS_2_TRANSFER_READ_BIT},
+        {kdCurr, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, read},
+        {ndCurr, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, read},
+        {lumMomCurr, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, read},
+        {denoise, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | copy, readWrite | VK_ACCESS_2_TRANSFER_READ_BIT},
+        {sc, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | copy, readWrite | VK_ACCESS_2_TRANSFER_WRITE_BIT}});
+
+    m_rgRasterize = m_graph.addPass("rasterize", {
+        {sc, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT}});
+
+    // post.frag or post.comp
+    const VkPipelineStageFlags2 post = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT
+        | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    m_rgPostSc      = m_graph.addPass("post (sc)", {{sc, post, read}});
+    m_rgPostColCurr = m_graph.addPass("post (colCurr)", {{colCurr, post, read}});
+
+    // Bound: now their views
+    m_graph.allocate(m_device, m_physicalDevice);
+    for (ImageWrap* image : {&m_scImageBuffer, &m_denoiseBuffer, &m_gbPosBuffer}) {
+        image->imageView = createImageView(image->image, VK_FORMAT_R32G32B32A32_SFLOAT);
+        image->sampler   = createTextureSampler(); }
+    m_gbIdBuffer.imageView = createImageView(m_gbIdBuffer.image, VK_FORMAT_R32G32_UINT);
+}
@@ -8,6 +8,9 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <float.h>
+#include <stdint.h>
 #include <math.h>
 
 #include <filesystem>
@@ -32,17 +35,46 @@ using namespace glm;
 #include "shaders/shared_structs.h"
 
 // Local objects and procedures defined and used here:
-struct ModelData
+
+// One assimp mesh, kept in its own (untransformed) coordinate system
+// so that every node referencing it can share its buffers and BLAS.
+struct MeshData
 {
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indicies;
-    std::vector<Material> materials;
     std::vector<int32_t>     matIndx;
+};
+
+// One node's reference to a mesh, with the node's accumulated transformation.
+struct MeshInstance
+{
+    uint32_t meshIndex;
+    mat4     transform;
+};
+
+struct ModelData
+{
+    std::vector<MeshData> meshes;
+    std::vector<MeshInstance> instances;
+    std::vector<Material> materials;
     std::vector<std::string> textures;
 
-    void readAssimpFile(const std::string& path, const mat4& M);
+    bool readAssimpFile(const std::string& path, const mat4& M);
+};
+
+void readAssimpMesh(MeshData* mesh, const aiMesh* aimesh);
+
+struct ClusterStats
+{
+    size_t meshesSplit{0};
+    size_t clusters{0};
+    size_t minTriangles{SIZE_MAX};
+    size_t maxTriangles{0};
 };
 
+void clusterMesh(const MeshData& mesh, size_t maxTriangles,
+                 std::vector<MeshData>& clusters, ClusterStats& stats);
+
 void recurseModelNodes(ModelData* meshdata,
                        const  aiScene* aiscene,
                        const  aiNode* node,
@@ -57,50 +89,65 @@ VkDeviceAddress getBufferDeviceAddress(VkDevice device, VkBuffer buffer) {
     return vkGetBufferDeviceAddress(device, &info);
 }
 
-void VkApp::myloadModel(const std::string& filename, glm::mat4 transform)
+// Runs on a loader thread (see loadScene in vkapp_scene.cpp).  Parses
+// the model, posts what the renderer needs up front (lights,
+// materials, instances), then queues each object's buffers and each
+// texture as a streamed upload; applySceneUpdates adds them to the
+// scene as they arrive.  Stops early if a newer load has started.
+void VkApp::myloadModel(const std::string& filename, glm::mat4 transform, uint64_t generation)
 {
     ModelData meshdata;
-    meshdata.readAssimpFile(filename.c_str(), glm::mat4());
-
-    printf("vertices: %lld\n", meshdata.vertices.size());
-    printf("indices: %lld (%lld)\n", meshdata.indicies.size(), meshdata.indicies.size()/3);
-    printf("materials: %lld\n", meshdata.materials.size());
-    printf("matIndx: %lld\n", meshdata.matIndx.size());
-    printf("textures: %lld\n", meshdata.textures.size());
+    if (!meshdata.readAssimpFile(filename.c_str(), transform))
+        return;
+    if (generation != m_sceneGeneration) return;
+
+    size_t nbVertices = 0, nbIndices = 0;
+    for (const MeshData& mesh : meshdata.meshes) {
+        nbVertices += mesh.vertices.size();
+        nbIndices  += mesh.indicies.size(); }
+
+    printf("meshes: %zu\n", meshdata.meshes.size());
+    printf("instances: %zu\n", meshdata.instances.size());
+    printf("vertices: %zu\n", nbVertices);
+    printf("indices: %zu (%zu)\n", nbIndices, nbIndices/3);
+    printf("materials: %zu\n", meshdata.materials.size());
+    printf("textures: %zu\n", meshdata.textures.size());
     std::cout << std::endl;
 
-    for (size_t i = 0; i < meshdata.materials.size(); ++i)
+    auto load = std::make_shared<SceneLoad>();
+    load->generation = generation;
+    load->path = filename;
+
+    // The emitters are needed in world coordinates, so each instance
+    // of an emitting mesh contributes its own (transformed) triangles.
+    for (const MeshInstance& inst : meshdata.instances)
     {
-        Material& mat = meshdata.materials[i];
-        if (glm::dot(mat.emission, mat.emission) > 0.0f)
+        const MeshData& mesh = meshdata.meshes[inst.meshIndex];
+        for (size_t x = 0; x < mesh.matIndx.size();++x)
         {
-            for (size_t x = 0; x < meshdata.matIndx.size();++x)
+            const Material& mat = meshdata.materials[mesh.matIndx[x]];
+            if (glm::dot(mat.emission, mat.emission) > 0.0f)
             {
-                if (i == meshdata.matIndx[x])
-                {
-                    Emitter e;
+                Emitter e;
 
-                    size_t id_1 = meshdata.indicies[3*x+0];
-                    size_t id_2 = meshdata.indicies[3*x+1];
-                    size_t id_3 = meshdata.indicies[3*x+2];
+                size_t id_1 = mesh.indicies[3*x+0];
+                size_t id_2 = mesh.indicies[3*x+1];
+                size_t id_3 = mesh.indicies[3*x+2];
 
-                    e.v0 = meshdata.vertices[id_1].pos;
-                    e.v1 = meshdata.vertices[id_2].pos;
-                    e.v2 = meshdata.vertices[id_3].pos;
+                e.v0 = vec3(inst.transform*vec4(mesh.vertices[id_1].pos, 1.0f));
+                e.v1 = vec3(inst.transform*vec4(mesh.vertices[id_2].pos, 1.0f));
+                e.v2 = vec3(inst.transform*vec4(mesh.vertices[id_3].pos, 1.0f));
 
-                    auto crs =glm::cross(e.v1 - e.v0, e.v2 - e.v0);
-                    e.normal = glm::normalize(crs);
+                auto crs =glm::cross(e.v1 - e.v0, e.v2 - e.v0);
+                e.normal = glm::normalize(crs);
 
-                    e.index = meshdata.matIndx[x];
-                    e.emission = mat.emission;
+                e.index = mesh.matIndx[x];
+                e.emission = mat.emission;
 
-                    e.area = std::abs((crs.x + crs.y + crs.z)/2);
+                e.area = glm::length(crs)/2;  // Must match the shaders' PdfLight
 
-                    m_emitterList.emplace_back(e);
-                }
+                load->emitters.emplace_back(e);
             }
-            //mat.emission *= 5.0f;
-            
         }
     }
     
@@ -111,82 +158,183 @@ void VkApp::myloadModel(const std::string& filename, glm::mat4 transform)
     //
     // Hint: meshdata.materials[i].emission is a vec3 color of light emitted.
 
-    // @@ The raytracer will eventually need a list of lights, that is
-    // a list of triangle indices whose associated material type has a
-    // non-zero emission vec3.  Create such a list.  The vkapp.h header
-    // file has no data member for this, so create your own.
-    //
-    // Hint: Triangle i has
-    //   vertices in meshdata.vertices, indexed by [3*i], [3*i+1], [3*i+2]
-    //   and a material in meshdata.materials, indexed by meshdata.matIndx[i]
-    
-    ObjData object;
-    object.nbIndices  = static_cast<uint32_t>(meshdata.indicies.size());
-    object.nbVertices = static_cast<uint32_t>(meshdata.vertices.size());
-
-    // Create the buffers on Device and copy vertices, indices and materials
-    VkCommandBuffer    cmdBuf = createTempCmdBuffer();
+    // The texture binding has m_textureSlots slots; a material whose
+    // texture has none is drawn untextured.
+    if (meshdata.textures.size() > m_textureSlots) {
+        printf("textures: %zu, only the first %u are used\n", meshdata.textures.size(), m_textureSlots);
+        meshdata.textures.resize(m_textureSlots);
+        for (Material& mat : meshdata.materials)
+            if (mat.textureId >= int(m_textureSlots))
+                mat.textureId = -1; }
 
     VkBufferUsageFlags flag = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
         | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     VkBufferUsageFlags rtFlags = flag
         | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
-  
-    object.vertexBuffer = createStagedBufferWrap(cmdBuf, meshdata.vertices,
-                                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rtFlags);
-    object.indexBuffer = createStagedBufferWrap(cmdBuf, meshdata.indicies,
-                                        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rtFlags);
-    object.matColorBuffer = createStagedBufferWrap(cmdBuf, meshdata.materials, flag);
-    object.matIndexBuffer = createStagedBufferWrap(cmdBuf, meshdata.matIndx, flag);
-  
-    submitTempCmdBuffer(cmdBuf);
-    
-    // Creates all textures on the GPU
-    auto txtOffset = static_cast<uint32_t>(m_objText.size());  // Offset is current size
-    for(const auto& texName : meshdata.textures)
-        m_objText.push_back(createTextureImage(texName));
-
-    // Assuming one instance of an object with its supplied transform.
-    // Could provide multiple transform here to make a vector of instances of this object.
-    ObjInst instance;
-    instance.transform = transform;
-    instance.objIndex  = static_cast<uint32_t>(m_objData.size()); // Index of current object
-    m_objInst.push_back(instance);
-
-    // Creating information for device access
-    ObjDesc desc;
-    desc.txtOffset            = txtOffset;
-    desc.vertexAddress        = getBufferDeviceAddress(m_device, object.vertexBuffer.buffer);
-    desc.indexAddress         = getBufferDeviceAddress(m_device, object.indexBuffer.buffer);
-    desc.materialAddress      = getBufferDeviceAddress(m_device, object.matColorBuffer.buffer);
-    desc.materialIndexAddress = getBufferDeviceAddress(m_device, object.matIndexBuffer.buffer);
-
-    m_objData.emplace_back(object);
-    m_objDesc.emplace_back(desc);
-
-    // @@ At shutdown:
-    //   Destroy each buffer  in the m_objDesc list with:   objDesc.destroy(m_device);
+
+    // Meshes larger than this are split into spatial clusters.  The
+    // device limits bound a single BLAS geometry (maxPrimitiveCount)
+    // and a single vertex/index buffer (maxStorageBufferRange); the
+    // soft limit m_maxClusterTriangles keeps each BLAS spatially tight.
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR asProps
+        {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR};
+    VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+    prop2.pNext = &asProps;
+    vkGetPhysicalDeviceProperties2(m_physicalDevice, &prop2);
+
+    size_t maxTriangles = m_maxClusterTriangles;
+    maxTriangles = std::min<size_t>(maxTriangles, asProps.maxPrimitiveCount);
+    maxTriangles = std::min<size_t>(maxTriangles,
+                                    prop2.properties.limits.maxStorageBufferRange/(3*sizeof(Vertex)));
+
+    // One object (and later one BLAS) per unique mesh, or per cluster
+    // of a split mesh.  Meshes without triangles (points, lines) are skipped.
+    ClusterStats stats;
+    std::vector<std::vector<MeshData>> clusters(meshdata.meshes.size());
+    std::vector<std::pair<size_t, const MeshData*>> parts;  // (mesh index, mesh or cluster)
+    for (size_t m = 0; m < meshdata.meshes.size(); ++m)
+    {
+        if (meshdata.meshes[m].indicies.empty()) continue;
+
+        if (meshdata.meshes[m].matIndx.size() > maxTriangles) {
+            clusterMesh(meshdata.meshes[m], maxTriangles, clusters[m], stats);
+            for (const MeshData& cluster : clusters[m])
+                parts.push_back({m, &cluster}); }
+        else
+            parts.push_back({m, &meshdata.meshes[m]});
+    }
+
+    // One instance per node reference of a mesh (or of each of its
+    // clusters), with the node's transform.  Until the renderer has the
+    // part, objIndex is the index in parts.
+    std::vector<std::vector<uint32_t>> partIndex(meshdata.meshes.size());
+    for (uint32_t p = 0; p < parts.size(); p++)
+        partIndex[parts[p].first].push_back(p);
+    for (const MeshInstance& mi : meshdata.instances)
+    {
+        for (uint32_t p : partIndex[mi.meshIndex]) {
+            ObjInst instance;
+            instance.transform = mi.transform;
+            instance.objIndex  = p;
+            load->instances.push_back(instance); }
+    }
+
+    if (stats.meshesSplit > 0)
+        printf("clusters: %zu meshes over %zu triangles split into %zu clusters"
+               " (%zu to %zu triangles each)\n",
+               stats.meshesSplit, maxTriangles, stats.clusters,
+               stats.minTriangles, stats.maxTriangles);
+    printf("parts: %zu  instances: %zu\n", parts.size(), load->instances.size());
+
+    // The model's materials are shared by all its meshes.  The scene
+    // is posted once they've arrived; being streamed first, they (and
+    // it) arrive before any of its objects or textures.
+    Upload matUpload;
+    BufferWrap matColorBuffer = stageBuffer(matUpload, meshdata.materials, flag);
+    load->materials  = matColorBuffer;
+    load->nbParts    = static_cast<uint32_t>(parts.size());
+    load->nbTextures = static_cast<uint32_t>(meshdata.textures.size());
+    matUpload.done = [this, load]() {
+        std::lock_guard<std::mutex> lock(m_sceneMutex);
+        m_sceneLoads.push_back(load); };
+    queueUpload(std::move(matUpload), true);
+
+    // The textures are decoded on threads of their own, while this one
+    // queues the objects.  Each arrives (or stays the placeholder) on
+    // its own.
+    std::vector<std::thread> decoders;
+    unsigned nbDecoders = std::max(1u, std::min(4u, std::thread::hardware_concurrency()/2));
+    for (unsigned d = 0; d < nbDecoders && d < meshdata.textures.size(); d++)
+        decoders.emplace_back([this, &meshdata, d, nbDecoders, generation]() {
+            for (size_t t = d; t < meshdata.textures.size(); t += nbDecoders) {
+                if (generation != m_sceneGeneration) return;
+                int slot = static_cast<int>(t);
+                try {
+                    // Its coarse levels; the rest are streamed in when sampled
+                    std::shared_ptr<const TextureMips> mips = loadTextureMips(meshdata.textures[t]);
+                    int level = coarseLevel(*mips);
+                    ImageWrap image = createStreamedImage(*mips);
+                    int nbLevels = static_cast<int>(mips->levels.size());
+                    uploadTextureLevels(*mips, image.image, level, nbLevels, true,
+                                        [this, generation, slot, mips, level, image]() {
+                        SceneArrival arrival;
+                        arrival.generation = generation;
+                        arrival.texture    = slot;
+                        arrival.image      = image;
+                        arrival.mips       = mips;
+                        arrival.level      = level;
+                        std::lock_guard<std::mutex> lock(m_sceneMutex);
+                        m_sceneArrivals.push_back(arrival); }); }
+                catch (const std::exception& e) {
+                    printf("Texture %s: %s\n", meshdata.textures[t].c_str(), e.what()); } } });
+
+    for (uint32_t p = 0; p < parts.size() && generation == m_sceneGeneration; p++)
+    {
+        const MeshData& mesh = *parts[p].second;
+
+        ObjData object;
+        object.nbIndices  = static_cast<uint32_t>(mesh.indicies.size());
+        object.nbVertices = static_cast<uint32_t>(mesh.vertices.size());
+        object.transform  = glm::mat4(1.0);
+
+        Upload upload;
+        object.vertexBuffer = stageBuffer(upload, mesh.vertices,
+                                          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rtFlags);
+        object.indexBuffer = stageBuffer(upload, mesh.indicies,
+                                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rtFlags);
+        object.matIndexBuffer = stageBuffer(upload, mesh.matIndx, flag);
+
+        // Creating information for device access
+        ObjDesc desc;
+        desc.txtOffset            = 0;  // One model per scene
+        desc.vertexAddress        = getBufferDeviceAddress(m_device, object.vertexBuffer.buffer);
+        desc.indexAddress         = getBufferDeviceAddress(m_device, object.indexBuffer.buffer);
+        desc.materialAddress      = getBufferDeviceAddress(m_device, matColorBuffer.buffer);
+        desc.materialIndexAddress = getBufferDeviceAddress(m_device, object.matIndexBuffer.buffer);
+
+        upload.done = [this, generation, p, object, desc]() {
+            SceneArrival arrival;
+            arrival.generation = generation;
+            arrival.part       = static_cast<int>(p);
+            arrival.object     = object;
+            arrival.desc       = desc;
+            std::lock_guard<std::mutex> lock(m_sceneMutex);
+            m_sceneArrivals.push_back(arrival); };
+        queueUpload(std::move(upload), true);
+    }
+
+    for (std::thread& decoder : decoders)
+        decoder.join();
 }
 
+// From m_emitterList.  A scene without emitters (or none yet) gets one
+// that emits nothing, so the lights buffer isn't empty and the shaders'
+// light sampling stays finite.
 void VkApp::createLightbuffer()
 {
+    if (m_emitterList.empty()) {
+        Emitter none{};
+        none.normal = vec3(0, 0, 1);
+        none.area   = 1.0f;
+        m_emitterList.push_back(none); }
+
     VkCommandBuffer cmdbuf = createTempCmdBuffer();
     //m_lightBuffer = createStagedBufferWrap(cmdbuf,sizeof(Emitter) * m_emitterList.size(),m_emitterList.data(),
     //    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
     //    | VK_BUFFER_USAGE_TRANSFER_DST_BIT
     //);
 
-    m_lightBuffer = createBufferWrap(sizeof(Emitter) * m_emitterList.size(), 
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT| VK_BUFFER_USAGE_TRANSFER_DST_BIT
-        , VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    
-    vkCmdUpdateBuffer(cmdbuf, m_lightBuffer.buffer, 0,
-        m_emitterList.size() * sizeof(Emitter), m_emitterList.data());
+    // Staged like the meshes, by the uploader (vkCmdUpdateBuffer needs
+    // the graphics queue, and stops at 64KB)
+    m_lightBuffer = createStagedBufferWrap(cmdbuf, m_emitterList,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT| VK_BUFFER_USAGE_TRANSFER_DST_BIT);
     
     submitTempCmdBuffer(cmdbuf);
 }
 
-void ModelData::readAssimpFile(const std::string& path, const mat4& M)
+// False if the file can't be read (a scene loaded at run time mustn't
+// take the app down with it).
+bool ModelData::readAssimpFile(const std::string& path, const mat4& M)
 {
     printf("ReadAssimpFile File:  %s \n", path.c_str());
   
@@ -199,7 +347,7 @@ void ModelData::readAssimpFile(const std::string& path, const mat4& M)
     std::ifstream find_it(path.c_str());
     if (find_it.fail()) {
         std::cerr << "File not found: "  << path << std::endl;
-        exit(-1); }
+        return false; }
 
     // Invoke assimp to read the file.
     printf("Assimp %d.%d Reading %s\n", aiGetVersionMajor(), aiGetVersionMinor(), path.c_str());
@@ -209,11 +357,11 @@ void ModelData::readAssimpFile(const std::string& path, const mat4& M)
     
     if (!aiscene) {
         printf("... Failed to read.\n");
-        exit(-1); }
+        return false; }
 
     if (!aiscene->mRootNode) {
         printf("Scene has no rootnode.\n");
-        exit(-1); }
+        return false; }
 
     printf("Assimp mNumMeshes: %d\n", aiscene->mNumMeshes);
     printf("Assimp mNumMaterials: %d\n", aiscene->mNumMaterials);
@@ -264,15 +412,158 @@ void ModelData::readAssimpFile(const std::string& path, const mat4& M)
         materials.push_back(newmat);
     }
     
+    // Each mesh is converted exactly once ...
+    meshes.resize(aiscene->mNumMeshes);
+    for (unsigned int m=0;  m<aiscene->mNumMeshes;  m++)
+        readAssimpMesh(&meshes[m], aiscene->mMeshes[m]);
+
+    // ... and then instanced by every node that references it.
     recurseModelNodes(this, aiscene, aiscene->mRootNode, modelTr);
+    return true;
+}
 
+// Converts one assimp mesh, recording its vertex/normal/texture data
+// and triangle indices in the mesh's own coordinate system.
+void readAssimpMesh(MeshData* mesh, const aiMesh* aimesh)
+{
+    for (unsigned int t=0;  t<aimesh->mNumVertices;  ++t) {
+        aiVector3D aipnt = aimesh->mVertices[t];
+        aiVector3D ainrm = aimesh->HasNormals() ? aimesh->mNormals[t] : aiVector3D(0,0,1);
+        aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0,0,0);
+
+        mesh->vertices.push_back({{aipnt.x, aipnt.y, aipnt.z},
+                                  {ainrm.x, ainrm.y, ainrm.z},
+                                  {aitex.x, aitex.y}});
+    }
+        
+    // Loop through all faces, recording indices
+    for (unsigned int t=0;  t<aimesh->mNumFaces;  ++t) {
+        aiFace* aiface = &aimesh->mFaces[t];
+        for (int i=2;  i<aiface->mNumIndices;  i++) {
+            mesh->matIndx.push_back(aimesh->mMaterialIndex);
+            mesh->indicies.push_back(aiface->mIndices[0]);
+            mesh->indicies.push_back(aiface->mIndices[i-1]);
+            mesh->indicies.push_back(aiface->mIndices[i]); } }
+}
+
+// Spreads the low 10 bits of v so that there are two zero bits
+// between each, for interleaving into a 30 bit Morton code.
+static uint32_t expandBits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+struct ClusterBox
+{
+    vec3 lo{ FLT_MAX};
+    vec3 hi{-FLT_MAX};
+    void grow(const vec3& p) { lo = glm::min(lo, p);  hi = glm::max(hi, p); }
+    void grow(const ClusterBox& b) { lo = glm::min(lo, b.lo);  hi = glm::max(hi, b.hi); }
+    float area() const {
+        if (lo.x > hi.x) return 0.0f;
+        vec3 d = hi - lo;
+        return 2.0f*(d.x*d.y + d.y*d.z + d.z*d.x); }
+};
+
+// Splits a mesh into clusters of at most maxTriangles triangles.
+// Triangles are first ordered along a Morton curve through their
+// centroids so that any contiguous range is spatially coherent.  A
+// range that is too large is split where the surface area heuristic
+// (SAH) over the two halves' bounding boxes is lowest; the split is
+// kept within the middle half of the range so the recursion stays
+// shallow.  Each cluster gets its own compacted vertex list, and keeps
+// the original per-triangle material index.
+void clusterMesh(const MeshData& mesh, size_t maxTriangles,
+                 std::vector<MeshData>& clusters, ClusterStats& stats)
+{
+    const size_t nbTri = mesh.matIndx.size();
+    
+    // Triangle bounds and centroids
+    std::vector<ClusterBox> triBox(nbTri);
+    ClusterBox centroidBox;
+    for (size_t t = 0; t < nbTri; ++t) {
+        for (int k = 0; k < 3; ++k)
+            triBox[t].grow(mesh.vertices[mesh.indicies[3*t+k]].pos);
+        centroidBox.grow(0.5f*(triBox[t].lo + triBox[t].hi)); }
+
+    // Order the triangles along the Morton curve
+    vec3 extent = glm::max(centroidBox.hi - centroidBox.lo, vec3(1e-20f));
+    std::vector<std::pair<uint32_t, uint32_t>> order(nbTri);
+    for (size_t t = 0; t < nbTri; ++t) {
+        vec3 c = (0.5f*(triBox[t].lo + triBox[t].hi) - centroidBox.lo) / extent;
+        uvec3 q = uvec3(glm::clamp(c*1023.0f, vec3(0.0f), vec3(1023.0f)));
+        uint32_t code = (expandBits(q.x)<<2) | (expandBits(q.y)<<1) | expandBits(q.z);
+        order[t] = {code, static_cast<uint32_t>(t)}; }
+    std::sort(order.begin(), order.end());
+
+    // Recursively split [begin,end) ranges of that order.
+    std::vector<ClusterBox> leftBox(nbTri+1), rightBox(nbTri+1);
+    std::vector<std::pair<size_t, size_t>> ranges;
+    std::vector<std::pair<size_t, size_t>> stack{{0, nbTri}};
+    while (!stack.empty()) {
+        auto [begin, end] = stack.back();
+        stack.pop_back();
+        size_t n = end - begin;
+        if (n <= maxTriangles) {
+            ranges.push_back({begin, end});
+            continue; }
+
+        // Sweep bounding boxes from both ends of the range.
+        leftBox[0] = ClusterBox();
+        for (size_t i = 0; i < n; ++i) {
+            leftBox[i+1] = leftBox[i];
+            leftBox[i+1].grow(triBox[order[begin+i].second]); }
+        rightBox[n] = ClusterBox();
+        for (size_t i = n; i > 0; --i) {
+            rightBox[i-1] = rightBox[i];
+            rightBox[i-1].grow(triBox[order[begin+i-1].second]); }
+
+        size_t best = n/2;
+        float bestCost = FLT_MAX;
+        for (size_t i = n/4; i <= 3*n/4; ++i) {
+            float cost = leftBox[i].area()*i + rightBox[i].area()*(n-i);
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = i; } }
+
+        stack.push_back({begin+best, end});
+        stack.push_back({begin, begin+best}); }
+
+    // Build each cluster's compacted vertex and index lists.
+    std::vector<int32_t> remap(mesh.vertices.size(), -1);
+    for (auto [begin, end] : ranges) {
+        MeshData cluster;
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t t = order[i].second;
+            for (int k = 0; k < 3; ++k) {
+                uint32_t v = mesh.indicies[3*t+k];
+                if (remap[v] < 0) {
+                    remap[v] = static_cast<int32_t>(cluster.vertices.size());
+                    cluster.vertices.push_back(mesh.vertices[v]); }
+                cluster.indicies.push_back(remap[v]); }
+            cluster.matIndx.push_back(mesh.matIndx[t]); }
+
+        // Reset only the entries this cluster touched
+        for (size_t i = begin; i < end; ++i)
+            for (int k = 0; k < 3; ++k)
+                remap[mesh.indicies[3*order[i].second+k]] = -1;
+
+        stats.minTriangles = std::min(stats.minTriangles, end-begin);
+        stats.maxTriangles = std::max(stats.maxTriangles, end-begin);
+        clusters.push_back(std::move(cluster)); }
+
+    stats.meshesSplit++;
+    stats.clusters += ranges.size();
 }
 
 // Recursively traverses the assimp node hierarchy, accumulating
-// modeling transformations, and creating and transforming any meshes
-// found.  Meshes comming from assimp can have associated surface
-// properties, so each mesh *copies* the current BRDF as a starting
-// point and modifies it from the assimp data structure.
+// modeling transformations.  Each reference to a mesh found along the
+// way is recorded as an instance of that mesh with the accumulated
+// transformation, rather than as a transformed copy of the mesh.
 void recurseModelNodes(ModelData* meshdata,
                        const aiScene* aiscene,
                        const aiNode* node,
@@ -285,38 +576,16 @@ void recurseModelNodes(ModelData* meshdata,
 
     // Accumulating transformations while traversing down the hierarchy.
     aiMatrix4x4 childTr = parentTr*node->mTransformation;
-    aiMatrix3x3 normalTr = aiMatrix3x3(childTr); // Really should be inverse-transpose for full generality
+
+    // aiMatrix4x4 is row-major, glm::mat4 is column-major.
+    mat4 M;
+    for (int r=0;  r<4;  r++)
+        for (int c=0;  c<4;  c++)
+            M[c][r] = childTr[r][c];
      
     // Loop through this node's meshes
-    for (unsigned int m=0;  m<node->mNumMeshes; ++m) {
-        aiMesh* aimesh = aiscene->mMeshes[node->mMeshes[m]];
-        //printf("  %d: %d:%d\n", m, aimesh->mNumVertices, aimesh->mNumFaces);
-
-        // Loop through all vertices and record the
-        // vertex/normal/texture/tangent data with the node's model
-        // transformation applied.
-        uint faceOffset = meshdata->vertices.size();
-        for (unsigned int t=0;  t<aimesh->mNumVertices;  ++t) {
-            aiVector3D aipnt = childTr*aimesh->mVertices[t];
-            aiVector3D ainrm = aimesh->HasNormals() ? normalTr*aimesh->mNormals[t] : aiVector3D(0,0,1);
-            aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0,0,0);
-            aiVector3D aitan = aimesh->HasTangentsAndBitangents() ? normalTr*aimesh->mTangents[t] :  aiVector3D(1,0,0);
-
-
-            meshdata->vertices.push_back({{aipnt.x, aipnt.y, aipnt.z},
-                                          {ainrm.x, ainrm.y, ainrm.z},
-                                          {aitex.x, aitex.y}});
-        }
-        
-        // Loop through all faces, recording indices
-        for (unsigned int t=0;  t<aimesh->mNumFaces;  ++t) {
-            aiFace* aiface = &aimesh->mFaces[t];
-            for (int i=2;  i<aiface->mNumIndices;  i++) {
-                meshdata->matIndx.push_back(aimesh->mMaterialIndex);
-                meshdata->indicies.push_back(aiface->mIndices[0]+faceOffset);
-                meshdata->indicies.push_back(aiface->mIndices[i-1]+faceOffset);
-                meshdata->indicies.push_back(aiface->mIndices[i]+faceOffset); } }; }
-
+    for (unsigned int m=0;  m<node->mNumMeshes; ++m)
+        meshdata->instances.push_back({node->mMeshes[m], M});
 
     // Recurse onto this node's children
     for (unsigned int i=0;  i<node->mNumChildren;  ++i)
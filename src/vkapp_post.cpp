@@ -0,0 +1,113 @@
+// Post (the tone mapper) as a compute pass.
+//
+//   render pass:  post.frag on a fullscreen triangle, into the
+//                 swapchain image as a color attachment.  Always
+//                 available.
+//   compute:      post.comp writes the swapchain image as a storage
+//                 image, with no render pass -- where the surface
+//                 allows VK_IMAGE_USAGE_STORAGE_BIT on its images and
+//                 the device can store to their format.
+//
+// Either reads the image to show straight from where it was made
+// (postSource): the scanline pass's or the denoiser's m_scImageBuffer,
+// or the temporal pass's colCurr when there's no denoising; so the ray
+// tracer no longer copies colCurr to m_scImageBuffer each frame.
+
+#include <vector>
+
+#include "vkapp.h"
+
+#include "shaders/shared_structs.h"
+
+// Can the swapchain's images, of this format, be written by post.comp?
+bool VkApp::storageSwapchainSupported(const VkSurfaceCapabilitiesKHR& capabilities, VkFormat format)
+{
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(m_physicalDevice, format, &formatProperties);
+
+    // The swapchain's formats have no GLSL format qualifier, so stores
+    // are without one
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(m_physicalDevice, &features);
+
+    bool supported = (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT)
+        && (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)
+        && features.shaderStorageImageWriteWithoutFormat;
+    printf("Storage swapchain: %s\n", supported ? "yes, post in compute" : "no, post in a render pass");
+    return supported;
+}
+
+// Shares post.frag's pipeline layout: its descriptor set has the
+// swapchain image too, and its push constants reach both stages.
+void VkApp::createPostComputePipeline()
+{
+    if (!m_storageSwapchain)
+        return;
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_postPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/post.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr,
+                             &m_postComputePipeline);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+// The image post shows this frame: POST_SOURCE_*
+int VkApp::postSource()
+{
+    if (useRaytracer && !(useDenoise && m_num_atrous_iterations > 0))
+        return POST_SOURCE_COLCURR;
+    return POST_SOURCE_SC;  // Rasterized, or denoised
+}
+
+void VkApp::postCompute()
+{
+    // This frame's swapchain image.  The last frame's command buffer
+    // has finished (prepareFrame waited on its fence), so the set can
+    // be rewritten.
+    VkDescriptorImageInfo swapchainImage{VK_NULL_HANDLE, m_imageViews[m_swapchainIndex],
+                                         VK_IMAGE_LAYOUT_GENERAL};
+    m_postDesc.write(m_device, PostBindings::ePostSwapchain, swapchainImage);
+
+    // The swapchain image, to GENERAL for the stores; its old contents
+    // are discarded.  The source stage is the one submitFrame's wait on
+    // the acquire semaphore blocks, so the stores also wait for it.
+    VkImageMemoryBarrier imageBarrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    imageBarrier.srcAccessMask       = 0;
+    imageBarrier.dstAccessMask       = VK_ACCESS_SHADER_WRITE_BIT;
+    imageBarrier.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageBarrier.newLayout           = VK_IMAGE_LAYOUT_GENERAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image               = m_swapchainImages[m_swapchainIndex];
+    imageBarrier.subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_postComputePipeline);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_postPipelineLayout, 0, 1, &m_postDesc.descSet, 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_postPipelineLayout,
+                       VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(PushConstantPost), &m_pcPost);
+    vkCmdDispatch(m_commandBuffer, (windowSize.width + POST_TILE - 1)/POST_TILE,
+                  (windowSize.height + POST_TILE - 1)/POST_TILE, 1);
+
+    // On to the GUI's render pass (which loads the image as a color
+    // attachment), or to presentation
+#ifdef GUI
+    imageBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarrier.newLayout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+#else
+    imageBarrier.dstAccessMask = 0;
+    imageBarrier.newLayout     = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+#endif
+    imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    imageBarrier.oldLayout     = VK_IMAGE_LAYOUT_GENERAL;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage,
+                         0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+}
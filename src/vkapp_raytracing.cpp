@@ -29,34 +29,55 @@ void VkApp::createRtBuffers()
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL, 1);
 
-    m_rtNdCurrBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtNdCurrBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+    createScreenTargets();  // Nd, Kd and the samples, at their formats (vkapp_formats.cpp)
+
+    m_rtMotionBuffer = createBufferImage(windowSize);
+    transitionImageLayout(m_rtMotionBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL, 1);
 
-    m_rtNdPrevBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtNdPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+    m_rtLumMomCurrBuffer = createBufferImage(windowSize);
+    transitionImageLayout(m_rtLumMomCurrBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL, 1);
 
-    m_rtKdCurrBuffer = createBufferImage(windowSize);
-    transitionImageLayout(m_rtKdCurrBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
+    m_rtLumMomPrevBuffer = createBufferImage(windowSize);
+    transitionImageLayout(m_rtLumMomPrevBuffer.image, VK_FORMAT_R32G32B32A32_SFLOAT,
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL, 1);
 
+    // Empty reservoirs (M=0) so the first frame has nothing to reuse
+    VkDeviceSize reservoirSize = 2 * sizeof(Reservoir) * windowSize.width * windowSize.height;
+    m_reservoirBW = createBufferWrap(reservoirSize,
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                                     | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    vkCmdFillBuffer(cmdBuf, m_reservoirBW.buffer, 0, reservoirSize, 0);
+    submitTempCmdBuffer(cmdBuf);
+
 }
 
 // Initialize ray tracing
 void VkApp::initRayTracing()
 {
 
-    m_pcRay.rr = 0.8f;
+    m_pcRay.rr = 0.95f;
+    m_pcRay.minDepth = 3;
+    m_pcRay.maxDepth = 16;
+    m_pcRay.mis = eMisPower;
+    m_pcRay.restirCandidates = 8;
+    m_pcRay.adaptiveThreshold = 0.02f;
+    m_pcRay.adaptiveMaxSpp = 4;
+    m_pcRay.adaptiveMinSamples = 16;
+    m_pcRay.historyCap = 32;
 
     // Requesting ray tracing properties
     VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtProps
         {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
-    prop2.pNext = &rtProps;
+    if (m_hasRtPipeline)
+        prop2.pNext = &rtProps;  // Only meaningful if the device supports the extension
     vkGetPhysicalDeviceProperties2(m_physicalDevice, &prop2);
 
     handleSize      = rtProps.shaderGroupHandleSize;
@@ -76,21 +97,42 @@ void VkApp::createRtDescriptorSet()
 
     m_rtDesc.setBindings(m_device, {
             {RtBindings::eTlas, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1,  // TLAS
-             VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR},
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
+             | VK_SHADER_STAGE_COMPUTE_BIT},
             {RtBindings::eOutCurrImage, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,  // Output 4 images
-             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
             {RtBindings::eLights, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
             VK_SHADER_STAGE_RAYGEN_BIT_KHR 
-            | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT},
+            | VK_SHADER_STAGE_COMPUTE_BIT},
 
             {RtBindings::eOutPrevImage, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
-            VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
             {RtBindings::eOutCurrNd, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
-            VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
             {RtBindings::eOutPrevNd, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
-            VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
             {RtBindings::eOutCurrKd, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
-            VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eReservoirs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eSamplerTables, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eMoments, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eAdaptiveList, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eGbPos, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eGbIds, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eSampleCurr, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eMotion, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eLumMomCurr, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
+            {RtBindings::eLumMomPrev, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,
+            VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT},
         });
     
 
@@ -101,11 +143,49 @@ void VkApp::createRtDescriptorSet()
     m_rtDesc.write(m_device, RtBindings::eOutCurrNd, m_rtNdCurrBuffer.Descriptor());
     m_rtDesc.write(m_device, RtBindings::eOutPrevNd, m_rtNdPrevBuffer.Descriptor());
     m_rtDesc.write(m_device, RtBindings::eOutCurrKd, m_rtKdCurrBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eReservoirs, m_reservoirBW.buffer);
+    m_rtDesc.write(m_device, RtBindings::eSamplerTables, m_samplerBW.buffer);
+    m_rtDesc.write(m_device, RtBindings::eMoments, m_rtMomentsBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eAdaptiveList, m_adaptiveListBW.buffer);
+    m_rtDesc.write(m_device, RtBindings::eGbPos, m_gbPosBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eGbIds, m_gbIdBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eSampleCurr, m_rtSampleBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eMotion, m_rtMotionBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eLumMomCurr, m_rtLumMomCurrBuffer.Descriptor());
+    m_rtDesc.write(m_device, RtBindings::eLumMomPrev, m_rtLumMomPrevBuffer.Descriptor());
 }
 
 // Pipeline for the ray tracer: all shaders, raygen, chit, miss
 //
 void VkApp::createRtPipeline()
+{
+    ////////////////////////////////////////////////////////////////////////////////////////////
+    // Create the ray tracing pipeline layout.
+    // Push constant: we want to be able to update constants used by the shaders
+    VkPushConstantRange pushConstant{VK_SHADER_STAGE_RAYGEN_BIT_KHR
+        | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
+        0, sizeof(PushConstantRay)};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
+        {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges    = &pushConstant;
+
+    // Descriptor sets: one specific to ray tracing, and one shared with the rasterization pipeline
+    std::vector<VkDescriptorSetLayout> rtDescSetLayouts =
+        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout};
+    pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(rtDescSetLayouts.size());
+    pipelineLayoutCreateInfo.pSetLayouts = rtDescSetLayouts.data();
+
+    vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_rtPipelineLayout);
+
+    m_rtPipeline = buildRtPipeline(nullptr);
+}
+
+// The ray tracing pipeline's shaders and groups, with spec (if any)
+// fixing the feature toggles of a variant; see vkapp_variants.cpp.
+//
+VkPipeline VkApp::buildRtPipeline(const VkSpecializationInfo* spec)
 {
     ////////////////////////////////////////////////////////////////////////////////////////////
     // stages: Array of shaders: 1 raygen, 1 miss, 1 hit (later: an additional hit/miss pair.)
@@ -120,6 +200,7 @@ void VkApp::createRtPipeline()
 
     VkPipelineShaderStageCreateInfo stage{VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
     stage.pName = "main";  // All the same entry point
+    stage.pSpecializationInfo = spec;  // Feature toggles of a variant, if any
 
     VkRayTracingShaderGroupCreateInfoKHR group
         {VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR};
@@ -167,26 +248,6 @@ void VkApp::createRtPipeline()
     groups.push_back(group);
 
 
-    ////////////////////////////////////////////////////////////////////////////////////////////
-    // Create the ray tracing pipeline layout.
-    // Push constant: we want to be able to update constants used by the shaders
-    VkPushConstantRange pushConstant{VK_SHADER_STAGE_RAYGEN_BIT_KHR
-        | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
-        0, sizeof(PushConstantRay)};
-
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
-        {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-    pipelineLayoutCreateInfo.pPushConstantRanges    = &pushConstant;
-
-    // Descriptor sets: one specific to ray tracing, and one shared with the rasterization pipeline
-    std::vector<VkDescriptorSetLayout> rtDescSetLayouts =
-        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout};
-    pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(rtDescSetLayouts.size());
-    pipelineLayoutCreateInfo.pSetLayouts = rtDescSetLayouts.data();
-
-    vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_rtPipelineLayout);
-
     ////////////////////////////////////////////////////////////////////////////////////////////
     // Create the ray tracing pipeline.
     // Assemble the shader stages and recursion depth info into the ray tracing pipeline
@@ -201,10 +262,48 @@ void VkApp::createRtPipeline()
     rayPipelineInfo.maxPipelineRayRecursionDepth = 10;  // Ray depth
     rayPipelineInfo.layout                       = m_rtPipelineLayout;
 
-    vkCreateRayTracingPipelinesKHR(m_device, {}, {}, 1, &rayPipelineInfo, nullptr, &m_rtPipeline);
+    VkPipeline pipeline{};
+    vkCreateRayTracingPipelinesKHR(m_device, {}, m_pipelineCache, 1, &rayPipelineInfo, nullptr,
+                                   &pipeline);
     for (auto& s : stages)
         vkDestroyShaderModule(m_device, s.module, nullptr);
 
+    return pipeline;
+}
+
+// Pipeline for the ray query backend: a single compute shader, with
+// the same descriptor sets and push constant as the ray tracing pipeline.
+//
+void VkApp::createRqPipeline()
+{
+    VkPushConstantRange pushConstant{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantRay)};
+
+    std::vector<VkDescriptorSetLayout> descSetLayouts =
+        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
+        {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges    = &pushConstant;
+    pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descSetLayouts.size());
+    pipelineLayoutCreateInfo.pSetLayouts    = descSetLayouts.data();
+    vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_rqPipelineLayout);
+
+    m_rqPipeline = buildRqPipeline(nullptr);
+}
+
+VkPipeline VkApp::buildRqPipeline(const VkSpecializationInfo* spec)
+{
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_rqPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/raytrace.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    cpCreateInfo.stage.pSpecializationInfo = spec;
+
+    VkPipeline pipeline{};
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr, &pipeline);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+    return pipeline;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -217,12 +316,13 @@ constexpr integral align_up(integral x, size_t a) noexcept
     return integral((x + (integral(a) - 1)) & ~integral(a - 1));
 }
 
+// Groups in the SBT, in the order createRtPipeline makes them
+static const uint32_t missCount{2};
+static const uint32_t hitCount{1};
+static const uint32_t handleCount = 1 + missCount + hitCount;
+
 void VkApp::createRtShaderBindingTable()
 {
-    uint32_t missCount{2};
-    uint32_t hitCount{1};
-    auto     handleCount = 1 + missCount + hitCount;
-
     // The SBT (buffer) needs to have starting group to be aligned
     // and handles in the group to be aligned.
     uint32_t handleSizeAligned = align_up(handleSize, handleAlignment);  // handleAlignment==32
@@ -250,14 +350,6 @@ void VkApp::createRtShaderBindingTable()
     printf("    hit  %2ld:%2ld\n", m_hitRegion.stride,  m_hitRegion.size);
     printf("    call %2ld:%2ld\n", m_callRegion.stride, m_callRegion.size);
 
-    // Get the shader group handles.  This is a byte array retrieved
-    // from the pipeline.
-    uint32_t             dataSize = handleCount * handleSize;
-    std::vector<uint8_t> handles(dataSize);
-    auto result = vkGetRayTracingShaderGroupHandlesKHR(m_device, m_rtPipeline,
-                                                       0, handleCount, dataSize, handles.data());
-    assert(result == VK_SUCCESS);
-
     // Allocate a buffer for storing the SBT, and a staging buffer for transferring data to it.
     VkDeviceSize sbtSize = m_rgenRegion.size + m_missRegion.size
         + m_hitRegion.size + m_callRegion.size;
@@ -280,13 +372,35 @@ void VkApp::createRtShaderBindingTable()
     m_missRegion.deviceAddress = sbtAddress + m_rgenRegion.size;
     m_hitRegion.deviceAddress  = sbtAddress + m_rgenRegion.size + m_missRegion.size;
 
-    // Helper to retrieve the handle data
-    auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
-
     // Map the SBT buffer and write in the handles.
     uint8_t* mappedMemAddress;
     vkMapMemory(m_device, staging.memory, 0, sbtSize, 0, (void**)&mappedMemAddress);
-    uint8_t offset = 0;
+    writeShaderBindingTable(m_rtPipeline, mappedMemAddress);
+    vkUnmapMemory(m_device, staging.memory);
+    
+    copyBuffer(staging.buffer, m_shaderBindingTableBW.buffer, sbtSize);
+
+    staging.destroy(m_device);
+
+    // @@ destroy acceleration structure with m_shaderBindingTableBW.destroy(m_device);
+}
+
+// Write a pipeline's shader group handles into (mapped) SBT memory,
+// laid out by the regions' sizes and strides.
+void VkApp::writeShaderBindingTable(VkPipeline pipeline, uint8_t* mappedMemAddress)
+{
+    // Get the shader group handles.  This is a byte array retrieved
+    // from the pipeline.
+    uint32_t             dataSize = handleCount * handleSize;
+    std::vector<uint8_t> handles(dataSize);
+    auto result = vkGetRayTracingShaderGroupHandlesKHR(m_device, pipeline,
+                                                       0, handleCount, dataSize, handles.data());
+    assert(result == VK_SUCCESS);
+
+    // Helper to retrieve the handle data
+    auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
+
+    VkDeviceSize offset = 0;
 
     // Raygen
     uint32_t handleIdx{0};
@@ -303,14 +417,6 @@ void VkApp::createRtShaderBindingTable()
     for(uint32_t c = 0; c < hitCount; c++) {
         memcpy(mappedMemAddress+offset, getHandle(handleIdx++), handleSize);
         offset += m_hitRegion.stride; }
-
-    vkUnmapMemory(m_device, staging.memory);
-    
-    copyBuffer(staging.buffer, m_shaderBindingTableBW.buffer, sbtSize);
-
-    staging.destroy(m_device);
-
-    // @@ destroy acceleration structure with m_shaderBindingTableBW.destroy(m_device);
 }
 
 void VkApp::raytrace()
@@ -331,6 +437,25 @@ void VkApp::raytrace()
         m_pcRay.moved = true;
         prevUseDenoise = useDenoise;
     }
+    if (prevRtBackend != rtBackend)
+    {
+        // Both backends converge to the same image, but restart anyway
+        // so the two can be compared from a clean accumulation.
+        m_pcRay.moved = true;
+        prevRtBackend = rtBackend;
+    }
+    if (prevSampler != sampler)
+    {
+        // Samples from different samplers don't stratify together
+        m_pcRay.moved = true;
+        prevSampler = sampler;
+    }
+    if (m_sceneChanged)
+    {
+        // Objects or textures streamed in, or a new scene
+        m_pcRay.moved = true;
+        m_sceneChanged = false;
+    }
 
     if (m_pcRay.moved)
     {
@@ -338,15 +463,75 @@ void VkApp::raytrace()
     }
     app->myCamera.moved = false;
     ++currIterations;
-    m_pcRay.frameSeed = rand() % 32768;
-    m_pcRay.depth=1;
+    // The Sobol samplers index the pixel's sequence by the accumulated
+    // sample count, so the first samples after a reset are the best
+    // stratified ones.  The random sampler just needs a fresh seed.
+    m_pcRay.sampler = sampler;
+    m_pcRay.sampleIndex = uint(currIterations - 1);
+    m_pcRay.frameSeed = int(m_frameRng());
     m_pcRay.ExplicitLightRays = useExplicit;
+    m_pcRay.useRestir = useRestir;
+    m_pcRay.frame++;  // Its parity selects the current half of the reservoirs
     m_pcRay.n_threshold = f_nThreshold;
     m_pcRay.d_threshold = f_dThreshold;
-    while (float(rand())/RAND_MAX < m_pcRay.rr)   m_pcRay.depth++;
+
+    // A backend the device can't run falls back to one it can.
+    if (rtBackend == eRayQuery && !m_hasRayQuery) rtBackend = eMegakernel;
+    if (rtBackend != eRayQuery && !m_hasRtPipeline) rtBackend = eRayQuery;
+
+    // Hybrid: rasterize the camera rays' hits instead of tracing them
+    m_pcRay.hybrid = useHybrid && rtBackend != eWavefront;
+    m_graph.begin(m_commandBuffer, m_pcRay.hybrid ? m_rgRaytraceHybrid : m_rgRaytrace);
+
+    // Adaptive sampling once every pixel has enough samples to estimate
+    // its error; a moving camera restarts them all anyway.
+    m_pcRay.adaptive = useAdaptive && rtBackend != eWavefront && !m_pcRay.moved
+        && currIterations > size_t(m_pcRay.adaptiveMinSamples);
+    if (m_pcRay.adaptive)
+        buildAdaptiveList();
+
+    if (m_pcRay.hybrid)
+        rasterizeGBuffer();
+
+    // Checkerboard: trace half the pixels, and reconstruct the others
+    m_pcRay.checkerboard = useCheckerboard && rtBackend != eWavefront && !m_pcRay.adaptive;
+
+    if (rtBackend == eWavefront)
+        raytraceWavefront();
+    else if (rtBackend == eRayQuery)
+        raytraceRayQuery();
+    else
+        raytraceMegakernel();
+
+    if (m_pcRay.checkerboard)
+        reconstructCheckerboard();
+
+    // Blend the frame's samples into the reprojected history
+    temporalAccumulate();
+
+    // The history for the next frame, once temporal.comp's written it
+    // and the tracer's read the last.  The next frame's graph barrier
+    // waits on the copies.
+    VkPipelineStageFlags2 writers = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    if (m_hasRtPipeline) writers |= VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR;
+    CmdCopyImages(m_commandBuffer, {{&m_rtColCurrBuffer, &m_rtColPrevBuffer},
+                                    {&m_rtNdCurrBuffer, &m_rtNdPrevBuffer},
+                                    {&m_rtLumMomCurrBuffer, &m_rtLumMomPrevBuffer}},
+                  windowSize, writers, 0);
+}
+
+void VkApp::raytraceMegakernel()
+{
+    // The variant specialized for the current toggles, once it's
+    // built; the generic pipeline and its SBT until then.
+    VkPipeline pipeline = m_rtPipeline;
+    VkStridedDeviceAddressRegionKHR rgen = m_rgenRegion, miss = m_missRegion, hit = m_hitRegion;
+    if (const RtVariant* variant = rtVariant()) {
+        pipeline = variant->pipeline;
+        rgen = variant->rgen;  miss = variant->miss;  hit = variant->hit; }
 
     // Bind the ray tracing pipeline
-    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_rtPipeline);
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline);
 
     // Bind the descriptor sets (the ray tracing specific one, and the
     // full model descriptor)
@@ -362,17 +547,35 @@ void VkApp::raytrace()
                        | VK_SHADER_STAGE_MISS_BIT_KHR,
                        0, sizeof(PushConstantRay), &m_pcRay);
 
-    vkCmdTraceRaysKHR(m_commandBuffer, &m_rgenRegion, &m_missRegion, &m_hitRegion,
-                      &m_callRegion, windowSize.width, windowSize.height, 1);
+    if (m_pcRay.adaptive)
+        vkCmdTraceRaysIndirectKHR(m_commandBuffer, &rgen, &miss, &hit, &m_callRegion,
+                                  m_adaptiveListAddress + offsetof(AdaptiveCounters, traceArgs));
+    else
+        vkCmdTraceRaysKHR(m_commandBuffer, &rgen, &miss, &hit, &m_callRegion,
+                          m_pcRay.checkerboard ? (windowSize.width+1)/2 : windowSize.width,
+                          windowSize.height, 1);
+}
 
+void VkApp::raytraceRayQuery()
+{
+    VkPipeline pipeline = rqVariant();
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      pipeline ? pipeline : m_rqPipeline);
 
-    // Copy the ray tracer output image to the scanline output image
-    // -- because we already have the operations needed to display
-    // that image on the screen.
-    CmdCopyImage(m_rtColCurrBuffer, m_scImageBuffer);
-    CmdCopyImage(m_rtColCurrBuffer, m_rtColPrevBuffer);
-    CmdCopyImage(m_rtNdCurrBuffer, m_rtNdPrevBuffer);
+    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_rqPipelineLayout, 0, (uint32_t)descSets.size(),
+                            descSets.data(), 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_rqPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantRay), &m_pcRay);
 
-    
-}
+    // This MUST match the shader's local_size of 8x8
+    if (m_pcRay.adaptive)
+        vkCmdDispatchIndirect(m_commandBuffer, m_adaptiveListBW.buffer,
+                              offsetof(AdaptiveCounters, dispatchArgs));
+    else {
+        uint32_t width = m_pcRay.checkerboard ? (windowSize.width+1)/2 : windowSize.width;
+        vkCmdDispatch(m_commandBuffer, (width+7)/8, (windowSize.height+7)/8, 1); }
 
+    // temporalAccumulate follows, with its own barrier
+}
@@ -0,0 +1,128 @@
+// Low-discrepancy sampler tables, built once on the host and uploaded
+// to a storage buffer read by every path tracing backend.
+//
+//   sobol:      generator matrices of the first SOBOL_DIMS Sobol
+//               dimensions (Joe & Kuo direction numbers); the shader
+//               Owen-scrambles and shuffles them per pixel, and pads
+//               longer paths with independently shuffled 4D blocks
+//               (Burley, "Practical Hash-based Owen Scrambling", 2020).
+//   blueNoise:  void-and-cluster ranks of a BLUE_NOISE_SIZE^2 tile
+//               (Ulichney 1993), used as a per-pixel toroidal shift of
+//               one shared sequence so the error is blue noise in
+//               screen space (Georgiev & Fajardo 2016).
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include "vkapp.h"
+
+#include "shaders/shared_structs.h"
+
+// Direction numbers of dimension dim (0 is van der Corput) as 32
+// columns of its generator matrix, column j for index bit j.
+static void sobolMatrix(uint dim, uint* v)
+{
+    // Joe & Kuo: degree s, coefficients a and initial m_i of the
+    // primitive polynomial for dimensions 1, 2, 3
+    static const uint s[] = {0, 1, 2, 3};
+    static const uint a[] = {0, 0, 1, 1};
+    static const uint m[][3] = {{0,0,0}, {1,0,0}, {1,3,0}, {1,3,1}};
+
+    if (dim == 0) {
+        for (uint j=0;  j<32;  j++)
+            v[j] = 1u << (31-j);
+        return; }
+
+    uint S = s[dim];
+    for (uint j=0;  j<32;  j++) {
+        if (j < S)
+            v[j] = m[dim][j] << (31-j);
+        else {
+            v[j] = v[j-S] ^ (v[j-S] >> S);
+            for (uint k=1;  k<S;  k++)
+                v[j] ^= ((a[dim] >> (S-1-k)) & 1) * v[j-k]; } }
+}
+
+// Void-and-cluster ranking of an n x n toroidal tile: each pixel gets
+// its order of insertion 0..n*n-1 into a progressively denser blue
+// noise pattern.
+static std::vector<uint> voidAndCluster(int n)
+{
+    const int N = n*n;
+    const float sigma = 1.5f;
+
+    // Gaussian energy filter on the torus, indexed by wrapped offset
+    std::vector<float> kernel(N);
+    for (int y=0;  y<n;  y++)
+        for (int x=0;  x<n;  x++) {
+            int dx = std::min(x, n-x);
+            int dy = std::min(y, n-y);
+            kernel[y*n+x] = expf(-(dx*dx+dy*dy) / (2*sigma*sigma)); }
+
+    std::vector<int> on(N, 0);
+    std::vector<float> energy(N, 0.0f);
+    auto splat = [&](int p, float sign) {
+        int px = p%n, py = p/n;
+        for (int y=0;  y<n;  y++)
+            for (int x=0;  x<n;  x++)
+                energy[y*n+x] += sign*kernel[((y-py+n)%n)*n + (x-px+n)%n]; };
+    auto tightestCluster = [&]() {  // The set pixel with the most energy
+        int best = -1;
+        for (int p=0;  p<N;  p++)
+            if (on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+        return best; };
+    auto largestVoid = [&]() {  // The empty pixel with the least energy
+        int best = -1;
+        for (int p=0;  p<N;  p++)
+            if (!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+        return best; };
+
+    // Initial pattern: a tenth of the pixels from a fixed LCG, then
+    // relaxed by moving the tightest cluster into the largest void
+    // until that stops changing anything.
+    uint seed = 12345;
+    int ones = N/10;
+    for (int i=0;  i<ones; ) {
+        seed = 1664525u*seed + 1013904223u;
+        int p = (seed >> 8) % N;
+        if (!on[p]) { on[p] = 1;  splat(p, 1.0f);  i++; } }
+    while (true) {
+        int c = tightestCluster();
+        on[c] = 0;  splat(c, -1.0f);
+        int v = largestVoid();
+        on[v] = 1;  splat(v, 1.0f);
+        if (v == c) break; }
+    std::vector<int> prototype = on;
+    std::vector<float> protoEnergy = energy;
+
+    std::vector<uint> rank(N);
+    // Phase 1: rank the prototype's pixels by removing clusters
+    for (int r=ones-1;  r>=0;  r--) {
+        int c = tightestCluster();
+        on[c] = 0;  splat(c, -1.0f);
+        rank[c] = r; }
+    // Phases 2 and 3: fill the largest voids for the remaining ranks
+    on = prototype;
+    energy = protoEnergy;
+    for (int r=ones;  r<N;  r++) {
+        int v = largestVoid();
+        on[v] = 1;  splat(v, 1.0f);
+        rank[v] = r; }
+
+    return rank;
+}
+
+void VkApp::createSamplerTables()
+{
+    std::vector<uint> tables(SOBOL_DIMS*32 + BLUE_NOISE_SIZE*BLUE_NOISE_SIZE);
+    for (uint d=0;  d<SOBOL_DIMS;  d++)
+        sobolMatrix(d, &tables[d*32]);
+
+    std::vector<uint> ranks = voidAndCluster(BLUE_NOISE_SIZE);
+    std::copy(ranks.begin(), ranks.end(), tables.begin() + SOBOL_DIMS*32);
+
+    VkCommandBuffer cmdBuf = createTempCmdBuffer();
+    m_samplerBW = createStagedBufferWrap(cmdBuf, tables, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    submitTempCmdBuffer(cmdBuf);
+}
@@ -95,7 +95,8 @@ void VkApp::imageLayoutBarrier(VkCommandBuffer cmdbuffer,
                          0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
 }
 
-ImageWrap VkApp::createTextureImage(std::string fileName)
+ImageWrap VkApp::createTextureImage(std::string fileName,
+                                    std::function<void(const ImageWrap&)> done, bool stream)
 {
     //VkImage& textureImage, VkDeviceMemory& textureImageMemory
     int texWidth, texHeight, texChannels;
@@ -103,12 +104,24 @@ ImageWrap VkApp::createTextureImage(std::string fileName)
     stbi_set_flip_vertically_on_load(true);
     stbi_uc* pixels = stbi_load(fileName.c_str(), &texWidth, &texHeight, &texChannels,
                                 STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
 
     if (!pixels) {
         throw std::runtime_error("failed to load texture image!");
     }
 
+    ImageWrap myImage = createTextureFromPixels(pixels, texWidth, texHeight, done, stream);
+    stbi_image_free(pixels);
+    return myImage;
+}
+
+// An RGBA8 texture of width*height pixels, with a full mip chain.  It
+// may be bound at once, but is only sampled correctly by the commands
+// after the upload's been acquired (done runs then, on the render thread).
+ImageWrap VkApp::createTextureFromPixels(const void* pixels, int texWidth, int texHeight,
+                                         std::function<void(const ImageWrap&)> done, bool stream)
+{
+    VkDeviceSize imageSize = texWidth * texHeight * 4;
+
     BufferWrap staging = createBufferWrap(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
                                       | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
@@ -118,8 +131,6 @@ ImageWrap VkApp::createTextureImage(std::string fileName)
     memcpy(data, pixels, static_cast<size_t>(imageSize));
     vkUnmapMemory(m_device, staging.memory);
 
-    stbi_image_free(pixels);
-
     uint mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
     
     ImageWrap myImage = createImageWrap(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM,
@@ -128,23 +139,51 @@ ImageWrap VkApp::createTextureImage(std::string fileName)
                                   | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                                   mipLevels);
+    // The view and sampler reach every level: the ray cones' textureLod
+    // picks one
+    myImage.imageView = createImageView(myImage.image, VK_FORMAT_R8G8B8A8_UNORM,
+                                        VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+    myImage.sampler = createTextureSampler(mipLevels);
+    myImage.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    transitionImageLayout(myImage.image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-    copyBufferToImage(staging.buffer, myImage.image, static_cast<uint32_t>(texWidth),
-                      static_cast<uint32_t>(texHeight));
-
-    staging.destroy(m_device);
+    // Level 0 on the upload queue, the mipmaps (blits) on the graphics
+    // queue after the handover; still in TRANSFER_DST between the two
+    VkImage image = myImage.image;
+    Upload upload;
+    upload.staging = {staging};
+    upload.copy = [this, staging, image, texWidth, texHeight, mipLevels](VkCommandBuffer cmd) {
+        VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+        barrier.dstAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image               = image;
+        barrier.subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1};
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+        copyBufferToImage(cmd, staging.buffer, image, static_cast<uint32_t>(texWidth),
+                          static_cast<uint32_t>(texHeight)); };
+
+    VkImageMemoryBarrier handover{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    handover.dstAccessMask    = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    handover.oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    handover.newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    handover.image            = image;
+    handover.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1};
+    upload.images = {handover};
+    upload.acquired = [this, image, texWidth, texHeight, mipLevels](VkCommandBuffer cmd) {
+        generateMipmaps(cmd, image, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels); };
+    if (done)
+        upload.done = [done, myImage]() { done(myImage); };
+    queueUpload(std::move(upload), stream);
 
-    generateMipmaps(myImage.image, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
-    
-    myImage.imageView = createImageView(myImage.image, VK_FORMAT_R8G8B8A8_UNORM);
-    myImage.sampler = createTextureSampler();
-    myImage.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     return myImage;
 }
 
-void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
+// Recorded into commandBuffer, on the graphics queue (blits).  Leaves
+// every level in SHADER_READ_ONLY_OPTIMAL.
+void VkApp::generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat,
                             int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
 {
     // Check if image format supports linear blitting
@@ -155,8 +194,6 @@ void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
         throw std::runtime_error("texture image format does not support linear blitting!");
     }
 
-    VkCommandBuffer commandBuffer = createTempCmdBuffer();
-
     VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
     barrier.image = image;
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -208,7 +245,7 @@ void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
         barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
         vkCmdPipelineBarrier(commandBuffer,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
                              0, nullptr,
                              0, nullptr,
                              1, &barrier);
@@ -224,41 +261,83 @@ void VkApp::generateMipmaps(VkImage image, VkFormat imageFormat,
     barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
     vkCmdPipelineBarrier(commandBuffer,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
                          0, nullptr,
                          0, nullptr,
                          1, &barrier);
-
-    submitTempCmdBuffer(commandBuffer);
 }
 
-void VkApp::CmdCopyImage(ImageWrap& src, ImageWrap& dst)
+void VkApp::CmdCopyImage(VkCommandBuffer cmd, ImageWrap& src, ImageWrap& dst, VkExtent2D size,
+                         VkPipelineStageFlags2 writers, VkPipelineStageFlags2 readers)
 {
-    VkImageCopy imageCopyRegion{};
-    imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.srcSubresource.layerCount = 1;
-    imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.dstSubresource.layerCount = 1;
-    imageCopyRegion.extent.width = windowSize.width;
-    imageCopyRegion.extent.height = windowSize.height;
-    imageCopyRegion.extent.depth = 1;
-
-    imageLayoutBarrier(m_commandBuffer, src.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-    imageLayoutBarrier(m_commandBuffer, dst.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-    vkCmdCopyImage(m_commandBuffer, src.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                                dst.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                                1, &imageCopyRegion);
+    CmdCopyImages(cmd, {{&src, &dst}}, size, writers, readers);
+}
 
-    imageLayoutBarrier(m_commandBuffer, src.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-    imageLayoutBarrier(m_commandBuffer, dst.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+// Copies between images in GENERAL layout, which copies can use as
+// they are, as one batch: a barrier after the writers of their sources
+// and readers of their destinations, and one before whatever reads
+// next.  No stages (0) for either, where the render graph's barriers
+// already cover it.  Images of different formats are converted, by
+// blits (the same size, so nothing's filtered).
+void VkApp::CmdCopyImages(VkCommandBuffer cmd,
+                          const std::vector<std::pair<ImageWrap*, ImageWrap*>>& copies,
+                          VkExtent2D size, VkPipelineStageFlags2 writers, VkPipelineStageFlags2 readers,
+                          bool convert)
+{
+    const VkPipelineStageFlags2 stage = convert ? VK_PIPELINE_STAGE_2_BLIT_BIT : VK_PIPELINE_STAGE_2_COPY_BIT;
+    VkMemoryBarrier2 barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    VkDependencyInfo dependency{VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependency.memoryBarrierCount = 1;
+    dependency.pMemoryBarriers    = &barrier;
+
+    if (writers) {
+        barrier.srcStageMask  = writers;
+        barrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+        barrier.dstStageMask  = stage;
+        barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier2(cmd, &dependency); }
 
+    VkImageCopy imageCopyRegion{};
+    imageCopyRegion.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    imageCopyRegion.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    imageCopyRegion.extent = {size.width, size.height, 1};
+    VkImageBlit blitRegion{};
+    blitRegion.srcSubresource = imageCopyRegion.srcSubresource;
+    blitRegion.dstSubresource = imageCopyRegion.dstSubresource;
+    blitRegion.srcOffsets[1]  = {int32_t(size.width), int32_t(size.height), 1};
+    blitRegion.dstOffsets[1]  = blitRegion.srcOffsets[1];
+    for (const std::pair<ImageWrap*, ImageWrap*>& copy : copies)
+        if (convert)
+            vkCmdBlitImage(cmd, copy.first->image, VK_IMAGE_LAYOUT_GENERAL,
+                           copy.second->image, VK_IMAGE_LAYOUT_GENERAL, 1, &blitRegion, VK_FILTER_NEAREST);
+        else
+            vkCmdCopyImage(cmd, copy.first->image, VK_IMAGE_LAYOUT_GENERAL,
+                           copy.second->image, VK_IMAGE_LAYOUT_GENERAL, 1, &imageCopyRegion);
+
+    if (readers) {
+        barrier.srcStageMask  = stage;
+        barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        barrier.dstStageMask  = readers;
+        barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+        vkCmdPipelineBarrier2(cmd, &dependency); }
 }
 
 BufferWrap VkApp::createStagedBufferWrap(const VkCommandBuffer& cmdBuf,
                                          const VkDeviceSize&    size,
                                          const void*            data,
                                          VkBufferUsageFlags     usage)
+{
+    // Copied by the uploader: ready for the commands of the frame that
+    // acquires it, or of any temp command buffer (which flushes)
+    Upload upload;
+    BufferWrap bw = stageBuffer(upload, size, data, usage);
+    queueUpload(std::move(upload));
+    
+    return bw;
+}
+
+BufferWrap VkApp::stageBuffer(Upload& upload, VkDeviceSize size, const void* data,
+                              VkBufferUsageFlags usage)
 {
     BufferWrap staging = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
@@ -269,13 +348,23 @@ BufferWrap VkApp::createStagedBufferWrap(const VkCommandBuffer& cmdBuf,
     memcpy(dest, data, size);
     vkUnmapMemory(m_device, staging.memory);
 
-    
     BufferWrap bw = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    copyBuffer(staging.buffer, bw.buffer, size);
 
-    staging.destroy(m_device);
-    
+    // After the upload's other copies, if any
+    VkBuffer src = staging.buffer, dst = bw.buffer;
+    upload.staging.push_back(staging);
+    upload.copy = [prior=upload.copy, src, dst, size](VkCommandBuffer cmd) {
+        if (prior) prior(cmd);
+        VkBufferCopy copyRegion{0, 0, size};
+        vkCmdCopyBuffer(cmd, src, dst, 1, &copyRegion); };
+    VkBufferMemoryBarrier handover{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    handover.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;  // Vertices, indices, shaders, AS builds
+    handover.buffer        = dst;
+    handover.offset        = 0;
+    handover.size          = VK_WHOLE_SIZE;
+    upload.buffers.push_back(handover);
+
     return bw;
 }
 
@@ -323,10 +412,9 @@ void VkApp::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size
 }
 
 
-void VkApp::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+void VkApp::copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image,
+                              uint32_t width, uint32_t height)
 {
-    VkCommandBuffer commandBuffer = createTempCmdBuffer();
-
     VkBufferImageCopy region{};
     region.bufferOffset = 0;
     region.bufferRowLength = 0;
@@ -339,8 +427,6 @@ void VkApp::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, ui
     region.imageExtent = {width, height, 1};
 
     vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-    
-    submitTempCmdBuffer(commandBuffer);
 }
 
 void VkApp::transitionImageLayout(VkImage image,
@@ -374,7 +460,8 @@ void VkApp::transitionImageLayout(VkImage image,
     submitTempCmdBuffer(commandBuffer);
 }
 
-VkSampler VkApp::createTextureSampler()
+// Sampling levels [0, mipLevels) of its image
+VkSampler VkApp::createTextureSampler(uint32_t mipLevels)
 {
     VkPhysicalDeviceProperties properties{};
     vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
@@ -392,6 +479,8 @@ VkSampler VkApp::createTextureSampler()
     samplerInfo.compareEnable = VK_FALSE;
     samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = static_cast<float>(mipLevels - 1);
 
     VkSampler textureSampler;
     if (vkCreateSampler(m_device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
@@ -402,41 +491,40 @@ VkSampler VkApp::createTextureSampler()
 
 void VkApp::createPostDescriptor()
 {
+    // The images post can show; and for post.comp, this frame's
+    // swapchain image, written each frame by postCompute
     m_postDesc.setBindings(m_device, {
-            {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT}
+            {PostBindings::ePostSources, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2,
+             VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT},
+            {PostBindings::ePostSwapchain, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
         });
-    m_postDesc.write(m_device, 0, m_scImageBuffer.Descriptor());
-
-}
+    m_postDesc.write(m_device, PostBindings::ePostSources,
+                     std::vector<ImageWrap>{m_scImageBuffer, m_rtColCurrBuffer});  // POST_SOURCE_*
 
-void VkApp::createScBuffer()
-{
-    m_scImageBuffer = createBufferImage(windowSize);
-
-        VkCommandBuffer    cmdBuf = createTempCmdBuffer();
-        imageLayoutBarrier(cmdBuf, m_scImageBuffer.image,
-                           VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-        submitTempCmdBuffer(cmdBuf);
-    
 }
 
-ImageWrap VkApp::createBufferImage(VkExtent2D& size)
+// A transient image is left unbound, without a view or sampler, for
+// the render graph to place (see vkapp_graph.cpp).  Screen targets that
+// can be packed pass their format (vkapp_formats.cpp).
+ImageWrap VkApp::createBufferImage(VkExtent2D& size, bool transient, VkFormat format)
 {
     //uint mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
     uint mipLevels = 1;
 
-    ImageWrap myImage = createImageWrap(size.width, size.height, VK_FORMAT_R32G32B32A32_SFLOAT,
+    ImageWrap myImage = createImageWrap(size.width, size.height, format,
                                   VK_IMAGE_USAGE_TRANSFER_DST_BIT
                                   | VK_IMAGE_USAGE_SAMPLED_BIT
                                   | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
                                   | VK_IMAGE_USAGE_STORAGE_BIT
                                   | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                  mipLevels);
+                                  mipLevels, !transient);
+    myImage.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    if (transient)
+        return myImage;
 
-    myImage.imageView = createImageView(myImage.image, VK_FORMAT_R32G32B32A32_SFLOAT);
+    myImage.imageView = createImageView(myImage.image, format);
     myImage.sampler = createTextureSampler();
-    myImage.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
     return myImage;
 }
 
@@ -517,28 +605,67 @@ void VkApp::createScanlineRenderPass()
 
 void VkApp::createScDescriptorSet()
 {
-    auto nbTxt = static_cast<uint32_t>(m_objText.size());
+    // A fixed number of texture slots, so a scene (streamed in at run
+    // time) never changes the layout every pipeline was built with.
+    // Slots without a texture hold m_placeholderTexture.
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    m_textureSlots = std::min({1024u, properties.limits.maxPerStageDescriptorSamplers,
+                               properties.limits.maxPerStageDescriptorSampledImages,
+                               properties.limits.maxDescriptorSetSamplers});
+    auto nbTxt = m_textureSlots;
+    createTexStreaming();  // Its feedback and min LOD buffers have an entry per slot
 
     m_scDesc.setBindings(m_device, {
             {ScBindings::eMatrices, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
                 VK_SHADER_STAGE_VERTEX_BIT 
                 | VK_SHADER_STAGE_RAYGEN_BIT_KHR 
-                | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR},
+                | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
+                | VK_SHADER_STAGE_COMPUTE_BIT},
             {ScBindings::eObjDescs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
 				VK_SHADER_STAGE_VERTEX_BIT
 		        | VK_SHADER_STAGE_FRAGMENT_BIT
 		        | VK_SHADER_STAGE_RAYGEN_BIT_KHR
-		        | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR},
+		        | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
+		        | VK_SHADER_STAGE_COMPUTE_BIT},
             {ScBindings::eTextures, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nbTxt,
                 VK_SHADER_STAGE_FRAGMENT_BIT 
                 | VK_SHADER_STAGE_RAYGEN_BIT_KHR 
-                | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR}
+                | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
+                | VK_SHADER_STAGE_COMPUTE_BIT},
+            {ScBindings::eInstDescs, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_RAYGEN_BIT_KHR
+                | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
+                | VK_SHADER_STAGE_COMPUTE_BIT},
+            {ScBindings::eTexFeedback, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_FRAGMENT_BIT
+                | VK_SHADER_STAGE_RAYGEN_BIT_KHR
+                | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
+                | VK_SHADER_STAGE_COMPUTE_BIT},
+            {ScBindings::eTexMinLod, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_FRAGMENT_BIT
+                | VK_SHADER_STAGE_RAYGEN_BIT_KHR
+                | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
+                | VK_SHADER_STAGE_COMPUTE_BIT}
         });
               
     m_scDesc.write(m_device, ScBindings::eMatrices, m_matrixBW.buffer);
-    m_scDesc.write(m_device, ScBindings::eObjDescs, m_objDescriptionBW.buffer);
-    m_scDesc.write(m_device, ScBindings::eTextures, m_objText);    
+    m_scDesc.write(m_device, ScBindings::eTexFeedback, m_texFeedbackBW.buffer);
+    m_scDesc.write(m_device, ScBindings::eTexMinLod, m_texMinLodBW.buffer);
+    writeSceneDescriptors();
+}
+
+// The scene's bindings in m_scDesc: again each time it changes
+void VkApp::writeSceneDescriptors()
+{
+    std::vector<ImageWrap> textures(m_textureSlots, m_placeholderTexture);
+    for (size_t t = 0; t < m_objText.size() && t < textures.size(); t++)
+        if (m_objText[t].image)  // Else not here yet
+            textures[t] = m_objText[t];
 
+    m_scDesc.write(m_device, ScBindings::eObjDescs, m_objDescriptionBW.buffer);
+    m_scDesc.write(m_device, ScBindings::eTextures, textures);    
+    m_scDesc.write(m_device, ScBindings::eInstDescs, m_instDescriptionBW.buffer);
 }
 
 void VkApp::createScPipeline()
@@ -554,7 +681,13 @@ void VkApp::createScPipeline()
     createInfo.pPushConstantRanges    = &pushConstantRanges;
     vkCreatePipelineLayout(m_device, &createInfo, nullptr, &m_scanlinePipelineLayout);
 
+    m_scanlinePipeline = buildScPipeline(nullptr);
+}
 
+// The scanline pipeline's state and shaders, with spec (if any)
+// fixing the fragment shader's BRDF; see vkapp_variants.cpp.
+VkPipeline VkApp::buildScPipeline(const VkSpecializationInfo* spec)
+{
     VkShaderModule vertShaderModule = createShaderModule(loadFile("spv/scanline.vert.spv"));
     VkShaderModule fragShaderModule = createShaderModule(loadFile("spv/scanline.frag.spv"));
 
@@ -569,6 +702,7 @@ void VkApp::createScPipeline()
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     fragShaderStageInfo.module = fragShaderModule;
     fragShaderStageInfo.pName = "main";
+    fragShaderStageInfo.pSpecializationInfo = spec;
 
     VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
@@ -667,14 +801,16 @@ void VkApp::createScPipeline()
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_scanlinePipeline) != VK_SUCCESS) {
+    VkPipeline pipeline{};
+    if (vkCreateGraphicsPipelines(m_device, m_pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create scanline pipeline!");
     }
 
     // Done with the temporary spv shader modules.
     vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
     vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
-    
+
+    return pipeline;
 }
 
 // Create a Vulkan buffer to hold the camera matrices, products and inverses.
@@ -691,10 +827,31 @@ void VkApp::createMatrixBuffer()
 // Create a Vulkan buffer containing pointers to all object buffers
 // (vertex, triangle indices, materials, and material indices. Will be
 // included in a descriptor set for use in shaders.
+// Also a buffer of all instances (transforms and object index) so the
+// ray tracer can take a hit back to world coordinates.
 void VkApp::createObjDescriptionBuffer()
 {
+    // At least one of each: a buffer can't be empty (as when no
+    // object of the scene has streamed in yet)
+    std::vector<ObjDesc> objDesc = m_objDesc;
+    if (objDesc.empty())
+        objDesc.emplace_back();
+
+    std::vector<InstDesc> instDesc;
+    instDesc.reserve(m_objInst.size());
+    for (const ObjInst& inst : m_objInst) {
+        InstDesc desc;
+        desc.transform       = inst.transform;
+        desc.normalTransform = glm::transpose(glm::inverse(inst.transform));
+        desc.objIndex        = inst.objIndex;
+        instDesc.push_back(desc); }
+    if (instDesc.empty())
+        instDesc.emplace_back();
+    
     VkCommandBuffer cmdBuf = createTempCmdBuffer();
-    m_objDescriptionBW  = createStagedBufferWrap(cmdBuf, m_objDesc,
+    m_objDescriptionBW  = createStagedBufferWrap(cmdBuf, objDesc,
+                                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    m_instDescriptionBW = createStagedBufferWrap(cmdBuf, instDesc,
                                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
     submitTempCmdBuffer(cmdBuf);
 }
@@ -702,6 +859,8 @@ void VkApp::createObjDescriptionBuffer()
 void VkApp::rasterize()
 {
     VkDeviceSize offset{0};
+
+    m_graph.begin(m_commandBuffer, m_rgRasterize);
     
     std::array<VkClearValue, 2> clearValues{};
     clearValues[0].color        = {{0,0,0,1}};
@@ -715,7 +874,9 @@ void VkApp::rasterize()
     _i.renderArea      = {{0, 0}, windowSize};
     vkCmdBeginRenderPass(m_commandBuffer, &_i, VK_SUBPASS_CONTENTS_INLINE);
 
-    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_scanlinePipeline);
+    VkPipeline pipeline = scVariant();
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipeline ? pipeline : m_scanlinePipeline);
     vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                             m_scanlinePipelineLayout, 0, 1, &m_scDesc.descSet, 0, nullptr);
 
@@ -762,35 +923,36 @@ void VkApp::updateCameraBuffer()
     hostUBO.viewInverse = glm::inverse(view);
     hostUBO.projInverse = glm::inverse(proj);
 
-    // UBO on the device, and what stages access it.
-    VkBuffer deviceUBO      = m_matrixBW.buffer;
-    auto     uboUsageStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
-                            | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+    // What stages access the UBO: the rasterizer's, the tracer's (ray
+    // query and wavefront in compute), and the temporal pass's
+    VkPipelineStageFlags2 uboUsageStages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT
+        | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    if (m_hasRtPipeline) uboUsageStages |= VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR;
 
     // Ensure that the modified UBO is not visible to previous frames.
-    VkBufferMemoryBarrier beforeBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    beforeBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    beforeBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    beforeBarrier.buffer        = deviceUBO;
-    beforeBarrier.offset        = 0;
-    beforeBarrier.size          = sizeof(hostUBO);
-    vkCmdPipelineBarrier(m_commandBuffer, uboUsageStages, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0,
-                         nullptr, 1, &beforeBarrier, 0, nullptr);
-
+    VkBufferMemoryBarrier2 barrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2};
+    barrier.srcStageMask        = uboUsageStages;
+    barrier.srcAccessMask       = 0;  // Only read: an execution dependency
+    barrier.dstStageMask        = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barrier.dstAccessMask       = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer              = m_matrixBW.buffer;
+    barrier.offset              = 0;
+    barrier.size                = sizeof(hostUBO);
+    VkDependencyInfo dependency{VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependency.bufferMemoryBarrierCount = 1;
+    dependency.pBufferMemoryBarriers    = &barrier;
+    vkCmdPipelineBarrier2(m_commandBuffer, &dependency);
 
     // Schedule the host-to-device upload. (hostUBO is copied into the cmd
     // buffer so it is okay to deallocate when the function returns).
     vkCmdUpdateBuffer(m_commandBuffer, m_matrixBW.buffer, 0, sizeof(MatrixUniforms), &hostUBO);
 
     // Making sure the updated UBO will be visible.
-    VkBufferMemoryBarrier afterBarrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    afterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    afterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    afterBarrier.buffer        = deviceUBO;
-    afterBarrier.offset        = 0;
-    afterBarrier.size          = sizeof(hostUBO);
-    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, uboUsageStages,
-                         VK_DEPENDENCY_DEVICE_GROUP_BIT, 0,
-                         nullptr, 1, &afterBarrier, 0, nullptr);
+    barrier.srcStageMask  = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.dstStageMask  = uboUsageStages;
+    barrier.dstAccessMask = VK_ACCESS_2_UNIFORM_READ_BIT;
+    vkCmdPipelineBarrier2(m_commandBuffer, &dependency);
 }
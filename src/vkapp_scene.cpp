@@ -0,0 +1,200 @@
+// Streamed scene loading, and switching scenes at run time.
+//
+//   loadScene:          starts a loader thread (myloadModel in
+//                       vkapp_loadModel.cpp) for a model, and stops
+//                       any earlier one (each checks m_sceneGeneration).
+//   loader thread:      parses the model, then queues its materials,
+//                       each object's buffers, and each texture (decoded
+//                       on a few threads of its own) as streamed uploads.
+//   upload callbacks:   on the render thread, once handed to the
+//                       graphics queue: the materials post the scene
+//                       (SceneLoad), each object or texture posts a
+//                       SceneArrival.  A texture arrives with its
+//                       coarse levels only (see vkapp_texstream.cpp).
+//   applySceneUpdates:  at the start of a frame.  A newly posted scene
+//                       replaces the one shown; its objects get their
+//                       BLASes and join the TLAS as they arrive, its
+//                       textures replace the placeholder in their slots.
+//
+// So the first frames are drawn at once: of an empty scene, then of a
+// scene filling in.  Accumulation restarts with each change.  Applying
+// a change waits for the frames in flight (not for the uploads), since
+// the buffers, the TLAS and the descriptors they use are replaced.
+
+#include <fstream>
+
+#include "vkapp.h"
+
+void VkApp::loadScene(const std::string& path)
+{
+    // A bad path leaves the scene (and any load in progress) as it is
+    std::ifstream find_it(path.c_str());
+    if (find_it.fail()) {
+        printf("Scene not found: %s\n", path.c_str());
+        return; }
+
+    // Join the earlier loaders that have finished.  (Any still parsing
+    // stop on their own, and are joined later: not worth a wait here.)
+    std::vector<std::thread::id> done;
+    {
+        std::lock_guard<std::mutex> lock(m_sceneMutex);
+        done.swap(m_sceneThreadsDone);
+    }
+    for (size_t i = 0; i < m_sceneThreads.size(); )
+        if (std::find(done.begin(), done.end(), m_sceneThreads[i].get_id()) != done.end()) {
+            m_sceneThreads[i].join();
+            m_sceneThreads.erase(m_sceneThreads.begin() + i); }
+        else
+            i++;
+
+    uint64_t generation = ++m_sceneGeneration;
+    printf("Loading scene %s\n", path.c_str());
+    m_sceneThreads.emplace_back([this, path, generation]() {
+        myloadModel(path, glm::mat4(1.0f), generation);
+        std::lock_guard<std::mutex> lock(m_sceneMutex);
+        m_sceneThreadsDone.push_back(std::this_thread::get_id()); });
+}
+
+// Until a scene streams in: no objects, a light that emits nothing,
+// and the placeholder (mid grey) in every texture slot
+void VkApp::createEmptyScene()
+{
+    const uint8_t grey[4] = {128, 128, 128, 255};
+    m_placeholderTexture = createTextureFromPixels(grey, 1, 1);
+    createLightbuffer();
+}
+
+static void destroyObject(VkDevice device, ObjData& object)
+{
+    object.vertexBuffer.destroy(device);
+    object.indexBuffer.destroy(device);
+    object.matIndexBuffer.destroy(device);
+}
+
+void VkApp::applySceneUpdates()
+{
+    std::vector<std::shared_ptr<SceneLoad>> loads;
+    std::vector<SceneArrival> arrivals;
+    {
+        std::lock_guard<std::mutex> lock(m_sceneMutex);
+        loads.swap(m_sceneLoads);
+        arrivals.swap(m_sceneArrivals);
+    }
+    if (loads.empty() && arrivals.empty())
+        return;
+
+    // The frames in flight use what's replaced below.  (Not
+    // vkDeviceWaitIdle: the upload thread submits to its own queue.)
+    vkQueueWaitIdle(m_queue);
+    if (m_computeQueue)
+        vkQueueWaitIdle(m_computeQueue);
+    waitUploadsAcquired();  // A replaced scene's arrivals may still be copying
+
+    bool newObjects = false;
+    for (std::shared_ptr<SceneLoad>& load : loads) {
+        if (load->generation != m_sceneGeneration) {  // Replaced before it was shown
+            load->materials.destroy(m_device);
+            continue; }
+
+        destroyScene();
+        m_sceneShown = load->generation;
+        m_scenePath  = load->path;
+        m_objMaterials.push_back(load->materials);
+        m_emitterList = load->emitters;
+        createLightbuffer();
+        m_objText.assign(load->nbTextures, ImageWrap{});
+        m_texStream.assign(load->nbTextures, StreamedTexture{});
+        m_scenePartObject.assign(load->nbParts, -1);
+        m_sceneInstances = load->instances;
+        newObjects = true;
+        printf("Scene %s: %u objects and %u textures to come\n",
+               m_scenePath.c_str(), load->nbParts, load->nbTextures); }
+
+    for (SceneArrival& arrival : arrivals) {
+        if (arrival.generation != m_sceneShown) {  // Of a scene replaced, or never shown
+            destroyObject(m_device, arrival.object);
+            arrival.image.destroy(m_device);
+            continue; }
+
+        if (arrival.part >= 0) {
+            m_scenePartObject[arrival.part] = static_cast<int>(m_objData.size());
+            m_objData.push_back(arrival.object);
+            m_objDesc.push_back(arrival.desc);
+            newObjects = true; }
+        if (arrival.texture >= 0) {
+            m_objText[arrival.texture] = arrival.image;
+            StreamedTexture& streamed = m_texStream[arrival.texture];
+            streamed.mips      = arrival.mips;
+            streamed.resident  = streamed.uploaded = streamed.requested = arrival.level; } }
+
+    if (newObjects) {
+        // BLASes for the objects that arrived (BLAS i is object i's),
+        // and a TLAS over every instance whose object is here
+        createBottomLevelAS();
+        m_objInst.clear();
+        for (const ObjInst& inst : m_sceneInstances) {
+            int objIndex = m_scenePartObject[inst.objIndex];
+            if (objIndex >= 0)
+                m_objInst.push_back({inst.transform, static_cast<uint32_t>(objIndex)}); }
+        createTopLevelAS();
+
+        m_objDescriptionBW.destroy(m_device);
+        m_instDescriptionBW.destroy(m_device);
+        createObjDescriptionBuffer();
+
+        m_rtDesc.write(m_device, RtBindings::eTlas, m_rtBuilder.getAccelerationStructure());
+        m_rtDesc.write(m_device, RtBindings::eLights, m_lightBuffer.buffer);
+
+        if (m_objData.size() == m_scenePartObject.size())
+            printf("Scene %s: all %zu objects, %zu instances\n", m_scenePath.c_str(),
+                   m_objData.size(), m_objInst.size()); }
+
+    writeSceneDescriptors();
+    m_sceneChanged = true;
+}
+
+// Everything of the scene shown (not the placeholder); the frames using
+// it are done.
+void VkApp::destroyScene()
+{
+    m_rtBuilder.destroy();
+
+    for (ObjData& object : m_objData)
+        destroyObject(m_device, object);
+    for (size_t t = 0; t < m_objText.size(); t++)
+        if (t < m_texStream.size() && m_texStream[t].pending >= 0)
+            m_texOrphans.push_back(m_objText[t]);  // A level's still copied into it
+        else
+            m_objText[t].destroy(m_device);  // (Nothing, for a slot not loaded)
+    for (BufferWrap& mat : m_objMaterials)
+        mat.destroy(m_device);
+    m_lightBuffer.destroy(m_device);
+    m_lightBuffer = {};
+
+    m_objData.clear();
+    m_objDesc.clear();
+    m_objText.clear();
+    m_texStream.clear();  // Its orphans are destroyed as their levels arrive
+    m_objInst.clear();
+    m_objMaterials.clear();
+    m_emitterList.clear();
+    m_scenePartObject.clear();
+    m_sceneInstances.clear();
+}
+
+// Stops the loader threads, and destroys what they uploaded that never
+// joined the scene.  Before the uploader goes, whose queued uploads
+// write into those.
+void VkApp::destroySceneLoader()
+{
+    ++m_sceneGeneration;  // Stops them after the file's parsed
+    for (std::thread& loader : m_sceneThreads)
+        loader.join();
+    m_sceneThreads.clear();
+    m_sceneThreadsDone.clear();
+
+    flushStreamedUploads();  // Everything queued, copied and its callbacks run (so posted)
+
+    m_sceneShown = 0;  // Nothing posted is shown, now
+    applySceneUpdates();
+}
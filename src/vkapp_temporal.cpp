@@ -0,0 +1,77 @@
+// Temporal accumulation as its own pass.
+//
+//   trace:     every backend's storeSample writes the frame's samples
+//              (m_rtSampleBuffer), the first hits' motion vectors
+//              (m_rtMotionBuffer), and NdCurr/KdCurr.
+//   temporal:  temporal.comp reprojects each pixel's history along its
+//              motion vector, clamps it to the new samples'
+//              neighbourhood where the pixel moved, and blends, leaving
+//              the result and its history length in colCurr.
+//              It also carries the luminance moments along, and leaves
+//              the variance the denoiser is guided by in
+//              m_rtLumMomCurrBuffer.
+//
+// A moving camera no longer resets the history: it's carried along,
+// and capped at m_pcRay.historyCap samples while moving.
+
+#include <vector>
+
+#include "vkapp.h"
+
+#include "shaders/shared_structs.h"
+
+// The pass sees the ray tracer's descriptor sets and push constants,
+// as the ray query backend does.
+void VkApp::createTemporalPipeline()
+{
+    VkPushConstantRange pushConstant{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstantRay)};
+
+    std::vector<VkDescriptorSetLayout> descSetLayouts =
+        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
+        {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges    = &pushConstant;
+    pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descSetLayouts.size());
+    pipelineLayoutCreateInfo.pSetLayouts    = descSetLayouts.data();
+    vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_temporalPipelineLayout);
+
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_temporalPipelineLayout;
+    cpCreateInfo.stage = createShaderStageInfo(loadFile("spv/temporal.comp.spv"),
+                                               VK_SHADER_STAGE_COMPUTE_BIT);
+    vkCreateComputePipelines(m_device, m_pipelineCache, 1, &cpCreateInfo, nullptr,
+                             &m_temporalPipeline);
+    vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr);
+}
+
+void VkApp::destroyTemporal()
+{
+    vkDestroyPipeline(m_device, m_temporalPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_temporalPipelineLayout, nullptr);
+}
+
+void VkApp::temporalAccumulate()
+{
+    // The tracer's (or the checkerboard reconstruction's) outputs are read next
+    VkPipelineStageFlags writers = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    if (m_hasRtPipeline) writers |= VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, writers, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_temporalPipeline);
+    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_temporalPipelineLayout, 0, (uint32_t)descSets.size(),
+                            descSets.data(), 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_temporalPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(PushConstantRay), &m_pcRay);
+
+    // This MUST match the shader's local_size of 8x8
+    vkCmdDispatch(m_commandBuffer, (windowSize.width+7)/8, (windowSize.height+7)/8, 1);
+    // (The output images are copied next, after raytrace's barrier)
+}
@@ -0,0 +1,422 @@
+// Texture streaming: the shaders sample only a scene's texture levels
+// they ask for, within a memory budget (m_texBudgetMB).
+//
+//   loader thread:    decodes a texture into its whole mip chain, kept in
+//                     memory (TextureMips), creates its image of every
+//                     level, and uploads its coarse levels into it
+//                     (coarseLevel: up to TEX_STREAM_COARSE texels).
+//   shaders:          each texture sample records its LOD in the feedback
+//                     buffer (eTexFeedback), the finest per texture, and
+//                     samples no finer than its min LOD (eTexMinLod).
+//   streamTextures:   the render thread, at the start of a frame's
+//                     command buffer.  Reads last frame's feedback, takes
+//                     in the levels uploaded since, and picks the next
+//                     levels to stream in: a level finer at a time, the
+//                     textures furthest from their request first.  Over
+//                     budget, the least recently sampled textures give up
+//                     their finest level (never their coarse ones).
+//                     Writes the min LODs, if any changed.
+//   texture thread:   uploads a level into its texture's image (off the
+//                     graphics queue), posted to m_texReady once handed
+//                     over.
+//
+// A texture's image is made once: a level streamed in is copied into
+// it, and its min LOD lowered; evicting a level only raises the min LOD
+// again, its data left in place for the next promotion.  There's no
+// sparse residency here, so the image's memory is the whole chain's from
+// the start: the budget bounds the levels sampled and streamed, not
+// that.  A level being copied is in the transfer layout while the
+// frames sample the image's coarser ones.
+
+#include <algorithm>
+#include <cstring>
+
+#include "vkapp.h"
+
+#define STBI_FAILURE_USERMSG
+#include "stb_image.h"
+
+#include "shaders/shared_structs.h"
+
+static const int TEX_STREAM_COARSE = 128;   // Texels: the largest level always resident
+static const int TEX_STREAM_JOBS = 4;       // Levels being uploaded at once
+static const uint64_t TEX_STREAM_KEEP = 120; // Frames a sampled texture keeps its levels
+
+static VkDeviceSize levelBytes(const VkApp::TextureMips& mips, int level)
+{
+    VkDeviceSize bytes = 0;
+    for (size_t l = level; l < mips.levels.size(); l++)
+        bytes += mips.levels[l].size();
+    return bytes;
+}
+
+// Decoded, with every level box filtered from the one above
+std::shared_ptr<const VkApp::TextureMips> VkApp::loadTextureMips(const std::string& fileName)
+{
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load(true);
+    stbi_uc* pixels = stbi_load(fileName.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels)
+        throw std::runtime_error("failed to load texture image!");
+
+    auto mips = std::make_shared<TextureMips>();
+    mips->width  = width;
+    mips->height = height;
+    mips->levels.emplace_back(pixels, pixels + size_t(width)*height*4);
+    stbi_image_free(pixels);
+
+    for (int w = width, h = height; w > 1 || h > 1; ) {
+        int nw = std::max(1, w/2), nh = std::max(1, h/2);
+        const std::vector<uint8_t>& src = mips->levels.back();
+        std::vector<uint8_t> dst(size_t(nw)*nh*4);
+        for (int y = 0; y < nh; y++) {
+            int y0 = std::min(2*y, h - 1), y1 = std::min(2*y + 1, h - 1);
+            for (int x = 0; x < nw; x++) {
+                int x0 = std::min(2*x, w - 1), x1 = std::min(2*x + 1, w - 1);
+                for (int c = 0; c < 4; c++)
+                    dst[(size_t(y)*nw + x)*4 + c] = uint8_t(
+                        (src[(size_t(y0)*w + x0)*4 + c] + src[(size_t(y0)*w + x1)*4 + c]
+                         + src[(size_t(y1)*w + x0)*4 + c] + src[(size_t(y1)*w + x1)*4 + c] + 2) / 4); } }
+        mips->levels.push_back(std::move(dst));
+        w = nw;
+        h = nh; }
+
+    return mips;
+}
+
+// The finest level a texture always has on the GPU
+int VkApp::coarseLevel(const TextureMips& mips)
+{
+    int level = 0;
+    while (std::max(mips.width >> level, mips.height >> level) > TEX_STREAM_COARSE)
+        level++;
+    return level;
+}
+
+// An image of all mips' levels, their data to come (uploadTextureLevels)
+ImageWrap VkApp::createStreamedImage(const TextureMips& mips)
+{
+    uint32_t mipLevels = static_cast<uint32_t>(mips.levels.size());
+    ImageWrap myImage = createImageWrap(mips.width, mips.height, VK_FORMAT_R8G8B8A8_UNORM,
+                                        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mipLevels);
+    myImage.imageView = createImageView(myImage.image, VK_FORMAT_R8G8B8A8_UNORM,
+                                        VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+    myImage.sampler = createTextureSampler(mipLevels);
+    myImage.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return myImage;
+}
+
+// Mips' levels firstLevel to lastLevel (excluded) copied from memory into
+// image: all on the upload queue, no blits.  Just created, every level
+// is made ready to sample; else only those, whose old contents (unused,
+// below the min LOD) are discarded.
+void VkApp::uploadTextureLevels(const TextureMips& mips, VkImage image, int firstLevel, int lastLevel,
+                                bool created, std::function<void()> done)
+{
+    VkDeviceSize size = 0;
+    for (int l = firstLevel; l < lastLevel; l++)
+        size += mips.levels[l].size();
+
+    BufferWrap staging = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                          | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    std::vector<VkBufferImageCopy> regions;
+    uint8_t* data;
+    vkMapMemory(m_device, staging.memory, 0, size, 0, reinterpret_cast<void**>(&data));
+    VkDeviceSize offset = 0;
+    for (int l = firstLevel; l < lastLevel; l++) {
+        const std::vector<uint8_t>& level = mips.levels[l];
+        memcpy(data + offset, level.data(), level.size());
+
+        VkBufferImageCopy region{};
+        region.bufferOffset     = offset;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, uint32_t(l), 0, 1};
+        region.imageExtent      = {uint32_t(std::max(1, mips.width >> l)),
+                                   uint32_t(std::max(1, mips.height >> l)), 1};
+        regions.push_back(region);
+        offset += level.size(); }
+    vkUnmapMemory(m_device, staging.memory);
+
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, uint32_t(firstLevel),
+                                  uint32_t(lastLevel - firstLevel), 0, 1};
+    if (created)
+        range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, uint32_t(mips.levels.size()), 0, 1};
+
+    Upload upload;
+    upload.staging = {staging};
+    upload.copy = [staging, image, range, regions](VkCommandBuffer cmd) {
+        VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+        barrier.dstAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image               = image;
+        barrier.subresourceRange    = range;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+        vkCmdCopyBufferToImage(cmd, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               static_cast<uint32_t>(regions.size()), regions.data()); };
+
+    // Handed over ready to sample
+    VkImageMemoryBarrier handover{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    handover.dstAccessMask    = VK_ACCESS_SHADER_READ_BIT;
+    handover.oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    handover.newLayout        = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    handover.image            = image;
+    handover.subresourceRange = range;
+    upload.images = {handover};
+    upload.done = done;
+    queueUpload(std::move(upload), true);
+}
+
+void VkApp::createTexStreaming()
+{
+    VkDeviceSize size = sizeof(uint32_t)*m_textureSlots;
+    m_texFeedbackBW = createBufferWrap(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                                       | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                                       | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_texReadbackBW = createBufferWrap(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                       | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    void* mapped;
+    vkMapMemory(m_device, m_texReadbackBW.memory, 0, size, 0, &mapped);
+    memset(mapped, 0xff, size);  // Nothing sampled
+    m_texReadback = static_cast<const uint32_t*>(mapped);
+
+    // Written by the first streamTextures (m_texMinLod's empty till then)
+    m_texMinLodBW = createBufferWrap(sizeof(float)*m_textureSlots, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                                     | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_texMinLod.clear();
+}
+
+void VkApp::streamTextures(VkCommandBuffer cmd)
+{
+    // Is the last frame done?  On one queue, prepareFrame waited for it;
+    // async, its trace may still be running.  If not, its feedback waits
+    // for a later frame.
+    bool lastDone = vkGetFenceStatus(m_device, m_waitFence) == VK_SUCCESS;
+    if (m_asyncActive && m_asyncFrame > 0) {
+        uint64_t value = 0;
+        vkGetSemaphoreCounterValue(m_device, m_asyncTimeline, &value);
+        lastDone = lastDone && value >= 2*(m_asyncFrame - 1) + 1; }
+
+    // The feedback the last frame copied: the frame before's
+    if (lastDone && m_texFrame >= 2)
+        for (size_t s = 0; s < m_texStream.size(); s++) {
+            StreamedTexture& t = m_texStream[s];
+            uint32_t level = m_texReadback[s];
+            if (!t.mips || level == ~0u) continue;
+            t.requested = std::clamp(int(level) - TEX_FEEDBACK_BIAS, 0,
+                                     int(t.mips->levels.size()) - 1);
+            t.lastUsed = m_texFrame; }
+
+    // The levels uploaded since, sampled from this frame on: its submit
+    // waits for their copies, as for any upload acquired
+    std::vector<StreamedLevel> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_texMutex);
+        ready.swap(m_texReady);
+    }
+    for (StreamedLevel& r : ready) {
+        auto orphan = std::find_if(m_texOrphans.begin(), m_texOrphans.end(),
+                                   [&r](const ImageWrap& image) { return image.image == r.image; });
+        if (orphan != m_texOrphans.end()) {  // Of a scene replaced
+            waitUploadsAcquired();  // Its copy may be running
+            orphan->destroy(m_device);
+            m_texOrphans.erase(orphan);
+            continue; }
+        if (r.generation != m_sceneShown || r.slot >= int(m_texStream.size()))
+            continue;
+        StreamedTexture& t = m_texStream[r.slot];
+        t.pending = -1;
+        if (!r.uploaded) continue;
+        t.uploaded = t.resident = r.level; }
+
+    // What's sampled, counting the levels on their way as there already
+    // (an eviction takes effect at once)
+    VkDeviceSize budget = VkDeviceSize(m_texBudgetMB) << 20;
+    VkDeviceSize committed = 0;
+    int busy = 0;
+    for (StreamedTexture& t : m_texStream) {
+        if (!t.mips) continue;
+        committed += levelBytes(*t.mips, t.pending >= 0 ? t.pending : t.resident);
+        busy += t.pending >= 0; }
+
+    // The least recently sampled texture that may give up a level: not
+    // sampled for a while, or not at its finest.  Over budget, any.
+    auto victim = [this](int except, bool any) {
+        int found = -1;
+        for (int s = 0; s < int(m_texStream.size()); s++) {
+            const StreamedTexture& t = m_texStream[s];
+            if (s == except || !t.mips || t.pending >= 0 || t.resident >= coarseLevel(*t.mips))
+                continue;
+            if (!any && t.requested <= t.resident && t.lastUsed + TEX_STREAM_KEEP > m_texFrame)
+                continue;
+            if (found < 0 || t.lastUsed < m_texStream[found].lastUsed)
+                found = s; }
+        return found; };
+    auto evict = [&](int s) {
+        StreamedTexture& t = m_texStream[s];
+        committed -= t.mips->levels[t.resident].size();
+        t.resident++; };
+
+    while (committed > budget) {  // The budget was lowered
+        int s = victim(-1, true);
+        if (s < 0) break;
+        evict(s); }
+
+    std::vector<int> wanted;
+    for (int s = 0; s < int(m_texStream.size()); s++) {
+        const StreamedTexture& t = m_texStream[s];
+        if (t.mips && t.pending < 0 && t.requested < t.resident)
+            wanted.push_back(s); }
+    std::sort(wanted.begin(), wanted.end(), [this](int a, int b) {
+        const StreamedTexture& ta = m_texStream[a];
+        const StreamedTexture& tb = m_texStream[b];
+        if (ta.resident - ta.requested != tb.resident - tb.requested)
+            return ta.resident - ta.requested > tb.resident - tb.requested;
+        return ta.lastUsed > tb.lastUsed; });
+
+    // A level still in the image (evicted) is sampled again at once;
+    // another's uploaded first
+    for (int s : wanted) {
+        StreamedTexture& t = m_texStream[s];
+        int level = t.resident - 1;
+        bool upload = level < t.uploaded;
+        if (upload && busy >= TEX_STREAM_JOBS) continue;
+        VkDeviceSize cost = t.mips->levels[level].size();
+        while (committed + cost > budget) {
+            int v = victim(s, false);
+            if (v < 0) break;
+            evict(v); }
+        if (committed + cost > budget) break;
+        committed += cost;
+        if (upload) {
+            streamTextureLevel(s, level);
+            busy++; }
+        else
+            t.resident = level; }
+
+    m_texResidentBytes = 0;
+    std::vector<float> minLod(m_textureSlots, 0.0f);  // Not streamed: all its levels
+    for (size_t s = 0; s < m_texStream.size() && s < minLod.size(); s++) {
+        const StreamedTexture& t = m_texStream[s];
+        if (!t.mips) continue;
+        m_texResidentBytes += levelBytes(*t.mips, t.resident);
+        minLod[s] = float(t.resident); }
+    bool minLodChanged = minLod != m_texMinLod;
+
+    // This frame's feedback: last frame's copied out, and reset.  And
+    // the min LODs, after the last frame's reads.
+    {
+        VkBufferMemoryBarrier written{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+        written.srcAccessMask       = VK_ACCESS_SHADER_WRITE_BIT;
+        written.dstAccessMask       = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        written.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        written.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        written.buffer              = m_texFeedbackBW.buffer;
+        written.size                = VK_WHOLE_SIZE;
+        VkBufferMemoryBarrier read = written;
+        read.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        read.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        read.buffer        = m_texMinLodBW.buffer;
+        VkBufferMemoryBarrier before[] = {written, read};
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, minLodChanged ? 2 : 1, before, 0, nullptr);
+
+        VkBufferCopy region{0, 0, sizeof(uint32_t)*m_textureSlots};
+        vkCmdCopyBuffer(cmd, m_texFeedbackBW.buffer, m_texReadbackBW.buffer, 1, &region);
+        vkCmdFillBuffer(cmd, m_texFeedbackBW.buffer, 0, VK_WHOLE_SIZE, ~0u);
+        if (minLodChanged) {
+            vkCmdUpdateBuffer(cmd, m_texMinLodBW.buffer, 0, sizeof(float)*minLod.size(), minLod.data());
+            m_texMinLod = minLod; }
+
+        VkBufferMemoryBarrier reset = written;
+        reset.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        reset.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        VkBufferMemoryBarrier copied = written;
+        copied.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        copied.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        copied.buffer        = m_texReadbackBW.buffer;
+        VkBufferMemoryBarrier updated = written;
+        updated.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        updated.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        updated.buffer        = m_texMinLodBW.buffer;
+        VkBufferMemoryBarrier after[] = {reset, copied, updated};
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+                             0, nullptr, minLodChanged ? 3 : 2, after, 0, nullptr);
+    }
+    m_texFrame++;
+}
+
+// Slot's level, uploaded into its image by the texture thread
+void VkApp::streamTextureLevel(int slot, int level)
+{
+    StreamedTexture& t = m_texStream[slot];
+    t.pending = level;
+
+    uint64_t generation = m_sceneShown;
+    std::shared_ptr<const TextureMips> mips = t.mips;
+    VkImage image = m_objText[slot].image;
+    std::lock_guard<std::mutex> lock(m_texMutex);
+    m_texJobs.push_back([this, generation, slot, level, mips, image]() {
+        auto post = [this, generation, slot, level, image](bool uploaded) {
+            std::lock_guard<std::mutex> lock(m_texMutex);
+            m_texReady.push_back({generation, slot, level, uploaded, image}); };
+        try {
+            uploadTextureLevels(*mips, image, level, level + 1, false, [post]() { post(true); }); }
+        catch (const std::exception& e) {
+            printf("Texture streaming failed: %s\n", e.what());
+            post(false); } });
+    if (!m_texThread.joinable())
+        m_texThread = std::thread(&VkApp::texStreamWorker, this);
+    m_texCv.notify_one();
+}
+
+void VkApp::texStreamWorker()
+{
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_texMutex);
+            m_texCv.wait(lock, [this]() { return m_texQuit || !m_texJobs.empty(); });
+            if (m_texQuit) return;
+            job = std::move(m_texJobs.front());
+            m_texJobs.pop_front();
+        }
+        job();
+    }
+}
+
+// Before the scene loader's: its flush hands over this one's uploads too
+void VkApp::destroyTexStreaming()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_texMutex);
+        m_texQuit = true;
+    }
+    m_texCv.notify_one();
+    if (m_texThread.joinable())
+        m_texThread.join();  // Finishes the level in progress, if any
+
+    // No level's copy left running, or to come: destroyScene frees every
+    // image of the scene shown
+    flushStreamedUploads();
+    waitUploadsAcquired();
+    m_texReady.clear();
+    m_texJobs.clear();
+    for (StreamedTexture& t : m_texStream)
+        t.pending = -1;
+    for (ImageWrap& image : m_texOrphans)
+        image.destroy(m_device);
+    m_texOrphans.clear();
+
+    m_texFeedbackBW.destroy(m_device);
+    m_texReadbackBW.destroy(m_device);
+    m_texMinLodBW.destroy(m_device);
+}
@@ -0,0 +1,357 @@
+// Uploads to device local memory (createStagedBufferWrap, the lights,
+// createTextureImage), off the graphics queue.
+//
+//   queueUpload:     any thread.  An Upload is its staging buffers, the
+//                    transfer commands that copy from them, and the
+//                    buffers and images those write.
+//   upload thread:   takes the queued uploads in one batch, records
+//                    their copies on a transfer-only queue family and
+//                    releases what they wrote to the graphics family;
+//                    the batch signals a timeline semaphore.  It
+//                    doesn't wait for it: it goes on to the next batch,
+//                    and frees a batch's staging buffers once the
+//                    semaphore has passed it.
+//   acquireUploads:  the render thread, at the start of a frame's
+//                    command buffer.  Acquires what the released batches
+//                    wrote, records their graphics commands (mipmaps
+//                    need a blit, which a transfer queue can't do), and
+//                    runs their done callbacks.  The submit of that
+//                    command buffer waits on the semaphore for the last
+//                    of those batches (m_uploadWait): the release and
+//                    acquire are ordered by it, on the GPU.
+//   flushUploads:    blocks until everything queued is copied and
+//                    acquired.  submitTempCmdBuffer calls it, so a temp
+//                    command buffer may use anything uploaded before it.
+//
+// A streamed upload (the scene loader's meshes and textures, and the
+// texture levels of vkapp_texstream.cpp) queues behind the others, and
+// a batch takes at most UPLOAD_STREAM_BATCH of them; flushUploads
+// doesn't wait for the rest, so a temp command buffer isn't held up by
+// a whole scene streaming in.
+//
+// So the path tracer keeps drawing while meshes and textures stream in.
+// Without a transfer-only family (or timeline semaphores) an upload is
+// copied on the graphics queue by the render thread and waited on, as
+// before.
+
+#include <vector>
+#include <chrono>
+
+#include "vkapp.h"
+
+void VkApp::createUploader()
+{
+    if (!m_transferQueue) {
+        printf("Uploads: on the graphics queue\n");
+        return; }
+
+    VkCommandPoolCreateInfo poolCreateInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolCreateInfo.queueFamilyIndex = m_transferQueueIndex;
+    if (vkCreateCommandPool(m_device, &poolCreateInfo, nullptr, &m_transferCmdPool) != VK_SUCCESS)
+        throw std::runtime_error("failed to create transfer command pool!");
+
+    VkSemaphoreTypeCreateInfo typeInfo{VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue  = 0;
+    VkSemaphoreCreateInfo semCreateInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    semCreateInfo.pNext = &typeInfo;
+    if (vkCreateSemaphore(m_device, &semCreateInfo, nullptr, &m_uploadTimeline) != VK_SUCCESS)
+        throw std::runtime_error("failed to create timeline semaphore!");
+
+    printf("Uploads: on queue family %u, by the upload thread\n", m_transferQueueIndex);
+}
+
+// The worker starts with the first upload.
+void VkApp::queueUpload(Upload upload, bool stream)
+{
+    std::lock_guard<std::mutex> lock(m_uploadMutex);
+    (stream ? m_uploadStream : m_uploadJobs).push_back(std::move(upload));
+    if (m_transferQueue && !m_uploadThread.joinable())
+        m_uploadThread = std::thread(&VkApp::uploadWorker, this);
+    m_uploadCv.notify_one();
+}
+
+// The upload thread's batches whose copies have finished: free their
+// command buffers and staging buffers.  wait: for all of them.
+void VkApp::retireUploads(bool wait)
+{
+    if (m_uploadsInFlight.empty())
+        return;
+    if (wait) {
+        VkSemaphoreWaitInfo waitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores    = &m_uploadTimeline;
+        waitInfo.pValues        = &m_uploadsInFlight.back().value;
+        vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX); }
+
+    uint64_t copied = 0;
+    vkGetSemaphoreCounterValue(m_device, m_uploadTimeline, &copied);
+    while (!m_uploadsInFlight.empty() && m_uploadsInFlight.front().value <= copied) {
+        UploadBatch& done = m_uploadsInFlight.front();
+        vkFreeCommandBuffers(m_device, m_transferCmdPool, 1, &done.cmd);
+        for (BufferWrap& staging : done.staging)
+            staging.destroy(m_device);
+        m_uploadsInFlight.pop_front(); }
+}
+
+void VkApp::uploadWorker()
+{
+    while (true) {
+        std::deque<Upload> batch;
+        {
+            std::unique_lock<std::mutex> lock(m_uploadMutex);
+            auto ready = [this]() {
+                return m_uploadQuit || !m_uploadJobs.empty() || !m_uploadStream.empty(); };
+            // With batches in flight, wake now and then to retire them
+            if (m_uploadsInFlight.empty())
+                m_uploadCv.wait(lock, ready);
+            else if (!m_uploadCv.wait_for(lock, std::chrono::milliseconds(UPLOAD_RETIRE_MS), ready)) {
+                lock.unlock();
+                retireUploads(false);
+                continue; }
+            if (m_uploadQuit) {
+                lock.unlock();
+                retireUploads(true);
+                return; }
+            batch.swap(m_uploadJobs);
+            for (int i = 0; i < UPLOAD_STREAM_BATCH && !m_uploadStream.empty(); i++) {
+                batch.push_back(std::move(m_uploadStream.front()));
+                m_uploadStream.pop_front(); }
+            m_uploadsBusy = int(batch.size());
+        }
+
+        VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocateInfo.commandPool        = m_transferCmdPool;
+        allocateInfo.commandBufferCount = 1;
+        allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        VkCommandBuffer cmd;
+        vkAllocateCommandBuffers(m_device, &allocateInfo, &cmd);
+
+        VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(cmd, &beginInfo);
+
+        // The copies, then the release of everything they wrote.  (The
+        // acquire repeats each barrier, layouts and all.)
+        std::vector<VkBufferMemoryBarrier> buffers;
+        std::vector<VkImageMemoryBarrier> images;
+        for (Upload& upload : batch) {
+            upload.copy(cmd);
+            for (VkBufferMemoryBarrier barrier : upload.buffers) {
+                barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask       = 0;
+                barrier.srcQueueFamilyIndex = m_transferQueueIndex;
+                barrier.dstQueueFamilyIndex = m_graphicsQueueIndex;
+                buffers.push_back(barrier); }
+            for (VkImageMemoryBarrier barrier : upload.images) {
+                barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask       = 0;
+                barrier.srcQueueFamilyIndex = m_transferQueueIndex;
+                barrier.dstQueueFamilyIndex = m_graphicsQueueIndex;
+                images.push_back(barrier); } }
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr, uint32_t(buffers.size()), buffers.data(),
+                             uint32_t(images.size()), images.data());
+        vkEndCommandBuffer(cmd);
+
+        uint64_t value = ++m_uploadValue;
+        VkTimelineSemaphoreSubmitInfo timelineInfo{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues    = &value;
+        VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+        submitInfo.pNext                = &timelineInfo;
+        submitInfo.commandBufferCount   = 1;
+        submitInfo.pCommandBuffers      = &cmd;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores    = &m_uploadTimeline;
+        // The staging buffers go with the batch, until its copies finish
+        UploadBatch inFlight{value, cmd, {}};
+        for (Upload& upload : batch) {
+            upload.batch = value;
+            for (BufferWrap& staging : upload.staging)
+                inFlight.staging.push_back(staging);
+            upload.staging.clear(); }
+        bool submitted = vkQueueSubmit(m_transferQueue, 1, &submitInfo, VK_NULL_HANDLE) == VK_SUCCESS;
+        if (!submitted) {
+            // Nothing will signal value: none of them may be handed over
+            printf("Upload failed: %zu uploads dropped\n", batch.size());
+            vkFreeCommandBuffers(m_device, m_transferCmdPool, 1, &cmd);
+            for (BufferWrap& staging : inFlight.staging)
+                staging.destroy(m_device); }
+        else
+            m_uploadsInFlight.push_back(std::move(inFlight));
+
+        {
+            std::lock_guard<std::mutex> lock(m_uploadMutex);
+            if (submitted)
+                for (Upload& upload : batch)
+                    m_uploadsCopied.push_back(std::move(upload));
+            m_uploadsBusy = 0;
+            m_uploadBatches++;
+        }
+        m_uploadIdleCv.notify_all();
+        retireUploads(false);
+    }
+}
+
+// Submit a command buffer from m_cmdPool and wait for it.  (Not
+// submitTempCmdBuffer, which flushes the uploads.)  With a timeline
+// semaphore, it first waits for the value on it.
+static void submitAndWait(VkDevice device, VkQueue queue, VkCommandPool pool, VkCommandBuffer cmd,
+                          VkSemaphore timeline = VK_NULL_HANDLE, uint64_t value = 0)
+{
+    vkEndCommandBuffer(cmd);
+    VkPipelineStageFlags stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues    = &value;
+    VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers    = &cmd;
+    if (timeline) {
+        submitInfo.pNext              = &timelineInfo;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores    = &timeline;
+        submitInfo.pWaitDstStageMask  = &stage; }
+    vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(queue);
+    vkFreeCommandBuffers(device, pool, 1, &cmd);
+}
+
+// Record the handover of every released upload into cmd, on the graphics
+// queue, and run their done callbacks.  Without the upload thread, the
+// queued uploads are copied now (blocking), in command buffers of their
+// own.  True if there were any.
+bool VkApp::acquireUploads(VkCommandBuffer cmd)
+{
+    std::deque<Upload> copied;
+    {
+        std::lock_guard<std::mutex> lock(m_uploadMutex);
+        copied.swap(m_transferQueue ? m_uploadsCopied : m_uploadJobs);
+        if (!m_transferQueue)
+            for (int i = 0; i < UPLOAD_STREAM_BATCH && !m_uploadStream.empty(); i++) {
+                copied.push_back(std::move(m_uploadStream.front()));
+                m_uploadStream.pop_front(); }
+    }
+    if (copied.empty())
+        return false;
+
+    if (m_transferQueue) {
+        std::vector<VkBufferMemoryBarrier> buffers;
+        std::vector<VkImageMemoryBarrier> images;
+        for (Upload& upload : copied) {
+            m_uploadWait = std::max(m_uploadWait, upload.batch);
+            for (VkBufferMemoryBarrier barrier : upload.buffers) {
+                barrier.srcAccessMask       = 0;
+                barrier.srcQueueFamilyIndex = m_transferQueueIndex;
+                barrier.dstQueueFamilyIndex = m_graphicsQueueIndex;
+                buffers.push_back(barrier); }
+            for (VkImageMemoryBarrier barrier : upload.images) {
+                barrier.srcAccessMask       = 0;
+                barrier.srcQueueFamilyIndex = m_transferQueueIndex;
+                barrier.dstQueueFamilyIndex = m_graphicsQueueIndex;
+                images.push_back(barrier); } }
+        // No source stage: the submit's wait on m_uploadWait orders it
+        // after the release
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_NONE, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             0, nullptr, uint32_t(buffers.size()), buffers.data(),
+                             uint32_t(images.size()), images.data());
+        for (Upload& upload : copied)
+            if (upload.acquired)
+                upload.acquired(cmd); }
+    else {
+        // All on the graphics queue: no ownership to transfer
+        VkCommandBuffer uploadCmd = createTempCmdBuffer();
+        for (Upload& upload : copied) {
+            upload.copy(uploadCmd);
+            std::vector<VkBufferMemoryBarrier> buffers = upload.buffers;
+            std::vector<VkImageMemoryBarrier> images = upload.images;
+            for (VkBufferMemoryBarrier& barrier : buffers) {
+                barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED; }
+            for (VkImageMemoryBarrier& barrier : images) {
+                barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED; }
+            vkCmdPipelineBarrier(uploadCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                                 0, nullptr, uint32_t(buffers.size()), buffers.data(),
+                                 uint32_t(images.size()), images.data());
+            if (upload.acquired)
+                upload.acquired(uploadCmd); }
+        submitAndWait(m_device, m_queue, m_cmdPool, uploadCmd);
+        for (Upload& upload : copied)
+            for (BufferWrap& staging : upload.staging)
+                staging.destroy(m_device); }
+
+    for (Upload& upload : copied)
+        if (upload.done)
+            upload.done();
+    return true;
+}
+
+void VkApp::flushUploads()
+{
+    if (m_transferQueue) {
+        std::unique_lock<std::mutex> lock(m_uploadMutex);
+        if (m_uploadJobs.empty() && m_uploadsBusy == 0 && m_uploadsCopied.empty())
+            return;
+        // The batch being copied, and the next (which takes all the
+        // queued jobs); not the streamed batches after them
+        uint64_t last = m_uploadBatches + (m_uploadsBusy ? 1 : 0) + (m_uploadJobs.empty() ? 0 : 1);
+        m_uploadIdleCv.wait(lock, [this, last]() { return m_uploadBatches >= last; });
+    }
+
+    VkCommandBuffer cmd = createTempCmdBuffer();
+    if (acquireUploads(cmd) && m_transferQueue)
+        submitAndWait(m_device, m_queue, m_cmdPool, cmd, m_uploadTimeline, m_uploadWait);
+    else {
+        vkEndCommandBuffer(cmd);
+        vkFreeCommandBuffers(m_device, m_cmdPool, 1, &cmd); }
+}
+
+// Block until the copies of every upload handed over so far are done.
+// Before freeing what a done callback posted: the frame that acquired
+// it waits for its copies, the callback doesn't.
+void VkApp::waitUploadsAcquired()
+{
+    if (!m_uploadTimeline)
+        return;
+    VkSemaphoreWaitInfo waitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores    = &m_uploadTimeline;
+    waitInfo.pValues        = &m_uploadWait;
+    vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX);
+}
+
+// flushUploads, until the streamed uploads are done too
+void VkApp::flushStreamedUploads()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_uploadMutex);
+        while (!m_uploadStream.empty()) {
+            lock.unlock();
+            flushUploads();
+            lock.lock(); }
+    }
+    flushUploads();
+}
+
+void VkApp::destroyUploader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_uploadMutex);
+        m_uploadQuit = true;
+    }
+    m_uploadCv.notify_one();
+    if (m_uploadThread.joinable())
+        m_uploadThread.join();  // Finishes the batch in progress, and retires them all
+
+    // Uploads never handed over: nothing waits for them now
+    for (std::deque<Upload>* uploads : {&m_uploadJobs, &m_uploadStream, &m_uploadsCopied})
+        for (Upload& upload : *uploads)
+            for (BufferWrap& staging : upload.staging)
+                staging.destroy(m_device);  // (None left, once copied)
+
+    vkDestroySemaphore(m_device, m_uploadTimeline, nullptr);
+    vkDestroyCommandPool(m_device, m_transferCmdPool, nullptr);
+}
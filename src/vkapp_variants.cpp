@@ -0,0 +1,208 @@
+// Pipeline variants specialized for the feature toggles.
+//
+//   The generic pipelines branch at run time on push constant flags
+//   (explicit light rays, ReSTIR, the MIS heuristic, the sampler; the
+//   scanline BRDF).  A variant fixes those flags as specialization
+//   constants (SPEC_* in shared_structs.h), so the driver compiles the
+//   branches not taken out of the hot shaders.
+//
+//   A frame asks for the variant matching its toggles.  The first ask
+//   queues a build on a worker thread and the frame carries on with the
+//   generic pipeline; once built, the variant is cached and used by
+//   every frame with the same toggles.  All builds share one
+//   VkPipelineCache, so variants after the first compile faster.
+//
+// Per-frame state (moved, useHistory, the frame seeds) stays in the
+// push constant: specializing on it would switch pipelines on every
+// camera move.  The wavefront stages aren't specialized.
+
+#include <vector>
+#include <cstring>  // for memcpy
+
+#include "vkapp.h"
+
+#include "shaders/shared_structs.h"
+
+// Ray tracer toggles, in specialization constant order
+struct RtSpec
+{
+    int explicitLights;
+    int restir;
+    int mis;
+    int sampler;
+};
+
+static const VkSpecializationMapEntry rtSpecEntries[] = {
+    {SPEC_EXPLICIT_LIGHTS, offsetof(RtSpec, explicitLights), sizeof(int)},
+    {SPEC_RESTIR,          offsetof(RtSpec, restir),         sizeof(int)},
+    {SPEC_MIS,             offsetof(RtSpec, mis),            sizeof(int)},
+    {SPEC_SAMPLER,         offsetof(RtSpec, sampler),        sizeof(int)}};
+
+static const VkSpecializationMapEntry scSpecEntry = {SPEC_BRDF, 0, sizeof(int)};
+
+// Request ids: the kind of pipeline above its key
+enum VariantKind { eVariantRt = 0, eVariantRq = 1, eVariantSc = 2 };
+static uint64_t variantId(VariantKind kind, uint32_t key) { return (uint64_t(kind) << 32) | key; }
+
+void VkApp::createPipelineCache()
+{
+    VkPipelineCacheCreateInfo info{VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    if (vkCreatePipelineCache(m_device, &info, nullptr, &m_pipelineCache) != VK_SUCCESS)
+        throw std::runtime_error("failed to create pipeline cache!");
+}
+
+// The ray tracer's toggles packed in one word: one bit each for the
+// booleans, two bits each for mis and sampler.
+uint32_t VkApp::rtVariantKey()
+{
+    return uint32_t(m_pcRay.ExplicitLightRays != 0)
+        | uint32_t(m_pcRay.useRestir != 0) << 1
+        | uint32_t(m_pcRay.mis & 3) << 2
+        | uint32_t(m_pcRay.sampler & 3) << 4;
+}
+
+// The megakernel variant for the current toggles, or nullptr (use
+// m_rtPipeline) while it's being built.
+const VkApp::RtVariant* VkApp::rtVariant()
+{
+    if (!useVariants) return nullptr;
+
+    uint32_t key = rtVariantKey();
+    {
+        std::lock_guard<std::mutex> lock(m_variantMutex);
+        auto found = m_rtVariants.find(key);
+        if (found != m_rtVariants.end()) return &found->second;
+    }
+
+    RtSpec spec{m_pcRay.ExplicitLightRays, m_pcRay.useRestir, m_pcRay.mis, m_pcRay.sampler};
+    requestVariant(variantId(eVariantRt, key), [this, key, spec]() {
+        VkSpecializationInfo info{4, rtSpecEntries, sizeof(RtSpec), &spec};
+
+        RtVariant variant;
+        variant.pipeline = buildRtPipeline(&info);
+
+        // The SBT has the generic one's layout, in host visible memory
+        // so that no queue is needed to fill it.
+        VkDeviceSize sbtSize = m_rgenRegion.size + m_missRegion.size + m_hitRegion.size;
+        variant.sbt = createBufferWrap(sbtSize,
+                                       VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                       | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
+                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                       | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        uint8_t* mapped;
+        vkMapMemory(m_device, variant.sbt.memory, 0, sbtSize, 0, (void**)&mapped);
+        writeShaderBindingTable(variant.pipeline, mapped);
+        vkUnmapMemory(m_device, variant.sbt.memory);
+
+        VkBufferDeviceAddressInfo addressInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
+        addressInfo.buffer = variant.sbt.buffer;
+        VkDeviceAddress sbtAddress = vkGetBufferDeviceAddress(m_device, &addressInfo);
+        variant.rgen = m_rgenRegion;
+        variant.miss = m_missRegion;
+        variant.hit  = m_hitRegion;
+        variant.rgen.deviceAddress = sbtAddress;
+        variant.miss.deviceAddress = sbtAddress + m_rgenRegion.size;
+        variant.hit.deviceAddress  = sbtAddress + m_rgenRegion.size + m_missRegion.size;
+
+        std::lock_guard<std::mutex> lock(m_variantMutex);
+        m_rtVariants[key] = variant; });
+
+    return nullptr;
+}
+
+// The ray query variant for the current toggles, or VK_NULL_HANDLE
+VkPipeline VkApp::rqVariant()
+{
+    if (!useVariants) return VK_NULL_HANDLE;
+
+    uint32_t key = rtVariantKey();
+    {
+        std::lock_guard<std::mutex> lock(m_variantMutex);
+        auto found = m_rqVariants.find(key);
+        if (found != m_rqVariants.end()) return found->second;
+    }
+
+    RtSpec spec{m_pcRay.ExplicitLightRays, m_pcRay.useRestir, m_pcRay.mis, m_pcRay.sampler};
+    requestVariant(variantId(eVariantRq, key), [this, key, spec]() {
+        VkSpecializationInfo info{4, rtSpecEntries, sizeof(RtSpec), &spec};
+        VkPipeline pipeline = buildRqPipeline(&info);
+
+        std::lock_guard<std::mutex> lock(m_variantMutex);
+        m_rqVariants[key] = pipeline; });
+
+    return VK_NULL_HANDLE;
+}
+
+// The scanline variant for the current BRDF, or VK_NULL_HANDLE
+VkPipeline VkApp::scVariant()
+{
+    if (!useVariants) return VK_NULL_HANDLE;
+
+    int brdf = (BRDF_var > 0) - (BRDF_var < 0);  // Only the sign selects the BRDF
+    {
+        std::lock_guard<std::mutex> lock(m_variantMutex);
+        auto found = m_scVariants.find(brdf);
+        if (found != m_scVariants.end()) return found->second;
+    }
+
+    requestVariant(variantId(eVariantSc, uint32_t(brdf+1)), [this, brdf]() {
+        VkSpecializationInfo info{1, &scSpecEntry, sizeof(int), &brdf};
+        VkPipeline pipeline = buildScPipeline(&info);
+
+        std::lock_guard<std::mutex> lock(m_variantMutex);
+        m_scVariants[brdf] = pipeline; });
+
+    return VK_NULL_HANDLE;
+}
+
+// Queue a build, once per variant; the worker starts with the first.
+void VkApp::requestVariant(uint64_t id, std::function<void()> build)
+{
+    std::lock_guard<std::mutex> lock(m_variantMutex);
+    if (!m_variantsRequested.insert(id).second) return;  // Built, or on its way
+
+    m_variantJobs.push_back(std::move(build));
+    if (!m_variantThread.joinable())
+        m_variantThread = std::thread(&VkApp::variantWorker, this);
+    m_variantCv.notify_one();
+}
+
+void VkApp::variantWorker()
+{
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_variantMutex);
+            m_variantCv.wait(lock, [this]() { return m_variantQuit || !m_variantJobs.empty(); });
+            if (m_variantQuit) return;
+            job = std::move(m_variantJobs.front());
+            m_variantJobs.pop_front();
+        }
+
+        // A failed build leaves its variant out: the generic pipeline
+        // keeps drawing those toggles.
+        try { job(); }
+        catch (const std::exception& e) { printf("Pipeline variant failed: %s\n", e.what()); }
+    }
+}
+
+void VkApp::destroyVariants()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_variantMutex);
+        m_variantQuit = true;
+    }
+    m_variantCv.notify_one();
+    if (m_variantThread.joinable())
+        m_variantThread.join();  // Finishes the build in progress, if any
+
+    for (auto& [key, variant] : m_rtVariants) {
+        vkDestroyPipeline(m_device, variant.pipeline, nullptr);
+        variant.sbt.destroy(m_device); }
+    for (auto& [key, pipeline] : m_rqVariants)
+        vkDestroyPipeline(m_device, pipeline, nullptr);
+    for (auto& [key, pipeline] : m_scVariants)
+        vkDestroyPipeline(m_device, pipeline, nullptr);
+
+    vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
+}
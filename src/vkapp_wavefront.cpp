@@ -0,0 +1,402 @@
+
+// Wavefront path tracer: the megakernel's bounce loop split into
+// stages that communicate through queues in device memory.
+//
+//   generate:  one path and one camera ray per pixel
+//   per bounce:
+//     extend:   trace the queued rays (vkCmdTraceRaysIndirectKHR)
+//     sort:     bucket the hits by material (count, scan, scatter)
+//     shade:    shade the hits in material order, queue shadow and next rays
+//     args:     turn the queue counters into indirect arguments
+//     connect:  trace the shadow rays (explicit lights only)
+//   resolve:   accumulate each path's radiance into the output images
+//
+// Only the rays still alive are traced and shaded at each bounce,
+// and rays hitting the same material are shaded together.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <math.h>
+
+#include "vkapp.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+#include "app.h"
+#include "shaders/shared_structs.h"
+
+template <class integral>
+constexpr integral align_up(integral x, size_t a) noexcept
+{
+    return integral((x + (integral(a) - 1)) & ~integral(a - 1));
+}
+
+// All stages see the same push constants: PushConstantRay, followed by PushConstantWavefront.
+static const VkShaderStageFlags wfStages = VK_SHADER_STAGE_RAYGEN_BIT_KHR
+    | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR
+    | VK_SHADER_STAGE_COMPUTE_BIT;
+
+// The queues, sized for one path per pixel.  Created on the first
+// wavefront frame, so the megakernel doesn't pay for their memory.
+void VkApp::createWavefrontBuffers()
+{
+    m_wfCapacity = windowSize.width * windowSize.height;
+    VkDeviceSize N = m_wfCapacity;
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+        | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    m_wfRaysBW       = createBufferWrap(2*N*sizeof(WfRay), usage,  // Current and next queues
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_wfHitsBW       = createBufferWrap(N*sizeof(WfHit), usage,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_wfShadowRaysBW = createBufferWrap(N*sizeof(WfShadowRay), usage,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_wfPathsBW      = createBufferWrap(N*sizeof(WfPath), usage,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_wfSortBW       = createBufferWrap((2*WF_SORT_BINS + N)*sizeof(uint), usage,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    // The counters double as indirect arguments, read by device address for trace rays.
+    m_wfCountersBW   = createBufferWrap(sizeof(WfCounters), usage
+                                        | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                                        | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkBufferDeviceAddressInfo info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
+    info.buffer = m_wfCountersBW.buffer;
+    m_wfCountersAddress = vkGetBufferDeviceAddress(m_device, &info);
+
+    printf("Wavefront buffers: %d paths, %.1f MB\n", m_wfCapacity,
+           N*(2*sizeof(WfRay) + sizeof(WfHit) + sizeof(WfShadowRay)
+              + sizeof(WfPath) + sizeof(uint))/(1024.0*1024.0));
+}
+
+void VkApp::createWavefrontDescriptorSet()
+{
+    VkShaderStageFlags stages = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+    m_wfDesc.setBindings(m_device, {
+            {WfBindings::eWfRays, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, stages},
+            {WfBindings::eWfHits, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, stages},
+            {WfBindings::eWfShadowRays, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, stages},
+            {WfBindings::eWfPaths, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, stages},
+            {WfBindings::eWfCounters, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, stages},
+            {WfBindings::eWfSort, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, stages},
+        });
+
+    m_wfDesc.write(m_device, WfBindings::eWfRays, m_wfRaysBW.buffer);
+    m_wfDesc.write(m_device, WfBindings::eWfHits, m_wfHitsBW.buffer);
+    m_wfDesc.write(m_device, WfBindings::eWfShadowRays, m_wfShadowRaysBW.buffer);
+    m_wfDesc.write(m_device, WfBindings::eWfPaths, m_wfPathsBW.buffer);
+    m_wfDesc.write(m_device, WfBindings::eWfCounters, m_wfCountersBW.buffer);
+    m_wfDesc.write(m_device, WfBindings::eWfSort, m_wfSortBW.buffer);
+}
+
+// One pipeline layout shared by the ray tracing stages (extend,
+// connect) and the compute stages (generate, sort, shade, args, resolve).
+void VkApp::createWavefrontPipelines()
+{
+    std::vector<VkPushConstantRange> pushConstants = {
+        {wfStages, 0, sizeof(PushConstantRay) + sizeof(PushConstantWavefront)}};
+
+    std::vector<VkDescriptorSetLayout> descSetLayouts =
+        {m_rtDesc.descSetLayout, m_scDesc.descSetLayout, m_wfDesc.descSetLayout};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
+        {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    pipelineLayoutCreateInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstants.size());
+    pipelineLayoutCreateInfo.pPushConstantRanges    = pushConstants.data();
+    pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descSetLayouts.size());
+    pipelineLayoutCreateInfo.pSetLayouts    = descSetLayouts.data();
+    vkCreatePipelineLayout(m_device, &pipelineLayoutCreateInfo, nullptr, &m_wfPipelineLayout);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////
+    // Ray tracing pipeline: two raygen shaders (extend, connect), the
+    // same miss, shadow miss and closest hit shaders as the megakernel.
+    std::vector<VkPipelineShaderStageCreateInfo> stages{};
+    std::vector<VkRayTracingShaderGroupCreateInfoKHR> groups{};
+
+    VkPipelineShaderStageCreateInfo stage{VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    stage.pName = "main";
+
+    VkRayTracingShaderGroupCreateInfoKHR group
+        {VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR};
+    group.anyHitShader       = VK_SHADER_UNUSED_KHR;
+    group.closestHitShader   = VK_SHADER_UNUSED_KHR;
+    group.generalShader      = VK_SHADER_UNUSED_KHR;
+    group.intersectionShader = VK_SHADER_UNUSED_KHR;
+
+    std::vector<std::pair<std::string, VkShaderStageFlagBits>> generalShaders = {
+        {"spv/wavefront_extend.rgen.spv", VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+        {"spv/wavefront_connect.rgen.spv", VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+        {"spv/raytrace.rmiss.spv", VK_SHADER_STAGE_MISS_BIT_KHR},
+        {"spv/raytraceShadow.rmiss.spv", VK_SHADER_STAGE_MISS_BIT_KHR}};
+
+    for (auto& [file, shaderStage] : generalShaders) {
+        stage.module = createShaderModule(loadFile(file));
+        stage.stage = shaderStage;
+        stages.push_back(stage);
+
+        group.type          = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+        group.generalShader = stages.size()-1;
+        groups.push_back(group);
+        group.generalShader = VK_SHADER_UNUSED_KHR; }
+
+    stage.module = createShaderModule(loadFile("spv/raytrace.rchit.spv"));
+    stage.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+    stages.push_back(stage);
+
+    group.type             = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
+    group.closestHitShader = stages.size()-1;
+    groups.push_back(group);
+
+    VkRayTracingPipelineCreateInfoKHR rayPipelineInfo
+        {VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR};
+    rayPipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+    rayPipelineInfo.pStages    = stages.data();
+    rayPipelineInfo.groupCount = static_cast<uint32_t>(groups.size());
+    rayPipelineInfo.pGroups    = groups.data();
+    rayPipelineInfo.maxPipelineRayRecursionDepth = 1;  // Only raygen shaders trace rays
+    rayPipelineInfo.layout                       = m_wfPipelineLayout;
+
+    vkCreateRayTracingPipelinesKHR(m_device, {}, {}, 1, &rayPipelineInfo, nullptr, &m_wfRtPipeline);
+    for (auto& s : stages)
+        vkDestroyShaderModule(m_device, s.module, nullptr);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////
+    // Compute pipelines
+    VkComputePipelineCreateInfo cpCreateInfo{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    cpCreateInfo.layout = m_wfPipelineLayout;
+
+    std::vector<std::pair<std::string, VkPipeline*>> computeShaders = {
+        {"spv/wavefront_generate.comp.spv", &m_wfGeneratePipeline},
+        {"spv/wavefront_sort.comp.spv", &m_wfSortPipeline},
+        {"spv/wavefront_shade.comp.spv", &m_wfShadePipeline},
+        {"spv/wavefront_args.comp.spv", &m_wfArgsPipeline},
+        {"spv/wavefront_resolve.comp.spv", &m_wfResolvePipeline}};
+
+    for (auto& [file, pipeline] : computeShaders) {
+        cpCreateInfo.stage = createShaderStageInfo(loadFile(file), VK_SHADER_STAGE_COMPUTE_BIT);
+        vkCreateComputePipelines(m_device, {}, 1, &cpCreateInfo, nullptr, pipeline);
+        vkDestroyShaderModule(m_device, cpCreateInfo.stage.module, nullptr); }
+}
+
+// As createRtShaderBindingTable, but with two raygen regions: extend and connect.
+void VkApp::createWavefrontShaderBindingTable()
+{
+    uint32_t missCount{2};
+    uint32_t hitCount{1};
+    auto     handleCount = 2 + missCount + hitCount;
+
+    uint32_t handleSizeAligned = align_up(handleSize, handleAlignment);
+
+    m_wfExtendRegion.stride = align_up(handleSizeAligned, baseAlignment);
+    m_wfExtendRegion.size   = m_wfExtendRegion.stride;
+    m_wfConnectRegion       = m_wfExtendRegion;
+
+    m_wfMissRegion.stride = handleSizeAligned;
+    m_wfMissRegion.size   = align_up(missCount * handleSizeAligned, baseAlignment);
+
+    m_wfHitRegion.stride  = handleSizeAligned;
+    m_wfHitRegion.size    = align_up(hitCount * handleSizeAligned, baseAlignment);
+
+    uint32_t             dataSize = handleCount * handleSize;
+    std::vector<uint8_t> handles(dataSize);
+    auto result = vkGetRayTracingShaderGroupHandlesKHR(m_device, m_wfRtPipeline,
+                                                       0, handleCount, dataSize, handles.data());
+    assert(result == VK_SUCCESS);
+
+    VkDeviceSize sbtSize = m_wfExtendRegion.size + m_wfConnectRegion.size
+        + m_wfMissRegion.size + m_wfHitRegion.size;
+
+    BufferWrap staging = createBufferWrap(sbtSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                      | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_wfShaderBindingTableBW = createBufferWrap(sbtSize,
+                                  VK_BUFFER_USAGE_TRANSFER_DST_BIT
+                                  | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                                  | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
+                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkBufferDeviceAddressInfo info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
+    info.buffer                    = m_wfShaderBindingTableBW.buffer;
+    VkDeviceAddress sbtAddress = vkGetBufferDeviceAddress(m_device, &info);
+
+    m_wfExtendRegion.deviceAddress  = sbtAddress;
+    m_wfConnectRegion.deviceAddress = sbtAddress + m_wfExtendRegion.size;
+    m_wfMissRegion.deviceAddress    = m_wfConnectRegion.deviceAddress + m_wfConnectRegion.size;
+    m_wfHitRegion.deviceAddress     = m_wfMissRegion.deviceAddress + m_wfMissRegion.size;
+
+    auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
+
+    uint8_t* mappedMemAddress;
+    vkMapMemory(m_device, staging.memory, 0, sbtSize, 0, (void**)&mappedMemAddress);
+
+    // Regions in the same order as the groups: extend, connect, miss x2, hit
+    uint32_t handleIdx{0};
+    VkDeviceSize offset = 0;
+    memcpy(mappedMemAddress+offset, getHandle(handleIdx++), handleSize);
+    offset += m_wfExtendRegion.size;
+    memcpy(mappedMemAddress+offset, getHandle(handleIdx++), handleSize);
+    offset += m_wfConnectRegion.size;
+    for(uint32_t c = 0; c < missCount; c++) {
+        memcpy(mappedMemAddress+offset + c*m_wfMissRegion.stride, getHandle(handleIdx++), handleSize); }
+    offset += m_wfMissRegion.size;
+    for(uint32_t c = 0; c < hitCount; c++) {
+        memcpy(mappedMemAddress+offset + c*m_wfHitRegion.stride, getHandle(handleIdx++), handleSize); }
+
+    vkUnmapMemory(m_device, staging.memory);
+
+    copyBuffer(staging.buffer, m_wfShaderBindingTableBW.buffer, sbtSize);
+
+    staging.destroy(m_device);
+}
+
+void VkApp::destroyWavefront()
+{
+    if (m_wfPipelineLayout == VK_NULL_HANDLE) return;  // Never used
+
+    vkDestroyPipeline(m_device, m_wfRtPipeline, nullptr);
+    vkDestroyPipeline(m_device, m_wfGeneratePipeline, nullptr);
+    vkDestroyPipeline(m_device, m_wfSortPipeline, nullptr);
+    vkDestroyPipeline(m_device, m_wfShadePipeline, nullptr);
+    vkDestroyPipeline(m_device, m_wfArgsPipeline, nullptr);
+    vkDestroyPipeline(m_device, m_wfResolvePipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_wfPipelineLayout, nullptr);
+    m_wfShaderBindingTableBW.destroy(m_device);
+    m_wfDesc.destroy(m_device);
+
+    m_wfRaysBW.destroy(m_device);
+    m_wfHitsBW.destroy(m_device);
+    m_wfShadowRaysBW.destroy(m_device);
+    m_wfPathsBW.destroy(m_device);
+    m_wfCountersBW.destroy(m_device);
+    m_wfSortBW.destroy(m_device);
+}
+
+// Every stage reads what the previous one wrote, either as shader
+// data or as indirect arguments.
+void VkApp::wavefrontBarrier()
+{
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+        | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+    vkCmdPipelineBarrier(m_commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                         | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                         | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                         | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+                         | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void VkApp::raytraceWavefront()
+{
+    if (m_wfPipelineLayout == VK_NULL_HANDLE) {
+        createWavefrontBuffers();
+        createWavefrontDescriptorSet();
+        createWavefrontPipelines();
+        createWavefrontShaderBindingTable(); }
+
+    uint32_t N = m_wfCapacity;
+    uint32_t shadeGroups = (N + WF_GROUP_SIZE - 1)/WF_GROUP_SIZE;
+
+    // All N camera rays are queued; the histogram starts empty.
+    WfCounters counters{};
+    counters.rayCount = N;
+    counters.traceArgs[0] = N;      counters.traceArgs[1] = 1;  counters.traceArgs[2] = 1;
+    counters.shadowArgs[0] = 0;     counters.shadowArgs[1] = 1; counters.shadowArgs[2] = 1;
+    counters.shadeArgs[0] = shadeGroups; counters.shadeArgs[1] = 1; counters.shadeArgs[2] = 1;
+    vkCmdUpdateBuffer(m_commandBuffer, m_wfCountersBW.buffer, 0, sizeof(WfCounters), &counters);
+    vkCmdFillBuffer(m_commandBuffer, m_wfSortBW.buffer, 0, WF_SORT_BINS*sizeof(uint), 0);
+
+    std::vector<VkDescriptorSet> descSets{m_rtDesc.descSet, m_scDesc.descSet, m_wfDesc.descSet};
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_wfPipelineLayout, 0, (uint32_t)descSets.size(),
+                            descSets.data(), 0, nullptr);
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+                            m_wfPipelineLayout, 0, (uint32_t)descSets.size(),
+                            descSets.data(), 0, nullptr);
+    vkCmdPushConstants(m_commandBuffer, m_wfPipelineLayout, wfStages,
+                       0, sizeof(PushConstantRay), &m_pcRay);
+
+    m_pcWf = PushConstantWavefront{};
+    m_pcWf.capacity = N;
+    auto pushWf = [&]() {
+        vkCmdPushConstants(m_commandBuffer, m_wfPipelineLayout, wfStages,
+                           sizeof(PushConstantRay), sizeof(PushConstantWavefront), &m_pcWf); };
+
+    VkDeviceAddress traceArgs  = m_wfCountersAddress + offsetof(WfCounters, traceArgs);
+    VkDeviceAddress shadowArgs = m_wfCountersAddress + offsetof(WfCounters, shadowArgs);
+    VkDeviceSize    shadeArgs  = offsetof(WfCounters, shadeArgs);
+
+    // Generate
+    pushWf();
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_wfGeneratePipeline);
+    vkCmdDispatch(m_commandBuffer, (windowSize.width+7)/8, (windowSize.height+7)/8, 1);
+    wavefrontBarrier();
+
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_wfRtPipeline);
+
+    // The paths end by Russian roulette in the shade stage; the queues
+    // just run dry, and the last bounces' indirect launches are empty.
+    for (int bounce=0;  bounce<m_pcRay.maxDepth;  bounce++) {
+        m_pcWf.bounce = bounce;
+        m_pcWf.queue  = bounce%2;
+
+        // Extend
+        pushWf();
+        vkCmdTraceRaysIndirectKHR(m_commandBuffer, &m_wfExtendRegion, &m_wfMissRegion,
+                                  &m_wfHitRegion, &m_callRegion, traceArgs);
+        wavefrontBarrier();
+
+        // Sort
+        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_wfSortPipeline);
+        for (m_pcWf.pass=0;  m_pcWf.pass<3;  m_pcWf.pass++) {
+            pushWf();
+            if (m_pcWf.pass == 1)
+                vkCmdDispatch(m_commandBuffer, 1, 1, 1);
+            else
+                vkCmdDispatchIndirect(m_commandBuffer, m_wfCountersBW.buffer, shadeArgs);
+            wavefrontBarrier(); }
+        m_pcWf.pass = 0;
+
+        // Shade
+        pushWf();
+        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_wfShadePipeline);
+        vkCmdDispatchIndirect(m_commandBuffer, m_wfCountersBW.buffer, shadeArgs);
+        wavefrontBarrier();
+
+        // Args
+        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_wfArgsPipeline);
+        vkCmdDispatch(m_commandBuffer, 1, 1, 1);
+        wavefrontBarrier();
+
+        // Connect
+        if (m_pcRay.ExplicitLightRays) {
+            vkCmdTraceRaysIndirectKHR(m_commandBuffer, &m_wfConnectRegion, &m_wfMissRegion,
+                                      &m_wfHitRegion, &m_callRegion, shadowArgs);
+            wavefrontBarrier(); }
+    }
+
+    // Resolve
+    vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_wfResolvePipeline);
+    vkCmdDispatch(m_commandBuffer, (windowSize.width+7)/8, (windowSize.height+7)/8, 1);
+
+    // The output images are copied next
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+}